@@ -12,6 +12,7 @@
 #include <memory>
 
 #include "protocol.h"
+#include "message_router.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
@@ -63,6 +64,8 @@ public:
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    // Subscribe to server JSON messages before the protocol starts
+    MessageRouter& GetMessageRouter() { return message_router_; }
 
 private:
     Application();
@@ -78,6 +81,7 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    MessageRouter message_router_;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
@@ -90,6 +94,9 @@ private:
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
+    int GetUplinkFrameDuration(ListeningMode mode) const;
+    bool OpenAudioChannel(ListeningMode mode);
+    void SubscribeMessages();
 };
 
 
@@ -25,6 +25,8 @@ public:
     virtual void EnableOutput(bool enable);
 
     virtual void OutputData(std::vector<int16_t>& data);
+    // Write a part of a buffer, like one chunk of the playback mixer
+    virtual void OutputData(const int16_t* data, size_t samples);
     virtual bool InputData(std::vector<int16_t>& data);
     virtual void Start();
 
@@ -1,6 +1,7 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -18,7 +19,16 @@
 #define TAG "AudioService"
 
 
-AudioService::AudioService() {
+AudioService::AudioService()
+    : audio_decode_queue_(MAX_DECODE_PACKETS_IN_QUEUE + MAX_TESTING_PACKETS_IN_QUEUE),
+      audio_send_queue_(MAX_SEND_PACKETS_IN_QUEUE),
+      audio_testing_queue_(MAX_TESTING_PACKETS_IN_QUEUE),
+      audio_encode_queue_(MAX_ENCODE_TASKS_IN_QUEUE),
+      audio_playback_queue_(MAX_PLAYBACK_TASKS_IN_QUEUE),
+      audio_effects_queue_(MAX_EFFECT_TASKS_IN_QUEUE),
+      jitter_buffer_(MAX_DECODE_PACKETS_IN_QUEUE, MAX_DECODE_QUEUE_DURATION_MS),
+      timestamp_queue_(MAX_TIMESTAMPS_IN_QUEUE + 1),
+      capture_stamp_queue_(MAX_CAPTURE_STAMPS_IN_QUEUE) {
     event_group_ = xEventGroupCreate();
 }
 
@@ -34,15 +44,33 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    decoder_pool_ = std::make_unique<DecoderPool>(codec->output_sample_rate());
+    /* Only the speech decoder is warmed, the 16 kHz 60 ms one of the system sounds is created by the first sound */
+    decoder_pool_->Prepare(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+    opus_encoder_.SetComplexity(complexity_controller_.complexity());
+    opus_encoder_.SetBitrate(complexity_controller_.bitrate());
+    opus_encoder_.Configure(16000, OPUS_FRAME_DURATION_MS);
+
+    encode_task_pool_ = std::make_unique<AudioTaskPool>(ENCODE_TASK_POOL_SIZE, MAX_OPUS_FRAME_DURATION_MS * 16000 / 1000);
+    playback_task_pool_ = std::make_unique<AudioTaskPool>(PLAYBACK_TASK_POOL_SIZE,
+        MAX_OPUS_FRAME_DURATION_MS * codec->output_sample_rate() / 1000);
+    send_packet_pool_ = std::make_unique<AudioPacketPool>(SEND_PACKET_POOL_SIZE, SEND_PACKET_PAYLOAD_SIZE);
+
+    mic_ring_.Configure(MIC_RING_DURATION_MS * 16000 / 1000, codec->input_channels());
 
     if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+        /* One pass for the microphone and the reference channels */
+        polyphase_input_resampler_ = CreatePolyphaseResampler(codec->input_sample_rate(), 16000, codec->input_channels());
+        if (!polyphase_input_resampler_) {
+            input_resampler_.Configure(codec->input_sample_rate(), 16000);
+            reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+        }
     }
 
+#if CONFIG_USE_AUDIO_DEBUGGER
+    audio_debugger_ = std::make_unique<AudioDebugger>();
+#endif
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -50,7 +78,12 @@ void AudioService::Initialize(AudioCodec* codec) {
 #endif
 
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+#if CONFIG_USE_AUDIO_DEBUGGER
+        audio_debugger_->Capture(kAudioDebugStreamProcessed, data.data(), data.size(), 1, 0, 16000);
+#endif
+        int64_t capture_time = TakeCaptureTime(data.size());
+        latency_tracer_.Record(kLatencyStageUplinkProcess, capture_time, esp_timer_get_time());
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data, capture_time);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
@@ -109,27 +142,37 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+    /* Start the opus encode and decode tasks */
+    xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
-        audio_service->OpusCodecTask();
+        audio_service->OpusEncodeTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_encode", OPUS_ENCODE_TASK_STACK_SIZE, this, OPUS_ENCODE_TASK_PRIORITY, &opus_encode_task_handle_,
+        OPUS_ENCODE_TASK_CORE < 0 ? tskNO_AFFINITY : OPUS_ENCODE_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecodeTask();
+        vTaskDelete(NULL);
+    }, "opus_decode", OPUS_DECODE_TASK_STACK_SIZE, this, OPUS_DECODE_TASK_PRIORITY, &opus_decode_task_handle_,
+        OPUS_DECODE_TASK_CORE < 0 ? tskNO_AFFINITY : OPUS_DECODE_TASK_CORE);
 }
 
 void AudioService::Stop() {
     esp_timer_stop(audio_power_timer_);
     service_stopped_ = true;
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    sound_player_.CancelAll();
+    audio_playback_queue_.Clear();
+    audio_effects_queue_.Clear();
+    audio_testing_queue_.Clear();
+
+    /* Wake up every task waiting on a running bit or a queue */
     xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
         AS_EVENT_WAKE_WORD_RUNNING |
-        AS_EVENT_AUDIO_PROCESSOR_RUNNING);
-
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+        AS_EVENT_AUDIO_PROCESSOR_RUNNING |
+        AS_EVENT_ALL_QUEUES);
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -140,30 +183,32 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     }
 
     if (codec_->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
-        if (!codec_->InputData(data)) {
+        input_buffer_.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
+        if (!codec_->InputData(input_buffer_)) {
             return false;
         }
-        if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
+        if (polyphase_input_resampler_) {
+            data.resize(polyphase_input_resampler_->GetOutputSamples(input_buffer_.size()));
+            polyphase_input_resampler_->Process(input_buffer_.data(), input_buffer_.size(), data.data());
+        } else if (codec_->input_channels() == 2) {
+            input_mic_buffer_.resize(input_buffer_.size() / 2);
+            input_reference_buffer_.resize(input_buffer_.size() / 2);
+            for (size_t i = 0, j = 0; i < input_mic_buffer_.size(); ++i, j += 2) {
+                input_mic_buffer_[i] = input_buffer_[j];
+                input_reference_buffer_[i] = input_buffer_[j + 1];
             }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
+            resampled_mic_buffer_.resize(input_resampler_.GetOutputSamples(input_mic_buffer_.size()));
+            resampled_reference_buffer_.resize(reference_resampler_.GetOutputSamples(input_reference_buffer_.size()));
+            input_resampler_.Process(input_mic_buffer_.data(), input_mic_buffer_.size(), resampled_mic_buffer_.data());
+            reference_resampler_.Process(input_reference_buffer_.data(), input_reference_buffer_.size(), resampled_reference_buffer_.data());
+            data.resize(resampled_mic_buffer_.size() + resampled_reference_buffer_.size());
+            for (size_t i = 0, j = 0; i < resampled_mic_buffer_.size(); ++i, j += 2) {
+                data[j] = resampled_mic_buffer_[i];
+                data[j + 1] = resampled_reference_buffer_[i];
             }
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            data.resize(input_resampler_.GetOutputSamples(input_buffer_.size()));
+            input_resampler_.Process(input_buffer_.data(), input_buffer_.size(), data.data());
         }
     } else {
         data.resize(samples * codec_->input_channels());
@@ -177,17 +222,27 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     debug_statistics_.input_count++;
 
 #if CONFIG_USE_AUDIO_DEBUGGER
-    // 音频调试：发送原始音频数据
-    if (audio_debugger_ == nullptr) {
-        audio_debugger_ = std::make_unique<AudioDebugger>();
+    // 音频调试：发送麦克风和参考信号
+    int channels = codec_->input_channels();
+    audio_debugger_->Capture(kAudioDebugStreamMic, data.data(), data.size() / channels, channels, 0, sample_rate);
+    if (channels == 2) {
+        audio_debugger_->Capture(kAudioDebugStreamReference, data.data(), data.size() / 2, 2, 1, sample_rate);
     }
-    audio_debugger_->Feed(data);
 #endif
 
     return true;
 }
 
 void AudioService::AudioInputTask() {
+    /* One I2S read feeds every consumer through the microphone ring, each at its own pace.
+     * The buffers are reused for every frame, the consumers copy what they need */
+    std::vector<int16_t> data;
+    std::vector<int16_t> feed;
+    MicRingCursor testing_cursor;
+    MicRingCursor wake_word_cursor;
+    MicRingCursor processor_cursor;
+    const size_t testing_feed_size = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
@@ -202,235 +257,492 @@ void AudioService::AudioInputTask() {
             continue;
         }
 
+        /* A consumer that was just enabled starts at the next read */
+        auto update_cursor = [this](MicRingCursor& cursor, bool running) {
+            if (running && !cursor.active) {
+                mic_ring_.Activate(cursor);
+            }
+            cursor.active = running;
+        };
+        update_cursor(testing_cursor, bits & AS_EVENT_AUDIO_TESTING_RUNNING);
+        update_cursor(wake_word_cursor, bits & AS_EVENT_WAKE_WORD_RUNNING);
+        update_cursor(processor_cursor, bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+
+        size_t wake_word_feed_size = wake_word_cursor.active ? wake_word_->GetFeedSize() : 0;
+        size_t processor_feed_size = processor_cursor.active ? audio_processor_->GetFeedSize() : 0;
+
+        /* Read as much as the consumer with the smallest feed size needs, so none of them waits longer than before */
+        size_t read_size = SIZE_MAX;
+        if (testing_cursor.active) {
+            read_size = std::min(read_size, testing_feed_size);
+        }
+        if (wake_word_feed_size > 0) {
+            read_size = std::min(read_size, wake_word_feed_size);
+        }
+        if (processor_feed_size > 0) {
+            read_size = std::min(read_size, processor_feed_size);
+        }
+        if (read_size == SIZE_MAX) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        if (!ReadAudioData(data, 16000, read_size)) {
+            ESP_LOGE(TAG, "Failed to read audio data");
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        int64_t read_time = esp_timer_get_time();
+        mic_ring_.Write(data.data(), data.size() / mic_ring_.channels());
+
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
-        if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+        while (testing_cursor.active && mic_ring_.Read(testing_cursor, feed, testing_feed_size)) {
+            if (audio_testing_queue_.Size() >= MAX_TESTING_PACKETS_IN_QUEUE) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
-                continue;
+                testing_cursor.active = false;
+                break;
             }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+            // If input channels is 2, we need to fetch the left channel data
+            if (mic_ring_.channels() == 2) {
+                for (size_t i = 0, j = 0; j < feed.size(); ++i, j += 2) {
+                    feed[i] = feed[j];
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
-                continue;
+                feed.resize(feed.size() / 2);
             }
+            PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, feed, read_time);
         }
 
         /* Feed the wake word */
-        if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = wake_word_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
-                    continue;
-                }
-            }
+        while (wake_word_feed_size > 0 && mic_ring_.Read(wake_word_cursor, feed, wake_word_feed_size)) {
+            wake_word_->Feed(feed);
         }
 
         /* Feed the audio processor */
-        if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
-            int samples = audio_processor_->GetFeedSize();
-            if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
-                    continue;
-                }
-            }
+        while (processor_feed_size > 0 && mic_ring_.Read(processor_cursor, feed, processor_feed_size)) {
+            /* Dropped if the processor falls behind, the output frames are then left unstamped */
+            capture_stamp_queue_.Push(CaptureStamp{read_time, processor_feed_size});
+            audio_processor_->Feed(std::move(feed));
         }
-
-        ESP_LOGE(TAG, "Should not be here, bits: %lx", bits);
-        break;
     }
 
     ESP_LOGW(TAG, "Audio input task stopped");
 }
 
 void AudioService::AudioOutputTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
-        if (service_stopped_) {
-            break;
+    while (!service_stopped_) {
+        /* Barge-in: fade out the playing speech within one chunk and drop what was received before the abort */
+        int64_t abort_time = playback_abort_time_.exchange(0);
+        if (abort_time > 0) {
+            speech_flush_time_ = abort_time;
+            barge_in_time_ = abort_time;
+            playback_mixer_.FadeOut(kMixerBusSpeech, PLAYBACK_ABORT_FADE_MS * codec_->output_sample_rate() / 1000);
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        /* Retire the frames written out completely and start the next frame of each bus */
+        for (int i = 0; i < kMixerBusCount; i++) {
+            auto bus = MixerBus(i);
+            if (playback_mixer_.Finished(bus)) {
+                auto task = playback_mixer_.Release(bus);
+                latency_tracer_.Record(kLatencyStageDownlinkTotal, task->origin_time, esp_timer_get_time());
+#if CONFIG_USE_SERVER_AEC
+                /* Record the timestamp for server AEC, drop it if the encoder side is not consuming */
+                if (task->timestamp > 0) {
+                    timestamp_queue_.Push(uint32_t(task->timestamp));
+                }
+#endif
+            }
+            auto& queue = bus == kMixerBusSpeech ? audio_playback_queue_ : audio_effects_queue_;
+            AudioTaskPtr task;
+            while (!playback_mixer_.Playing(bus) && queue.Pop(task)) {
+                xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_FULL);
+                if (bus == kMixerBusSpeech && task->origin_time != 0 && task->origin_time <= speech_flush_time_) {
+                    continue;
+                }
+                latency_tracer_.Record(kLatencyStageDownlinkPlaybackQueue, task->queue_time, esp_timer_get_time());
+                playback_mixer_.Feed(bus, std::move(task));
+            }
+        }
+
+        size_t samples = 0;
+        auto pcm = playback_mixer_.Mix(PLAYBACK_CHUNK_SAMPLES, samples);
+        if (pcm == nullptr) {
+            CheckBargeInDone();
+            xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_FULL);
+            xEventGroupWaitBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY, pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        }
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
-        codec_->OutputData(task->pcm);
+#if CONFIG_USE_AUDIO_DEBUGGER
+        audio_debugger_->Capture(kAudioDebugStreamPlayback, pcm, samples, 1, 0, codec_->output_sample_rate());
+#endif
+        auto start_time = esp_timer_get_time();
+        codec_->OutputData(pcm, samples);
+        latency_tracer_.Record(kLatencyStageDownlinkOutput, start_time, esp_timer_get_time());
+        CheckBargeInDone();
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
-
-#if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
-        }
-#endif
     }
 
+    playback_mixer_.Clear();
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
-void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
-            break;
-        }
+void AudioService::CheckBargeInDone() {
+    if (barge_in_time_ == 0 || (playback_mixer_.Playing(kMixerBusSpeech) && !playback_mixer_.Finished(kMixerBusSpeech))) {
+        return;
+    }
+    /* The fade is written, the speaker is silent at the latest when the DMA buffers have drained */
+    int64_t faded_time = esp_timer_get_time();
+    int64_t dma_us = int64_t(AUDIO_CODEC_DMA_DESC_NUM) * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / codec_->output_sample_rate();
+    latency_tracer_.Record(kLatencyStageBargeIn, barge_in_time_, faded_time + dma_us);
+    ESP_LOGI(TAG, "Barge-in: speech faded out in %ld ms, silent within %ld ms", (long)((faded_time - barge_in_time_) / 1000),
+        (long)((faded_time + dma_us - barge_in_time_) / 1000));
+    barge_in_time_ = 0;
+}
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+static void UpdateCodecTaskStatistics(CodecTaskStatistics& statistics, size_t queue_depth, int frame_duration_ms,
+    int64_t process_time_us) {
+    statistics.frames++;
+    statistics.audio_time_sum_ms += frame_duration_ms;
+    statistics.queue_depth_sum += queue_depth;
+    if (queue_depth > statistics.queue_depth_max) {
+        statistics.queue_depth_max = queue_depth;
+    }
+    statistics.process_time_sum_us += process_time_us;
+    if (process_time_us > statistics.process_time_max_us) {
+        statistics.process_time_max_us = process_time_us;
+    }
+}
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
+void AudioService::OpusDecodeTask() {
+    while (!service_stopped_) {
+        /* Local sounds go to the effects bus first, they do not wait for the speech bus */
+        std::unique_ptr<AudioStreamPacket> queued_packet;
+        AudioStreamPacket* packet = nullptr;
+        size_t queue_depth = audio_decode_queue_.Size();
+        if (!audio_effects_queue_.Full() && sound_player_.Next(sound_frame_)) {
+            if (sound_frame_.pcm != nullptr) {
+                /* Cached sound, straight to the mixer */
+                auto task = playback_task_pool_->Acquire(kAudioTaskTypeDecodeToPlaybackQueue);
+                task->timestamp = 0;
+                task->queue_time = esp_timer_get_time();
+                task->pcm.assign(sound_frame_.pcm, sound_frame_.pcm + sound_frame_.samples);
+                audio_effects_queue_.Push(std::move(task));
+                xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY);
+                continue;
             }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
+            packet = &sound_frame_.packet;
+        } else if (audio_playback_queue_.Full()) {
+            /* Wait for the speaker, or for a new sound */
+            xEventGroupWaitBits(event_group_, AS_EVENT_PLAYBACK_NOT_FULL | AS_EVENT_DECODE_NOT_EMPTY,
+                pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        } else if (audio_decode_queue_.Pop(queued_packet)) {
+            /* Audio testing goes through the decode queue and the server stream through the jitter buffer */
+            xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_FULL);
+            packet = queued_packet.get();
+        } else {
+            queued_packet = jitter_buffer_.Get();
+            packet = queued_packet.get();
+            if (packet == nullptr) {
+                int wait_ms = jitter_buffer_.GetWaitTimeMs();
+                /* A sound waiting for room on the effects bus resumes when the output task pops from it */
+                EventBits_t bits = AS_EVENT_DECODE_NOT_EMPTY;
+                if (!sound_player_.Empty() && audio_effects_queue_.Full()) {
+                    bits |= AS_EVENT_PLAYBACK_NOT_FULL;
+                }
+                xEventGroupWaitBits(event_group_, bits, pdTRUE, pdFALSE,
+                    wait_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms) + 1);
                 continue;
             }
+        }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+        auto start_time = esp_timer_get_time();
+        if (!packet->payload.empty() && !packet->decode_fec) {
+            /* Concealed and recovered frames are stamped when they leave the jitter buffer, they did not wait in it */
+            latency_tracer_.Record(kLatencyStageDownlinkJitterBuffer, packet->origin_time, start_time);
+        }
+        auto task = playback_task_pool_->Acquire(kAudioTaskTypeDecodeToPlaybackQueue);
+        task->timestamp = packet->timestamp;
+        task->origin_time = packet->origin_time;
+
+        if (decoder_pool_->Decode(packet->sample_rate, packet->frame_duration, std::move(packet->payload), task->pcm,
+                packet->decode_fec)) {
+            if (packet == &sound_frame_.packet) {
+                sound_player_.OnDecoded(&task->pcm);
+            }
+            task->queue_time = esp_timer_get_time();
+            latency_tracer_.Record(kLatencyStageDownlinkDecode, start_time, task->queue_time);
+            auto& queue = packet == &sound_frame_.packet ? audio_effects_queue_ : audio_playback_queue_;
+            queue.Push(std::move(task));
+            xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY);
+        } else {
+            ESP_LOGE(TAG, "Failed to decode audio");
+            if (packet == &sound_frame_.packet) {
+                sound_player_.OnDecoded(nullptr);
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
         }
+        debug_statistics_.decode_count++;
+        UpdateCodecTaskStatistics(decode_task_statistics_, queue_depth, packet->frame_duration, esp_timer_get_time() - start_time);
     }
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+    ESP_LOGW(TAG, "Opus decode task stopped");
 }
 
-void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
-        return;
+void AudioService::OpusEncodeTask() {
+    int frame_duration = OPUS_FRAME_DURATION_MS;
+    while (!service_stopped_) {
+        /* Wait for the application if the send queue is full */
+        if (audio_send_queue_.Full() || audio_send_queue_.Size() * frame_duration >= MAX_SEND_QUEUE_DURATION_MS) {
+            xEventGroupWaitBits(event_group_, AS_EVENT_SEND_NOT_FULL, pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        }
+
+        AudioTaskPtr task;
+        size_t queue_depth = audio_encode_queue_.Size();
+        if (!audio_encode_queue_.Pop(task)) {
+            xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_NOT_EMPTY, pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_NOT_FULL);
+
+        /* The frame duration follows the audio processor framing, recreate the encoder when it changes */
+        int duration = task->pcm.size() * 1000 / 16000;
+        if (duration != frame_duration) {
+            ESP_LOGI(TAG, "Opus encoder frame duration: %d -> %d ms", frame_duration, duration);
+            frame_duration = duration;
+            opus_encoder_.Configure(16000, frame_duration);
+        }
+
+        auto start_time = esp_timer_get_time();
+        latency_tracer_.Record(kLatencyStageUplinkEncodeQueue, task->queue_time, start_time);
+        auto packet = send_packet_pool_->Acquire();
+        packet->frame_duration = frame_duration;
+        packet->sample_rate = 16000;
+        packet->timestamp = task->timestamp;
+        packet->origin_time = task->origin_time;
+        if (!opus_encoder_.Encode(task->pcm, *packet)) {
+            ESP_LOGE(TAG, "Failed to encode audio");
+            continue;
+        }
+        packet->queue_time = esp_timer_get_time();
+        latency_tracer_.Record(kLatencyStageUplinkEncode, start_time, packet->queue_time);
+        auto encode_time = packet->queue_time - start_time;
+        UpdateCodecTaskStatistics(encode_task_statistics_, queue_depth, frame_duration, encode_time);
+        if (complexity_controller_.OnFrameEncoded(frame_duration, encode_time, packet->size(),
+                queue_depth >= MAX_ENCODE_TASKS_IN_QUEUE)) {
+            opus_encoder_.SetComplexity(complexity_controller_.complexity());
+            opus_encoder_.SetBitrate(complexity_controller_.bitrate());
+        }
+
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            audio_send_queue_.Push(std::move(packet));
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
+            }
+        } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+            /* Audio testing keeps up to 10 seconds of frames, more than the pool holds, they are copied out of it
+             * without the headroom, the decoder reads the whole payload */
+            auto testing_packet = std::make_unique<AudioStreamPacket>();
+            testing_packet->sample_rate = packet->sample_rate;
+            testing_packet->frame_duration = packet->frame_duration;
+            testing_packet->timestamp = packet->timestamp;
+            testing_packet->payload.assign(packet->data(), packet->data() + packet->size());
+            audio_testing_queue_.Push(std::move(testing_packet));
+        }
+        debug_statistics_.encode_count++;
+    }
+
+    ESP_LOGW(TAG, "Opus encode task stopped");
+}
+
+void AudioService::PrintCodecTaskStatistics() {
+    auto print = [](const char* name, const CodecTaskStatistics& statistics) {
+        if (statistics.frames == 0) {
+            return;
+        }
+        ESP_LOGI(TAG, "%s: frames=%lu queue avg=%.1f max=%lu, time avg=%lluus max=%luus, load=%.1f%%", name,
+            (unsigned long)statistics.frames, (double)statistics.queue_depth_sum / statistics.frames,
+            (unsigned long)statistics.queue_depth_max,
+            (unsigned long long)(statistics.process_time_sum_us / statistics.frames),
+            (unsigned long)statistics.process_time_max_us,
+            statistics.audio_time_sum_ms > 0 ? (double)statistics.process_time_sum_us / statistics.audio_time_sum_ms / 10 : 0.0);
+    };
+    print("Opus encode", encode_task_statistics_);
+    print("Opus decode", decode_task_statistics_);
+
+    auto& complexity = complexity_controller_.status();
+    if (encode_task_statistics_.frames > 0) {
+        auto& h = complexity.encode_time_histogram;
+        ESP_LOGI(TAG, "Opus encoder: complexity=%d/%d bitrate=%d sent=%lubps load=%lu%% raised=%lu lowered=%lu "
+            "overruns=%lu, encode time <1/2/4/8/16/32/64/64+ms: %lu/%lu/%lu/%lu/%lu/%lu/%lu/%lu", complexity.complexity,
+            complexity.max_complexity, complexity.bitrate,
+            (unsigned long)(complexity.encoded_time_ms > 0 ? complexity.encoded_bytes * 8000 / complexity.encoded_time_ms : 0),
+            (unsigned long)complexity.load_percent, (unsigned long)complexity.raised,
+            (unsigned long)complexity.lowered, (unsigned long)complexity.overruns,
+            (unsigned long)h[0], (unsigned long)h[1], (unsigned long)h[2], (unsigned long)h[3],
+            (unsigned long)h[4], (unsigned long)h[5], (unsigned long)h[6], (unsigned long)h[7]);
+    }
+
+    auto decoders = decoder_pool_->GetStatistics();
+    if (decoders.decodes > 0) {
+        ESP_LOGI(TAG, "Decoder pool: decodes=%lu switches=%lu creations=%lu evictions=%lu", (unsigned long)decoders.decodes,
+            (unsigned long)decoders.switches, (unsigned long)decoders.creations, (unsigned long)decoders.evictions);
+    }
+
+    auto mixer = playback_mixer_.GetStatistics();
+    if (mixer.mixed > 0) {
+        ESP_LOGI(TAG, "Playback mixer: mixed=%lu passthrough=%lu", (unsigned long)mixer.mixed, (unsigned long)mixer.passthrough);
+    }
+
+    auto sounds = sound_player_.GetCacheStatistics();
+    if (sounds.hits + sounds.misses > 0) {
+        ESP_LOGI(TAG, "Sound PCM cache: hits=%lu misses=%lu sounds=%lu bytes=%lu", (unsigned long)sounds.hits,
+            (unsigned long)sounds.misses, (unsigned long)sounds.sounds, (unsigned long)sounds.bytes);
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    auto jitter = jitter_buffer_.GetStatistics();
+    if (jitter.received > 0) {
+        ESP_LOGI(TAG, "Jitter buffer: received=%lu late=%lu dup=%lu overflow=%lu reordered=%lu concealed=%lu recovered=%lu "
+            "underruns=%lu, jitter=%lums target=%lu frames", (unsigned long)jitter.received, (unsigned long)jitter.late,
+            (unsigned long)jitter.duplicated, (unsigned long)jitter.overflowed, (unsigned long)jitter.reordered,
+            (unsigned long)jitter.concealed, (unsigned long)jitter.recovered, (unsigned long)jitter.underruns,
+            (unsigned long)jitter.jitter_ms,
+            (unsigned long)jitter.target_depth);
+    }
+
+    latency_tracer_.PrintSummary();
+}
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+void AudioService::PrepareDecoder(int sample_rate, int frame_duration) {
+    decoder_pool_->Prepare(sample_rate, frame_duration);
+}
+
+int64_t AudioService::TakeCaptureTime(size_t samples) {
+    /* The processor output is mono and keeps the input sample rate, so the samples line up with the reads.
+     * The frame is stamped with the read that delivered its first sample. */
+    int64_t time = 0;
+    while (samples > 0) {
+        if (capture_stamp_.samples == 0 && !capture_stamp_queue_.Pop(capture_stamp_)) {
+            break;
+        }
+        if (time == 0) {
+            time = capture_stamp_.time;
+        }
+        size_t taken = std::min(samples, capture_stamp_.samples);
+        capture_stamp_.samples -= taken;
+        samples -= taken;
     }
+    return time;
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
-    task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm, int64_t origin_time) {
+    /* Copy into a pooled buffer, so the caller keeps its own buffer and nothing is allocated */
+    auto task = encode_task_pool_->Acquire(type);
+    task->pcm.assign(pcm.begin(), pcm.end());
+    task->origin_time = origin_time;
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        size_t pending = timestamp_queue_.Size();
+        uint32_t timestamp;
+        if (timestamp_queue_.Pop(timestamp)) {
+            if (pending <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task->timestamp = timestamp;
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", pending);
+            }
+        }
+
+        /* The timestamp of a suppressed frame is dropped with it, the others keep their own */
+        if (uplink_dtx_enabled_) {
+            if (SuppressUplinkFrame(pcm.size() * 1000 / 16000)) {
+                /* Keep the last silent frame, it is sent ahead of the speech onset */
+                dtx_held_task_ = std::move(task);
+                return;
+            }
+            if (dtx_held_task_ && voice_detected_) {
+                PushEncodeTask(std::move(dtx_held_task_));
+            }
+            dtx_held_task_.reset();
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    PushEncodeTask(std::move(task));
+}
+
+bool AudioService::SuppressUplinkFrame(int frame_duration_ms) {
+    dtx_statistics_.frames++;
+    if (voice_detected_) {
+        dtx_silence_ms_ = 0;
+        dtx_keepalive_ms_ = 0;
+        return false;
+    }
+    dtx_silence_ms_ += frame_duration_ms;
+    if (dtx_silence_ms_ <= UPLINK_DTX_HANGOVER_MS) {
+        return false;
+    }
+    dtx_keepalive_ms_ += frame_duration_ms;
+    if (dtx_keepalive_ms_ >= UPLINK_DTX_KEEPALIVE_MS) {
+        dtx_keepalive_ms_ = 0;
+        dtx_statistics_.keepalives++;
+        return false;
+    }
+    dtx_statistics_.suppressed++;
+    return true;
+}
+
+void AudioService::PushEncodeTask(AudioTaskPtr task) {
+    /* Push the task to the encode queue, wait for the encoder if it is full */
+    task->queue_time = esp_timer_get_time();
+    while (!audio_encode_queue_.Push(std::move(task))) {
+        if (service_stopped_) {
+            return;
+        }
+        xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_NOT_FULL, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_NOT_EMPTY);
+}
+
+bool AudioService::PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!jitter_buffer_.Put(std::move(packet))) {
+        return false;
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
+    return true;
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+    std::unique_lock<std::mutex> lock(decode_producer_mutex_);
+    while (audio_decode_queue_.Size() * packet->frame_duration >= MAX_DECODE_QUEUE_DURATION_MS || audio_decode_queue_.Full()) {
+        if (!wait || service_stopped_) {
             return false;
         }
+        /* Do not block the other producers while waiting for the decoder */
+        lock.unlock();
+        xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_NOT_FULL, pdTRUE, pdFALSE, portMAX_DELAY);
+        lock.lock();
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    audio_decode_queue_.Push(std::move(packet));
+    lock.unlock();
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+AudioPacketPtr AudioService::PopPacketFromSendQueue() {
+    AudioPacketPtr packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(event_group_, AS_EVENT_SEND_NOT_FULL);
+    latency_tracer_.Record(kLatencyStageUplinkSendQueue, packet->queue_time, esp_timer_get_time());
     return packet;
 }
 
@@ -444,8 +756,8 @@ const std::string& AudioService::GetLastWakeWord() const {
     return wake_word_->GetLastDetectedWakeWord();
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
+AudioPacketPtr AudioService::PopWakeWordPacket() {
+    auto packet = send_packet_pool_->Acquire();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
         return packet;
     }
@@ -478,160 +790,128 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, encode_frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
 
         /* We should make sure no audio is playing */
         ResetDecoder();
+        /* The output callback is idle until Start(), drop the reads of the last session */
+        capture_stamp_queue_.Clear();
+        capture_stamp_.samples = 0;
+        /* Silence at the start still sends one frame, so the server sees the stream begin */
+        dtx_silence_ms_ = UPLINK_DTX_HANGOVER_MS;
+        dtx_keepalive_ms_ = UPLINK_DTX_KEEPALIVE_MS;
+        dtx_held_task_.reset();
+        dtx_statistics_ = UplinkDtxStatistics();
         audio_input_need_warmup_ = true;
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        if (uplink_dtx_enabled_ && dtx_statistics_.frames > 0) {
+            ESP_LOGI(TAG, "Uplink DTX: suppressed %lu of %lu frames, %lu keep-alive", (unsigned long)dtx_statistics_.suppressed,
+                (unsigned long)dtx_statistics_.frames, (unsigned long)dtx_statistics_.keepalives);
+        }
     }
 }
 
+void AudioService::EnableUplinkDtx(bool enable) {
+    /* Only read by the processor output callback, which is idle while voice processing is stopped */
+    uplink_dtx_enabled_ = enable && UPLINK_DTX_ENABLED;
+}
+
 void AudioService::EnableAudioTesting(bool enable) {
     ESP_LOGI(TAG, "%s audio testing", enable ? "Enabling" : "Disabling");
     if (enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Move audio_testing_queue_ to audio_decode_queue_, the decode queue is sized to hold all of it */
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            audio_decode_queue_.Clear();
+            std::unique_ptr<AudioStreamPacket> packet;
+            while (audio_testing_queue_.Pop(packet)) {
+                audio_decode_queue_.Push(std::move(packet));
+            }
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, encode_frame_duration_, models_list_);
         audio_processor_initialized_ = true;
     }
 
     audio_processor_->EnableDeviceAec(enable);
 }
 
+void AudioService::SetEncodeFrameDuration(int frame_duration_ms) {
+    if (frame_duration_ms != 20 && frame_duration_ms != 40 && frame_duration_ms != 60) {
+        ESP_LOGE(TAG, "Unsupported frame duration: %d ms", frame_duration_ms);
+        return;
+    }
+    if (frame_duration_ms == encode_frame_duration_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration_ms);
+    encode_frame_duration_ = frame_duration_ms;
+    /* The encoder follows the processor framing, see OpusEncodeTask */
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(frame_duration_ms);
+    }
+}
+
 void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
 
-void AudioService::PlaySound(const std::string_view& ogg) {
+SoundHandle AudioService::PlaySound(const std::string_view& ogg) {
     if (!codec_->output_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
-
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
-        }
+    auto handle = sound_player_.Play(ogg);
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
+    return handle;
+}
 
-        offset = body_off + body_size;
-    }
+void AudioService::AbortPlayback() {
+    playback_abort_time_ = esp_timer_get_time();
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    audio_playback_queue_.Clear();
+    /* Let the output task fade out at once, sounds on the effects bus keep playing */
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_FULL | AS_EVENT_PLAYBACK_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL);
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    /* A sound still being decoded or a frame still in the mixer, fading out included, keeps the device awake */
+    return audio_encode_queue_.Empty() && audio_decode_queue_.Empty() && jitter_buffer_.Empty() &&
+        audio_playback_queue_.Empty() && audio_effects_queue_.Empty() && audio_testing_queue_.Empty() &&
+        sound_player_.Empty() && playback_mixer_.Idle();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    /* Sounds keep playing on the effects bus, do not reset the decoder under them */
+    if (sound_player_.Empty()) {
+        decoder_pool_->ResetState();
+    }
+    timestamp_queue_.Clear();
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    /* Let the consumers release the cleared items and the producers see the free space */
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY | AS_EVENT_DECODE_NOT_FULL |
+        AS_EVENT_PLAYBACK_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -2,10 +2,9 @@
 #define AUDIO_SERVICE_H
 
 #include <memory>
-#include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -13,8 +12,6 @@
 #include <esp_timer.h>
 #include <model_path.h>
 
-#include <opus_encoder.h>
-#include <opus_decoder.h>
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
@@ -22,26 +19,102 @@
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
+#include "spsc_queue.h"
+#include "audio_task_pool.h"
+#include "jitter_buffer.h"
+#include "sound_player.h"
+#include "opus_complexity_controller.h"
+#include "latency_tracer.h"
+#include "mic_ring.h"
+#include "polyphase_resampler.h"
+#include "decoder_pool.h"
+#include "uplink_encoder.h"
+#include "playback_mixer.h"
 
 
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ *    Local sounds come from the {Sound Player} and audio testing from {Decode Queue}, both bypass the jitter buffer.
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
- * 
- * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
+ * The MIC is read once into a ring, the wake word, the processors and audio testing read it with their own cursors,
+ * so they can run at the same time.
+ *
+ * We use one task for MIC / Processors, one task for Speaker, and separate tasks for the Opus Encoder
+ * and the Opus Decoder, so a slow encode never delays playback and a burst of decoding never delays uplink.
  * 
+ * Decode Queue (with the Jitter Buffer) and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
+ *
+ * All queues are bounded lock-free SPSC rings. Each queue signals its own "not empty" / "not full"
+ * event bits, so a push only wakes the task that is waiting on that queue.
+ * The decode queue has several producers (PushPacketToDecodeQueue callers, audio testing); they are serialized
+ * by a producer-only mutex and never contend with the decoder.
  */
 
+#ifdef CONFIG_OPUS_FRAME_DURATION_MS
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
+#else
 #define OPUS_FRAME_DURATION_MS 60
+#endif
+// Uplink frame duration in kListeningModeRealtime, shorter frames for faster barge-in
+#define OPUS_REALTIME_FRAME_DURATION_MS 20
+#define MIN_OPUS_FRAME_DURATION_MS 20
+#define MAX_OPUS_FRAME_DURATION_MS 60
+// The encode / playback queues only hand PCM frames over between two tasks (double buffering)
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define MAX_EFFECT_TASKS_IN_QUEUE 2
+// Mixer output per codec write, one DMA frame, so an abort cuts in within one frame
+#define PLAYBACK_CHUNK_SAMPLES AUDIO_CODEC_DMA_FRAME_NUM
+// Speech fade-out on barge-in, short enough to feel instant, long enough not to click
+#define PLAYBACK_ABORT_FADE_MS 10
+// The Opus queues are limited by duration, the capacity is enough for the shortest frames
+#define MAX_DECODE_QUEUE_DURATION_MS 2400
+#define MAX_SEND_QUEUE_DURATION_MS 2400
+#define MAX_DECODE_PACKETS_IN_QUEUE (MAX_DECODE_QUEUE_DURATION_MS / MIN_OPUS_FRAME_DURATION_MS)
+#define MAX_SEND_PACKETS_IN_QUEUE (MAX_SEND_QUEUE_DURATION_MS / MIN_OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+#define MAX_TESTING_PACKETS_IN_QUEUE (AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS)
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+// Microphone frames kept for the consumers (wake word, processor, audio testing), more than any feed size
+#define MIC_RING_DURATION_MS 200
+// Microphone reads not yet matched to a processor output frame
+#define MAX_CAPTURE_STAMPS_IN_QUEUE 16
+// Tasks held outside the queues: one being filled by the producer and one being processed by the consumer,
+// the encode pool has one more for the frame held back by DTX
+#define ENCODE_TASK_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + 3)
+// The playback pool serves both mixer buses, each holds one more task while it plays
+#define PLAYBACK_TASK_POOL_SIZE (MAX_PLAYBACK_TASKS_IN_QUEUE + MAX_EFFECT_TASKS_IN_QUEUE + 3)
+// Uplink packets: the few in the send queue while the network keeps up, one being encoded and one being sent.
+// A longer backlog borrows heap packets, freed again when they are sent
+#define SEND_PACKET_POOL_SIZE 8
+// Payload reserved per pooled packet, the headroom and the largest Opus frame the encoder may write
+#define SEND_PACKET_PAYLOAD_SIZE 512
+
+#ifdef CONFIG_OPUS_ENCODE_TASK_PRIORITY
+#define OPUS_ENCODE_TASK_PRIORITY CONFIG_OPUS_ENCODE_TASK_PRIORITY
+#define OPUS_ENCODE_TASK_CORE CONFIG_OPUS_ENCODE_TASK_CORE
+#define OPUS_DECODE_TASK_PRIORITY CONFIG_OPUS_DECODE_TASK_PRIORITY
+#define OPUS_DECODE_TASK_CORE CONFIG_OPUS_DECODE_TASK_CORE
+#else
+#define OPUS_ENCODE_TASK_PRIORITY 2
+#define OPUS_ENCODE_TASK_CORE -1
+#define OPUS_DECODE_TASK_PRIORITY 2
+#define OPUS_DECODE_TASK_CORE -1
+#endif
+#define OPUS_ENCODE_TASK_STACK_SIZE (2048 * 13)
+#define OPUS_DECODE_TASK_STACK_SIZE (2048 * 6)
+
+#ifdef CONFIG_USE_UPLINK_DTX
+#define UPLINK_DTX_ENABLED true
+#else
+#define UPLINK_DTX_ENABLED false
+#endif
+// Frames still sent after the VAD reports silence
+#define UPLINK_DTX_HANGOVER_MS 400
+// One frame is sent this often during silence, so the server session stays alive
+#define UPLINK_DTX_KEEPALIVE_MS 1000
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -51,6 +124,16 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_PLAYBACK_NOT_FULL          (1 << 4)
+#define AS_EVENT_ENCODE_NOT_EMPTY           (1 << 5)
+#define AS_EVENT_ENCODE_NOT_FULL            (1 << 6)
+#define AS_EVENT_DECODE_NOT_EMPTY           (1 << 7)
+#define AS_EVENT_DECODE_NOT_FULL            (1 << 8)
+#define AS_EVENT_SEND_NOT_FULL              (1 << 9)
+#define AS_EVENT_ALL_QUEUES                 (AS_EVENT_PLAYBACK_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL | \
+                                             AS_EVENT_ENCODE_NOT_EMPTY | AS_EVENT_ENCODE_NOT_FULL | \
+                                             AS_EVENT_DECODE_NOT_EMPTY | AS_EVENT_DECODE_NOT_FULL | \
+                                             AS_EVENT_SEND_NOT_FULL)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
@@ -60,18 +143,6 @@ struct AudioServiceCallbacks {
 };
 
 
-enum AudioTaskType {
-    kAudioTaskTypeEncodeToSendQueue,
-    kAudioTaskTypeEncodeToTestingQueue,
-    kAudioTaskTypeDecodeToPlaybackQueue,
-};
-
-struct AudioTask {
-    AudioTaskType type;
-    std::vector<int16_t> pcm;
-    uint32_t timestamp;
-};
-
 struct DebugStatistics {
     uint32_t input_count = 0;
     uint32_t decode_count = 0;
@@ -79,6 +150,29 @@ struct DebugStatistics {
     uint32_t playback_count = 0;
 };
 
+// Time of a microphone read fed to the audio processor
+struct CaptureStamp {
+    int64_t time = 0;
+    size_t samples = 0;
+};
+
+// Uplink frames of one voice processing session
+struct UplinkDtxStatistics {
+    uint32_t frames = 0;
+    uint32_t suppressed = 0;        // Not encoded nor sent
+    uint32_t keepalives = 0;        // Sent during silence
+};
+
+// Per-direction statistics of the Opus encode / decode tasks
+struct CodecTaskStatistics {
+    uint32_t frames = 0;
+    uint64_t audio_time_sum_ms = 0;     // Duration of the frames, process_time_sum_us / audio_time_sum_ms is the CPU load
+    uint32_t queue_depth_max = 0;       // Input queue depth seen when a frame is taken
+    uint64_t queue_depth_sum = 0;
+    uint32_t process_time_max_us = 0;
+    uint64_t process_time_sum_us = 0;
+};
+
 class AudioService {
 public:
     AudioService();
@@ -88,7 +182,7 @@ public:
     void Start();
     void Stop();
     void EncodeWakeWord();
-    std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
+    AudioPacketPtr PopWakeWordPacket();
     const std::string& GetLastWakeWord() const;
     bool IsVoiceDetected() const { return voice_detected_; }
     bool IsIdle();
@@ -100,15 +194,42 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Skip the uplink frames while the VAD reports silence, needs the processor VAD (not with device AEC)
+    void EnableUplinkDtx(bool enable);
+    // Uplink frame duration (20 / 40 / 60 ms), call it while voice processing is stopped
+    void SetEncodeFrameDuration(int frame_duration_ms);
+    int GetEncodeFrameDuration() const { return encode_frame_duration_; }
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
-    std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
-    void PlaySound(const std::string_view& sound);
+    bool PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet);
+    // The packet goes back to the pool when the caller drops it, after Protocol::SendAudio()
+    AudioPacketPtr PopPacketFromSendQueue();
+    // Sounds play on the effects bus of the mixer, on top of the speech, ResetDecoder() does not stop them
+    SoundHandle PlaySound(const std::string_view& sound);
+    void SetPlaybackGain(MixerBus bus, int percent) { playback_mixer_.SetGain(bus, percent); }
+    // Speech volume while a sound plays, 100 disables ducking
+    void SetPlaybackDucking(int percent) { playback_mixer_.SetDucking(percent); }
+    PlaybackMixerStatistics GetPlaybackMixerStatistics() const { return playback_mixer_.GetStatistics(); }
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    // Barge-in: drop the queued speech and fade out the playing frame, the time to silence is traced
+    void AbortPlayback();
+    // Warm up the decoder of a stream before its first packet, like the server audio when the channel opens
+    void PrepareDecoder(int sample_rate, int frame_duration);
+    DecoderPoolStatistics GetDecoderPoolStatistics() { return decoder_pool_->GetStatistics(); }
     void SetModelsList(srmodel_list_t* models_list);
+    AudioTaskPoolStatistics GetEncodeTaskPoolStatistics() { return encode_task_pool_->GetStatistics(); }
+    AudioTaskPoolStatistics GetPlaybackTaskPoolStatistics() { return playback_task_pool_->GetStatistics(); }
+    AudioPacketPoolStatistics GetSendPacketPoolStatistics() { return send_packet_pool_->GetStatistics(); }
+    const CodecTaskStatistics& GetEncodeTaskStatistics() const { return encode_task_statistics_; }
+    const CodecTaskStatistics& GetDecodeTaskStatistics() const { return decode_task_statistics_; }
+    const OpusComplexityStatus& GetEncoderComplexityStatus() const { return complexity_controller_.status(); }
+    JitterBufferStatistics GetJitterBufferStatistics() { return jitter_buffer_.GetStatistics(); }
+    SoundPcmCacheStatistics GetSoundCacheStatistics() { return sound_player_.GetCacheStatistics(); }
+    LatencyTracer& GetLatencyTracer() { return latency_tracer_; }
+    void PrintCodecTaskStatistics();
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -116,12 +237,20 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    UplinkEncoder opus_encoder_;
+    std::unique_ptr<DecoderPool> decoder_pool_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Used instead of the Opus resamplers for the rate pairs it has a filter table for
+    std::unique_ptr<Resampler> polyphase_input_resampler_;
+    std::unique_ptr<AudioTaskPool> encode_task_pool_;
+    std::unique_ptr<AudioTaskPool> playback_task_pool_;
+    std::unique_ptr<AudioPacketPool> send_packet_pool_;
     DebugStatistics debug_statistics_;
+    CodecTaskStatistics encode_task_statistics_;
+    CodecTaskStatistics decode_task_statistics_;
+    OpusComplexityController complexity_controller_;
+    LatencyTracer latency_tracer_;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -129,22 +258,50 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    std::mutex decode_producer_mutex_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
+    SpscQueue<AudioPacketPtr> audio_send_queue_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
+    SpscQueue<AudioTaskPtr> audio_encode_queue_;
+    SpscQueue<AudioTaskPtr> audio_playback_queue_;    // Speech bus
+    SpscQueue<AudioTaskPtr> audio_effects_queue_;     // Effects bus
+    PlaybackMixer playback_mixer_;
+    std::atomic<int64_t> playback_abort_time_{0};   // Set by AbortPlayback(), taken by the output task
+    int64_t speech_flush_time_ = 0;     // Speech received before this is dropped by the output task
+    int64_t barge_in_time_ = 0;         // Abort being faded out, 0 if none
+    JitterBuffer jitter_buffer_;
+    SoundPlayer sound_player_;
+    SoundFrame sound_frame_;
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    SpscQueue<uint32_t> timestamp_queue_;
+    // Pushed by the input task, consumed by the processor output callback
+    SpscQueue<CaptureStamp> capture_stamp_queue_;
+    CaptureStamp capture_stamp_;
+    // Uplink DTX, used by the processor output callback
+    bool uplink_dtx_enabled_ = false;
+    int dtx_silence_ms_ = 0;
+    int dtx_keepalive_ms_ = 0;
+    AudioTaskPtr dtx_held_task_;
+    UplinkDtxStatistics dtx_statistics_;
+
+    // Written by the audio input task, read by each of its consumers
+    MicRing mic_ring_;
+
+    // Scratch buffers reused for every frame, so reading and decoding do not allocate
+    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t> input_mic_buffer_;
+    std::vector<int16_t> input_reference_buffer_;
+    std::vector<int16_t> resampled_mic_buffer_;
+    std::vector<int16_t> resampled_reference_buffer_;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
+    int encode_frame_duration_ = OPUS_FRAME_DURATION_MS;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
@@ -152,9 +309,13 @@ private:
 
     void AudioInputTask();
     void AudioOutputTask();
-    void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
-    void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void OpusEncodeTask();
+    void OpusDecodeTask();
+    void PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm, int64_t origin_time);
+    int64_t TakeCaptureTime(size_t samples);
+    void PushEncodeTask(AudioTaskPtr task);
+    void CheckBargeInDone();
+    bool SuppressUplinkFrame(int frame_duration_ms);
     void CheckAndUpdateAudioPowerState();
 };
 
@@ -0,0 +1,139 @@
+#include "audio_task_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioTaskPool"
+
+void AudioTaskRecycler::operator()(AudioTask* task) const {
+    if (pool != nullptr) {
+        pool->Release(task);
+    } else {
+        delete task;
+    }
+}
+
+AudioTaskPool::AudioTaskPool(size_t count, size_t samples)
+    : tasks_(count), samples_(samples) {
+    free_tasks_.reserve(count);
+    for (auto& task : tasks_) {
+        task.pcm.reserve(samples_);
+        free_tasks_.push_back(&task);
+    }
+}
+
+AudioTaskPtr AudioTaskPool::Acquire(AudioTaskType type) {
+    AudioTask* task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics_.acquire_count++;
+        if (!free_tasks_.empty()) {
+            task = free_tasks_.back();
+            free_tasks_.pop_back();
+        } else {
+            statistics_.task_misses++;
+        }
+        if (task == nullptr || task->pcm.capacity() < samples_) {
+            statistics_.buffer_misses++;
+        }
+    }
+
+    if (task == nullptr) {
+        ESP_LOGW(TAG, "Pool exhausted, allocating a task on the heap");
+        task = new AudioTask();
+    }
+    task->type = type;
+    task->timestamp = 0;
+    task->origin_time = 0;
+    task->queue_time = 0;
+    task->pcm.clear();
+    task->pcm.reserve(samples_);
+    return AudioTaskPtr(task, AudioTaskRecycler{this});
+}
+
+void AudioTaskPool::Release(AudioTask* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (task->pcm.capacity() > samples_) {
+        // The frame was larger than expected, keep the bigger size for every buffer from now on
+        samples_ = task->pcm.capacity();
+        statistics_.buffer_misses++;
+    }
+    if (task >= tasks_.data() && task < tasks_.data() + tasks_.size()) {
+        free_tasks_.push_back(task);
+    } else {
+        delete task;
+    }
+}
+
+AudioTaskPoolStatistics AudioTaskPool::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void AudioPacketRecycler::operator()(AudioStreamPacket* packet) const {
+    if (pool != nullptr) {
+        pool->Release(packet);
+    } else {
+        delete packet;
+    }
+}
+
+AudioPacketPool::AudioPacketPool(size_t count, size_t payload_size)
+    : packets_(count), payload_size_(payload_size) {
+    free_packets_.reserve(count);
+    for (auto& packet : packets_) {
+        packet.payload.reserve(payload_size_);
+        free_packets_.push_back(&packet);
+    }
+}
+
+AudioPacketPtr AudioPacketPool::Acquire() {
+    AudioStreamPacket* packet = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics_.acquire_count++;
+        if (!free_packets_.empty()) {
+            packet = free_packets_.back();
+            free_packets_.pop_back();
+        } else {
+            statistics_.packet_misses++;
+        }
+        if (packet == nullptr || packet->payload.capacity() < payload_size_) {
+            statistics_.buffer_misses++;
+        }
+    }
+
+    if (packet == nullptr) {
+        ESP_LOGW(TAG, "Packet pool exhausted, allocating a packet on the heap");
+        packet = new AudioStreamPacket();
+    }
+    packet->sample_rate = 0;
+    packet->frame_duration = 0;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->has_sequence = false;
+    packet->decode_fec = false;
+    packet->origin_time = 0;
+    packet->queue_time = 0;
+    packet->payload.clear();
+    packet->payload.reserve(payload_size_);
+    return AudioPacketPtr(packet, AudioPacketRecycler{this});
+}
+
+void AudioPacketPool::Release(AudioStreamPacket* packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (packet->payload.capacity() > payload_size_) {
+        // The frame was larger than expected, keep the bigger size for every buffer from now on
+        payload_size_ = packet->payload.capacity();
+        statistics_.buffer_misses++;
+    }
+    if (packet >= packets_.data() && packet < packets_.data() + packets_.size()) {
+        free_packets_.push_back(packet);
+    } else {
+        delete packet;
+    }
+}
+
+AudioPacketPoolStatistics AudioPacketPool::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
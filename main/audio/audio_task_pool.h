@@ -0,0 +1,112 @@
+#ifndef AUDIO_TASK_POOL_H
+#define AUDIO_TASK_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+enum AudioTaskType {
+    kAudioTaskTypeEncodeToSendQueue,
+    kAudioTaskTypeEncodeToTestingQueue,
+    kAudioTaskTypeDecodeToPlaybackQueue,
+};
+
+struct AudioTask {
+    AudioTaskType type;
+    std::vector<int16_t> pcm;
+    uint32_t timestamp;
+    // esp_timer_get_time() stamps for the latency tracer, 0 if not stamped
+    int64_t origin_time = 0;    // Encode: read from the microphone, playback: received from the network
+    int64_t queue_time = 0;     // Pushed to the encode / playback queue
+};
+
+class AudioTaskPool;
+
+struct AudioTaskRecycler {
+    AudioTaskPool* pool = nullptr;
+    void operator()(AudioTask* task) const;
+};
+
+// Returns the task to its pool when it goes out of scope
+using AudioTaskPtr = std::unique_ptr<AudioTask, AudioTaskRecycler>;
+
+struct AudioTaskPoolStatistics {
+    uint32_t acquire_count = 0;
+    uint32_t task_misses = 0;       // Tasks created on the heap because the pool was exhausted
+    uint32_t buffer_misses = 0;     // PCM buffers that had to be (re)allocated after the pool was created
+};
+
+/*
+ * Preallocated AudioTask objects with their PCM buffers already reserved.
+ * In steady state Acquire() and the recycler never touch the heap; the statistics count the pool misses, every
+ * time they had to. The encoded frames are pooled the same way, see AudioPacketPool.
+ */
+class AudioTaskPool {
+public:
+    AudioTaskPool(size_t count, size_t samples);
+
+    AudioTaskPool(const AudioTaskPool&) = delete;
+    AudioTaskPool& operator=(const AudioTaskPool&) = delete;
+
+    AudioTaskPtr Acquire(AudioTaskType type);
+    AudioTaskPoolStatistics GetStatistics();
+
+private:
+    friend struct AudioTaskRecycler;
+
+    std::mutex mutex_;
+    std::vector<AudioTask> tasks_;
+    std::vector<AudioTask*> free_tasks_;
+    size_t samples_;
+    AudioTaskPoolStatistics statistics_;
+
+    void Release(AudioTask* task);
+};
+
+class AudioPacketPool;
+
+struct AudioPacketRecycler {
+    AudioPacketPool* pool = nullptr;
+    void operator()(AudioStreamPacket* packet) const;
+};
+
+// Returns the packet to its pool when it goes out of scope
+using AudioPacketPtr = std::unique_ptr<AudioStreamPacket, AudioPacketRecycler>;
+
+struct AudioPacketPoolStatistics {
+    uint32_t acquire_count = 0;
+    uint32_t packet_misses = 0;     // Packets created on the heap because the pool was exhausted
+    uint32_t buffer_misses = 0;     // Payload buffers that had to be (re)allocated after the pool was created
+};
+
+/*
+ * Preallocated uplink AudioStreamPacket objects with their payload buffers already reserved, recycled like the
+ * AudioTask ones: the protocol only borrows a packet to send it (Protocol::SendAudio), and the packet comes back
+ * here when the sender drops it, so encoding and sending a frame do not touch the heap in steady state.
+ */
+class AudioPacketPool {
+public:
+    AudioPacketPool(size_t count, size_t payload_size);
+
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    AudioPacketPtr Acquire();
+    AudioPacketPoolStatistics GetStatistics();
+
+private:
+    friend struct AudioPacketRecycler;
+
+    std::mutex mutex_;
+    std::vector<AudioStreamPacket> packets_;
+    std::vector<AudioStreamPacket*> free_packets_;
+    size_t payload_size_;
+    AudioPacketPoolStatistics statistics_;
+
+    void Release(AudioStreamPacket* packet);
+};
+
+#endif // AUDIO_TASK_POOL_H
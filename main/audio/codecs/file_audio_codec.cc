@@ -0,0 +1,190 @@
+#include "file_audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "FileAudioCodec"
+
+#define WAV_HEADER_SIZE 44
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint16_t ReadLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void WriteLe32(uint8_t* p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void WriteLe16(uint8_t* p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+FileAudioCodec::FileAudioCodec(const char* input_path, const char* output_path, int output_sample_rate, float speed)
+    : speed_(speed) {
+    duplex_ = true;
+    input_reference_ = false;
+    input_channels_ = 1;
+    input_sample_rate_ = 16000;
+    output_sample_rate_ = output_sample_rate;
+
+    if (input_path != nullptr && !OpenInput(input_path)) {
+        ESP_LOGE(TAG, "Failed to open input WAV: %s, the microphone will be silent", input_path);
+    }
+    if (output_path != nullptr && !OpenOutput(output_path)) {
+        ESP_LOGE(TAG, "Failed to open output WAV: %s", output_path);
+    }
+    ESP_LOGI(TAG, "Input: %d Hz %d ch, output: %d Hz, speed: %.1f", input_sample_rate_, input_channels_,
+        output_sample_rate_, speed_);
+}
+
+FileAudioCodec::~FileAudioCodec() {
+    if (input_file_ != nullptr) {
+        fclose(input_file_);
+    }
+    if (output_file_ != nullptr) {
+        WriteOutputHeader();
+        fclose(output_file_);
+    }
+}
+
+bool FileAudioCodec::OpenInput(const char* path) {
+    input_file_ = fopen(path, "rb");
+    if (input_file_ == nullptr) {
+        return false;
+    }
+
+    uint8_t riff[12];
+    if (fread(riff, 1, sizeof(riff), input_file_) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "Not a WAV file");
+        fclose(input_file_);
+        input_file_ = nullptr;
+        return false;
+    }
+
+    // Walk the chunks until "data", the format comes from "fmt "
+    bool has_format = false;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), input_file_) == sizeof(chunk)) {
+        uint32_t size = ReadLe32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[16];
+            if (fread(fmt, 1, sizeof(fmt), input_file_) != sizeof(fmt)) {
+                break;
+            }
+            uint16_t format = ReadLe16(fmt);
+            uint16_t bits = ReadLe16(fmt + 14);
+            if (format != 1 || bits != 16) {
+                ESP_LOGE(TAG, "Only 16-bit PCM WAV is supported (format %u, %u bits)", format, bits);
+                break;
+            }
+            input_channels_ = ReadLe16(fmt + 2);
+            // A second channel is the AEC reference, like a replayed AudioDebugger capture
+            input_reference_ = input_channels_ == 2;
+            input_sample_rate_ = ReadLe32(fmt + 4);
+            has_format = true;
+            fseek(input_file_, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!has_format) {
+                break;
+            }
+            input_data_size_ = size;
+            return true;
+        } else {
+            fseek(input_file_, size + (size & 1), SEEK_CUR);
+        }
+    }
+
+    ESP_LOGE(TAG, "Invalid WAV file");
+    fclose(input_file_);
+    input_file_ = nullptr;
+    input_channels_ = 1;
+    input_reference_ = false;
+    input_sample_rate_ = 16000;
+    return false;
+}
+
+bool FileAudioCodec::OpenOutput(const char* path) {
+    output_file_ = fopen(path, "wb");
+    if (output_file_ == nullptr) {
+        return false;
+    }
+    // Sizes are filled in when the file is closed
+    WriteOutputHeader();
+    return true;
+}
+
+void FileAudioCodec::WriteOutputHeader() {
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    WriteLe32(header + 4, 36 + output_data_size_);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    WriteLe32(header + 16, 16);
+    WriteLe16(header + 20, 1);
+    WriteLe16(header + 22, output_channels_);
+    WriteLe32(header + 24, output_sample_rate_);
+    WriteLe32(header + 28, output_sample_rate_ * output_channels_ * sizeof(int16_t));
+    WriteLe16(header + 32, output_channels_ * sizeof(int16_t));
+    WriteLe16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    WriteLe32(header + 40, output_data_size_);
+
+    long position = ftell(output_file_);
+    fseek(output_file_, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), output_file_);
+    if (position > WAV_HEADER_SIZE) {
+        fseek(output_file_, position, SEEK_SET);
+    }
+}
+
+void FileAudioCodec::Pace(int64_t& start_time, uint64_t& position, int sample_rate, int samples) {
+    int64_t now = esp_timer_get_time();
+    if (position == 0) {
+        start_time = now;
+    }
+    position += samples;
+    if (speed_ <= 0 || sample_rate <= 0) {
+        return;
+    }
+    // Block like a DMA buffer would, until the samples are due
+    int64_t duration = int64_t(position * 1000000 / sample_rate / speed_);
+    int64_t due = start_time + duration;
+    if (due > now) {
+        vTaskDelay(pdMS_TO_TICKS((due - now) / 1000) + 1);
+    } else {
+        // Idle or late, restart the clock instead of catching up in a burst
+        start_time = now - duration;
+    }
+}
+
+int FileAudioCodec::Read(int16_t* dest, int samples) {
+    size_t read = 0;
+    if (input_file_ != nullptr && input_data_read_ < input_data_size_) {
+        size_t bytes = std::min<size_t>(samples * sizeof(int16_t), input_data_size_ - input_data_read_);
+        read = fread(dest, sizeof(int16_t), bytes / sizeof(int16_t), input_file_);
+        input_data_read_ += read * sizeof(int16_t);
+        if (input_data_read_ >= input_data_size_) {
+            ESP_LOGI(TAG, "End of input file, %llu frames read", (unsigned long long)(input_samples_ + read / input_channels_));
+        }
+    }
+    if (read < size_t(samples)) {
+        memset(dest + read, 0, (samples - read) * sizeof(int16_t));
+    }
+    Pace(input_start_time_, input_samples_, input_sample_rate_, samples / input_channels_);
+    return samples;
+}
+
+int FileAudioCodec::Write(const int16_t* data, int samples) {
+    if (output_file_ != nullptr) {
+        output_data_size_ += fwrite(data, sizeof(int16_t), samples, output_file_) * sizeof(int16_t);
+    }
+    Pace(output_start_time_, output_samples_, output_sample_rate_, samples / output_channels_);
+    return samples;
+}
@@ -0,0 +1,50 @@
+#ifndef _FILE_AUDIO_CODEC_H
+#define _FILE_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <cstdio>
+#include <cstdint>
+
+/*
+ * An AudioCodec backed by files instead of I2S, for profiling the audio pipeline without a mic or speaker.
+ * The microphone is read from a 16-bit PCM WAV file (its sample rate and channels become the input format,
+ * a second channel is the AEC reference), and the speaker output is written to a 16-bit mono WAV file.
+ *
+ * speed 1.0 paces reads and writes like the real I2S clock, 2.0 runs twice as fast, 0 does not wait at all.
+ * After the end of the input file the microphone returns silence.
+ *
+ * Not in the firmware sources, tests/host builds it into the AudioService pipeline test.
+ */
+class FileAudioCodec : public AudioCodec {
+private:
+    FILE* input_file_ = nullptr;
+    FILE* output_file_ = nullptr;
+    uint32_t input_data_size_ = 0;
+    uint32_t input_data_read_ = 0;
+    uint32_t output_data_size_ = 0;
+    float speed_;
+    int64_t input_start_time_ = 0;
+    int64_t output_start_time_ = 0;
+    uint64_t input_samples_ = 0;
+    uint64_t output_samples_ = 0;
+
+    bool OpenInput(const char* path);
+    bool OpenOutput(const char* path);
+    void WriteOutputHeader();
+    void Pace(int64_t& start_time, uint64_t& position, int sample_rate, int samples);
+
+    virtual int Read(int16_t* dest, int samples) override;
+    virtual int Write(const int16_t* data, int samples) override;
+
+public:
+    FileAudioCodec(const char* input_path, const char* output_path, int output_sample_rate, float speed = 1.0f);
+    virtual ~FileAudioCodec();
+
+    // Frames (per channel) read from the input and written to the output so far
+    inline uint64_t input_samples() const { return input_samples_; }
+    inline uint64_t output_samples() const { return output_samples_; }
+    inline bool input_finished() const { return input_data_read_ >= input_data_size_; }
+};
+
+#endif // _FILE_AUDIO_CODEC_H
@@ -1,8 +1,10 @@
 #include "no_audio_codec.h"
+#include "pcm_convert.h"
 
 #include <esp_log.h>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 
 #define TAG "NoAudioCodec"
 
@@ -280,42 +282,56 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
     std::lock_guard<std::mutex> lock(data_if_mutex_);
-    std::vector<int32_t> buffer(samples);
+    if (write_buffer_.empty()) {
+        write_buffer_.resize(NO_AUDIO_CODEC_CHUNK_SAMPLES + PCM32_ALIGNMENT_SLACK);
+    }
 
     // output_volume_: 0-100
     // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    if (volume_factor_volume_ != output_volume_) {
+        volume_factor_volume_ = output_volume_;
+        volume_factor_ = pow(double(output_volume_) / 100.0, 2) * 65536;
     }
 
-    size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
-    return bytes_written / sizeof(int32_t);
+    int written = 0;
+    while (written < samples) {
+        int chunk = std::min(samples - written, NO_AUDIO_CODEC_CHUNK_SAMPLES);
+        int32_t* buffer = AlignPcm32(write_buffer_.data(), data + written);
+        ScalePcm16ToPcm32(data + written, buffer, chunk, volume_factor_);
+
+        size_t bytes_written;
+        ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer, chunk * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+        written += bytes_written / sizeof(int32_t);
+        if (bytes_written < chunk * sizeof(int32_t)) {
+            break;
+        }
+    }
+    return written;
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
-    size_t bytes_read;
-
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
-        ESP_LOGE(TAG, "Read Failed!");
-        return 0;
+    if (read_buffer_.empty()) {
+        read_buffer_.resize(NO_AUDIO_CODEC_CHUNK_SAMPLES + PCM32_ALIGNMENT_SLACK);
     }
 
-    samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    int read = 0;
+    while (read < samples) {
+        int chunk = std::min(samples - read, NO_AUDIO_CODEC_CHUNK_SAMPLES);
+        int32_t* buffer = AlignPcm32(read_buffer_.data(), dest + read);
+        size_t bytes_read;
+        if (i2s_channel_read(rx_handle_, buffer, chunk * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+            ESP_LOGE(TAG, "Read Failed!");
+            return read;
+        }
+
+        int chunk_read = bytes_read / sizeof(int32_t);
+        ShiftPcm32ToPcm16(buffer, dest + read, chunk_read);
+        read += chunk_read;
+        if (chunk_read < chunk) {
+            break;
+        }
     }
-    return samples;
+    return read;
 }
 
 int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
@@ -6,10 +6,19 @@
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 #include <mutex>
+#include <vector>
+
+// Samples converted per I2S read / write, the 32-bit scratch buffers are allocated once with this size and the
+// slack of AlignPcm32(), so the conversion runs on the vector unit
+#define NO_AUDIO_CODEC_CHUNK_SAMPLES (AUDIO_CODEC_DMA_FRAME_NUM * 4)
 
 class NoAudioCodec : public AudioCodec {
 protected:
     std::mutex data_if_mutex_;
+    std::vector<int32_t> write_buffer_;
+    std::vector<int32_t> read_buffer_;
+    int volume_factor_volume_ = -1;     // output_volume_ the factor was computed for
+    int32_t volume_factor_ = 0;
 
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
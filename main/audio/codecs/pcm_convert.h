@@ -0,0 +1,166 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <cstdint>
+
+#include "sdkconfig.h"
+
+/*
+ * Sample conversion kernels between the 16-bit pipeline and 32-bit I2S slots.
+ *
+ * On the ESP32-S3 the middle of a buffer runs on the PIE vector unit, 8 samples per block, the head and the
+ * tail on the scalar loops. A block needs both pointers 16-byte aligned at the same sample: AlignPcm32() picks
+ * the start of a 32-bit scratch buffer that lines up with the 16-bit one, otherwise the scalar loops do it all.
+ * Elsewhere the scalar loops run alone. The vector blocks give the same samples as the scalar loops.
+ */
+#define PCM_SIMD_ALIGNMENT 16
+#define PCM_SIMD_BLOCK_SAMPLES 8
+// Extra 32-bit samples a scratch buffer needs for AlignPcm32()
+#define PCM32_ALIGNMENT_SLACK 3
+
+// Samples before the 16-bit pointer reaches the vector alignment
+static inline int PcmSimdHead(const int16_t* pcm) {
+    return int((PCM_SIMD_ALIGNMENT - uintptr_t(pcm) % PCM_SIMD_ALIGNMENT) % PCM_SIMD_ALIGNMENT / sizeof(int16_t));
+}
+
+// The start in a 32-bit scratch buffer, at most PCM32_ALIGNMENT_SLACK samples in, that is 16-byte aligned
+// where pcm is, so the kernels can run their vector blocks between the two
+static inline int32_t* AlignPcm32(int32_t* buffer, const int16_t* pcm) {
+    uintptr_t head = PcmSimdHead(pcm) * sizeof(int32_t);
+    uintptr_t aligned = (uintptr_t(buffer) + head + PCM_SIMD_ALIGNMENT - 1) & ~uintptr_t(PCM_SIMD_ALIGNMENT - 1);
+    return (int32_t*)(aligned - head);
+}
+
+// Scale by a Q16 volume factor (at most 65536) into the 32-bit slot. -32768 * 65536 is exactly INT32_MIN,
+// so the product cannot overflow and no clamping is needed.
+static inline void ScalePcm16ToPcm32Scalar(const int16_t* src, int32_t* dst, int samples, int32_t factor) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = src[i] * factor;
+        dst[i + 1] = src[i + 1] * factor;
+        dst[i + 2] = src[i + 2] * factor;
+        dst[i + 3] = src[i + 3] * factor;
+    }
+    for (; i < samples; i++) {
+        dst[i] = src[i] * factor;
+    }
+}
+
+// Take the upper bits of the 32-bit slot with a saturating shift
+static inline void ShiftPcm32ToPcm16Scalar(const int32_t* src, int16_t* dst, int samples) {
+    for (int i = 0; i < samples; i++) {
+        int32_t value = src[i] >> 12;
+        value = value > INT16_MAX ? INT16_MAX : value;
+        value = value < -INT16_MAX ? -INT16_MAX : value;
+        dst[i] = value;
+    }
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+/*
+ * PIE blocks of 8 samples, both pointers 16-byte aligned. The vector multiply keeps 16 bits of the product
+ * shifted by SAR, so the 32-bit product of the sample and factor / 2 is put together from its low and high
+ * halves, doubled, and the sample is added for the remainder of the factor (0 to 2, 65536 is 2 * 32767 + 2).
+ */
+static inline void ScalePcm16ToPcm32Blocks(const int16_t* src, int32_t* dst, int blocks, int32_t factor) {
+    int16_t half = int16_t(factor >= 65536 ? 32767 : factor >> 1);
+    int32_t rest = factor - 2 * half;
+    int32_t sar;
+    asm volatile(
+        "ee.vldbc.16     q7, %[half]\n"
+        "ee.zero.q       q6\n"
+        "1:\n"
+        "ee.vld.128.ip   q0, %[src], 16\n"
+        "movi            %[sar], 0\n"
+        "wsr.sar         %[sar]\n"
+        "ee.vmul.s16     q1, q0, q7\n"
+        "movi            %[sar], 16\n"
+        "wsr.sar         %[sar]\n"
+        "ee.vmul.s16     q2, q0, q7\n"
+        "ee.vzip.16      q1, q2\n"
+        "movi            %[sar], 1\n"
+        "wsr.sar         %[sar]\n"
+        "ee.vsl.32       q1, q1\n"
+        "ee.vsl.32       q2, q2\n"
+        "beqz            %[rest], 2f\n"
+        "ee.vcmp.lt.s16  q3, q0, q6\n"
+        "ee.vzip.16      q0, q3\n"
+        "ee.vadds.s32    q1, q1, q0\n"
+        "ee.vadds.s32    q2, q2, q3\n"
+        "blti            %[rest], 2, 2f\n"
+        "ee.vadds.s32    q1, q1, q0\n"
+        "ee.vadds.s32    q2, q2, q3\n"
+        "2:\n"
+        "ee.vst.128.ip   q1, %[dst], 16\n"
+        "ee.vst.128.ip   q2, %[dst], 16\n"
+        "addi            %[blocks], %[blocks], -1\n"
+        "bnez            %[blocks], 1b\n"
+        : [src] "+r"(src), [dst] "+r"(dst), [blocks] "+r"(blocks), [sar] "=&r"(sar)
+        : [half] "r"(&half), [rest] "r"(rest)
+        : "memory");
+}
+
+/* Arithmetic shift of the 32-bit lanes, clamped, then the low halves of 8 lanes packed into one register */
+static inline void ShiftPcm32ToPcm16Blocks(const int32_t* src, int16_t* dst, int blocks) {
+    static const int32_t limits[2] = {INT16_MAX, -INT16_MAX};
+    int32_t sar;
+    asm volatile(
+        "ee.vldbc.32     q6, %[limits]\n"
+        "addi            %[sar], %[limits], 4\n"
+        "ee.vldbc.32     q7, %[sar]\n"
+        "movi            %[sar], 12\n"
+        "wsr.sar         %[sar]\n"
+        "1:\n"
+        "ee.vld.128.ip   q0, %[src], 16\n"
+        "ee.vld.128.ip   q1, %[src], 16\n"
+        "ee.vsr.32       q0, q0\n"
+        "ee.vsr.32       q1, q1\n"
+        "ee.vmin.s32     q0, q0, q6\n"
+        "ee.vmin.s32     q1, q1, q6\n"
+        "ee.vmax.s32     q0, q0, q7\n"
+        "ee.vmax.s32     q1, q1, q7\n"
+        "ee.vunzip.16    q0, q1\n"
+        "ee.vst.128.ip   q0, %[dst], 16\n"
+        "addi            %[blocks], %[blocks], -1\n"
+        "bnez            %[blocks], 1b\n"
+        : [src] "+r"(src), [dst] "+r"(dst), [blocks] "+r"(blocks), [sar] "=&r"(sar)
+        : [limits] "r"(limits)
+        : "memory");
+}
+#endif
+
+static inline void ScalePcm16ToPcm32(const int16_t* src, int32_t* dst, int samples, int32_t factor) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    int head = PcmSimdHead(src);
+    if (head < samples && uintptr_t(dst + head) % PCM_SIMD_ALIGNMENT == 0) {
+        int blocks = (samples - head) / PCM_SIMD_BLOCK_SAMPLES;
+        ScalePcm16ToPcm32Scalar(src, dst, head, factor);
+        if (blocks > 0) {
+            ScalePcm16ToPcm32Blocks(src + head, dst + head, blocks, factor);
+        }
+        int done = head + blocks * PCM_SIMD_BLOCK_SAMPLES;
+        ScalePcm16ToPcm32Scalar(src + done, dst + done, samples - done, factor);
+        return;
+    }
+#endif
+    ScalePcm16ToPcm32Scalar(src, dst, samples, factor);
+}
+
+static inline void ShiftPcm32ToPcm16(const int32_t* src, int16_t* dst, int samples) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    int head = PcmSimdHead(dst);
+    if (head < samples && uintptr_t(src + head) % PCM_SIMD_ALIGNMENT == 0) {
+        int blocks = (samples - head) / PCM_SIMD_BLOCK_SAMPLES;
+        ShiftPcm32ToPcm16Scalar(src, dst, head);
+        if (blocks > 0) {
+            ShiftPcm32ToPcm16Blocks(src + head, dst + head, blocks);
+        }
+        int done = head + blocks * PCM_SIMD_BLOCK_SAMPLES;
+        ShiftPcm32ToPcm16Scalar(src + done, dst + done, samples - done);
+        return;
+    }
+#endif
+    ShiftPcm32ToPcm16Scalar(src, dst, samples);
+}
+
+#endif // PCM_CONVERT_H
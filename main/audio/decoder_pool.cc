@@ -0,0 +1,115 @@
+#include "decoder_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "DecoderPool"
+
+DecoderPool::DecoderPool(int output_sample_rate) : output_sample_rate_(output_sample_rate) {
+}
+
+DecoderPool::Slot* DecoderPool::GetSlot(int sample_rate, int frame_duration) {
+    Slot* oldest = &slots_[0];
+    for (auto& slot : slots_) {
+        if (slot.decoder && slot.sample_rate == sample_rate && slot.frame_duration == frame_duration) {
+            slot.last_used = ++use_count_;
+            return &slot;
+        }
+        /* Empty slots have last_used 0, so they are taken before any decoder is evicted */
+        if (slot.last_used < oldest->last_used) {
+            oldest = &slot;
+        }
+    }
+
+    if (oldest->decoder) {
+        ESP_LOGI(TAG, "Evicting the %d Hz %d ms decoder", oldest->sample_rate, oldest->frame_duration);
+        statistics_.evictions++;
+    }
+    ESP_LOGI(TAG, "Creating a %d Hz %d ms decoder", sample_rate, frame_duration);
+    statistics_.creations++;
+    oldest->sample_rate = sample_rate;
+    oldest->frame_duration = frame_duration;
+    oldest->last_used = ++use_count_;
+    oldest->decoder.reset();
+    int error = OPUS_OK;
+    oldest->decoder.reset(opus_decoder_create(sample_rate, 1, &error));
+    if (!oldest->decoder) {
+        ESP_LOGE(TAG, "Failed to create the decoder, error code: %d", error);
+    }
+    oldest->resampler.reset();
+    oldest->opus_resampler.reset();
+    if (sample_rate != output_sample_rate_) {
+        oldest->resampler = CreatePolyphaseResampler(sample_rate, output_sample_rate_, 1);
+        if (!oldest->resampler) {
+            oldest->opus_resampler = std::make_unique<OpusResampler>();
+            oldest->opus_resampler->Configure(sample_rate, output_sample_rate_);
+        }
+    }
+    return oldest;
+}
+
+void DecoderPool::Prepare(int sample_rate, int frame_duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    GetSlot(sample_rate, frame_duration);
+}
+
+bool DecoderPool::Decode(int sample_rate, int frame_duration, std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm,
+    bool fec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot* slot = GetSlot(sample_rate, frame_duration);
+    if (current_ != nullptr && current_ != slot) {
+        statistics_.switches++;
+    }
+    current_ = slot;
+    statistics_.decodes++;
+
+    if (!slot->decoder) {
+        return false;
+    }
+
+    // Decode straight into pcm unless the output needs resampling
+    bool resample = sample_rate != output_sample_rate_;
+    auto& output = resample ? decode_buffer_ : pcm;
+    int frame_size = sample_rate * frame_duration / 1000;
+    output.resize(frame_size);
+    int samples;
+    if (opus.empty()) {
+        /* Lost frame, Opus extrapolates one frame duration from the decoder state */
+        samples = opus_decode(slot->decoder.get(), nullptr, 0, output.data(), frame_size, 0);
+    } else {
+        /* With fec the frame size must be the lost frame's, Opus runs PLC if the packet carries no FEC data */
+        samples = opus_decode(slot->decoder.get(), opus.data(), opus.size(), output.data(), frame_size, fec ? 1 : 0);
+    }
+    if (samples < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", samples);
+        return false;
+    }
+    output.resize(samples);
+    if (slot->resampler) {
+        pcm.resize(slot->resampler->GetOutputSamples(decode_buffer_.size()));
+        slot->resampler->Process(decode_buffer_.data(), decode_buffer_.size(), pcm.data());
+    } else if (slot->opus_resampler) {
+        pcm.resize(slot->opus_resampler->GetOutputSamples(decode_buffer_.size()));
+        slot->opus_resampler->Process(decode_buffer_.data(), decode_buffer_.size(), pcm.data());
+    }
+    return true;
+}
+
+void DecoderPool::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+        if (slot.decoder) {
+            opus_decoder_ctl(slot.decoder.get(), OPUS_RESET_STATE);
+        }
+        if (slot.resampler) {
+            slot.resampler->Reset();
+        } else if (slot.opus_resampler) {
+            /* Configure() clears the filter state, there is no separate reset */
+            slot.opus_resampler->Configure(slot.sample_rate, output_sample_rate_);
+        }
+    }
+}
+
+DecoderPoolStatistics DecoderPool::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
@@ -0,0 +1,69 @@
+#ifndef DECODER_POOL_H
+#define DECODER_POOL_H
+
+#include <opus.h>
+#include <opus_resampler.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "polyphase_resampler.h"
+
+// Warm decoders kept at once: server speech, system sounds and one spare, the sounds one is created on first use
+#define DECODER_POOL_SIZE 3
+
+struct DecoderPoolStatistics {
+    uint32_t decodes = 0;
+    uint32_t switches = 0;      // Packets that used a different decoder than the previous one
+    uint32_t creations = 0;     // Decoders created, including the ones prepared ahead
+    uint32_t evictions = 0;     // Least recently used decoders destroyed to make room
+};
+
+/*
+ * Opus decoders keyed by sample rate and frame duration, each with its own resampler to the codec
+ * output rate. A stream that alternates between rates (16 kHz sounds and 24 kHz speech) keeps the
+ * decoder and resampler state of each, so switching allocates nothing and does not restart the filters.
+ *
+ * The decoders are plain libopus ones, so a lost frame (an empty payload, see JitterBuffer) can be decoded
+ * explicitly as packet loss concealment, or recovered from the in-band FEC data of the next frame.
+ */
+class DecoderPool {
+public:
+    explicit DecoderPool(int output_sample_rate);
+
+    DecoderPool(const DecoderPool&) = delete;
+    DecoderPool& operator=(const DecoderPool&) = delete;
+
+    // Create the decoder before its first packet, so that packet does not wait for it
+    void Prepare(int sample_rate, int frame_duration);
+    // Decode one packet to pcm at the output sample rate, an empty packet conceals one lost frame.
+    // With fec, opus is the frame after the lost one and its FEC data is decoded in place of the lost frame
+    bool Decode(int sample_rate, int frame_duration, std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm,
+        bool fec = false);
+    void ResetState();
+    DecoderPoolStatistics GetStatistics();
+
+private:
+    struct Slot {
+        int sample_rate = 0;
+        int frame_duration = 0;
+        uint32_t last_used = 0;
+        std::unique_ptr<OpusDecoder, void (*)(OpusDecoder*)> decoder{nullptr, opus_decoder_destroy};
+        std::unique_ptr<Resampler> resampler;               // Polyphase when there is a table for the rate pair
+        std::unique_ptr<OpusResampler> opus_resampler;      // Otherwise
+    };
+
+    const int output_sample_rate_;
+    std::mutex mutex_;
+    Slot slots_[DECODER_POOL_SIZE];
+    Slot* current_ = nullptr;
+    uint32_t use_count_ = 0;
+    std::vector<int16_t> decode_buffer_;
+    DecoderPoolStatistics statistics_;
+
+    Slot* GetSlot(int sample_rate, int frame_duration);
+};
+
+#endif // DECODER_POOL_H
@@ -0,0 +1,215 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+// Skip ahead instead of concealing longer gaps, Opus PLC fades to silence anyway
+#define MAX_CONCEALED_FRAMES_IN_A_ROW 5
+
+JitterBuffer::JitterBuffer(size_t capacity, int max_duration_ms)
+    : slots_(capacity), max_duration_ms_(max_duration_ms) {
+    statistics_.target_depth = JITTER_BUFFER_MIN_FRAMES;
+}
+
+static inline int64_t NowMs() {
+    return esp_timer_get_time() / 1000;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int frame_duration) {
+    // Transit time relative to the ideal send time of the frame, the constant offset cancels out
+    int64_t transit = NowMs() - int64_t(sequence) * frame_duration;
+    if (has_transit_) {
+        int d = std::abs(int(transit - last_transit_ms_));
+        jitter_x16_ += d - ((jitter_x16_ + 8) >> 4);
+    }
+    last_transit_ms_ = transit;
+    has_transit_ = true;
+}
+
+int JitterBuffer::GetTargetDepth() const {
+    if (frame_duration_ <= 0) {
+        return JITTER_BUFFER_MIN_FRAMES;
+    }
+    // Cover about twice the mean deviation
+    int jitter_ms = jitter_x16_ >> 4;
+    int depth = JITTER_BUFFER_MIN_FRAMES + (2 * jitter_ms + frame_duration_ - 1) / frame_duration_;
+    return std::min(depth, JITTER_BUFFER_MAX_FRAMES);
+}
+
+bool JitterBuffer::Put(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.received++;
+
+    uint32_t sequence = packet->sequence;
+    if (!packet->has_sequence) {
+        sequence = ++arrival_sequence_;
+    }
+    sample_rate_ = packet->sample_rate;
+    frame_duration_ = packet->frame_duration;
+
+    if (released_ && int32_t(sequence - released_sequence_) < 0) {
+        if (released_sequence_ - sequence <= slots_.size()) {
+            statistics_.late++;
+            return false;
+        }
+        // Far behind the playout point, the server restarted the stream
+        ESP_LOGW(TAG, "Sequence restarted: %lu -> %lu", (unsigned long)released_sequence_, (unsigned long)sequence);
+        for (auto& slot : slots_) {
+            slot.reset();
+        }
+        count_ = 0;
+        playing_ = false;
+        released_ = false;
+        // The transit times of the two streams are unrelated, do not take the jump for jitter
+        has_transit_ = false;
+    }
+    UpdateJitter(sequence, packet->frame_duration);
+    if (count_ == 0) {
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        first_buffered_time_ms_ = NowMs();
+    } else if (int32_t(sequence - next_sequence_) < 0) {
+        // An earlier frame arrived while buffering, or a frame that is not due yet while playing
+        if (highest_sequence_ - sequence >= slots_.size()) {
+            statistics_.overflowed++;
+            return false;
+        }
+        next_sequence_ = sequence;
+        statistics_.reordered++;
+    } else if (sequence - next_sequence_ >= slots_.size() ||
+        int64_t(sequence - next_sequence_ + 1) * frame_duration_ > max_duration_ms_) {
+        statistics_.overflowed++;
+        return false;
+    } else if (int32_t(sequence - highest_sequence_) < 0) {
+        statistics_.reordered++;
+    }
+
+    auto& slot = slots_[sequence % slots_.size()];
+    if (slot) {
+        statistics_.duplicated++;
+        return false;
+    }
+    if (int32_t(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    packet->sequence = sequence;
+    slot = std::move(packet);
+    count_++;
+    return true;
+}
+
+std::unique_ptr<AudioStreamPacket> JitterBuffer::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    next_sequence_++;
+    released_sequence_ = next_sequence_;
+    released_ = true;
+    missing_since_ms_ = -1;
+    return packet;
+}
+
+std::unique_ptr<AudioStreamPacket> JitterBuffer::Get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int target_depth = GetTargetDepth();
+    statistics_.target_depth = target_depth;
+    statistics_.jitter_ms = jitter_x16_ >> 4;
+
+    if (count_ == 0) {
+        if (playing_) {
+            playing_ = false;
+            statistics_.underruns++;
+        }
+        return nullptr;
+    }
+
+    if (!playing_) {
+        int64_t waited = NowMs() - first_buffered_time_ms_;
+        if (int(count_) < target_depth && waited < int64_t(target_depth) * frame_duration_) {
+            return nullptr;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = slots_[next_sequence_ % slots_.size()];
+    if (slot) {
+        count_--;
+        return Release(std::move(slot));
+    }
+
+    // The frame is missing but later frames are buffered, give it one frame to arrive
+    if (int(count_) <= target_depth) {
+        if (missing_since_ms_ < 0) {
+            missing_since_ms_ = NowMs();
+        }
+        if (NowMs() - missing_since_ms_ < frame_duration_) {
+            return nullptr;
+        }
+    }
+    uint32_t gap = 1;
+    while (!slots_[(next_sequence_ + gap) % slots_.size()]) {
+        gap++;
+    }
+    if (gap > MAX_CONCEALED_FRAMES_IN_A_ROW) {
+        ESP_LOGW(TAG, "Skip %lu missing frames", (unsigned long)gap);
+        next_sequence_ += gap;
+        count_--;
+        return Release(std::move(slots_[next_sequence_ % slots_.size()]));
+    }
+
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = sample_rate_;
+    packet->frame_duration = frame_duration_;
+    /* Stamped when replaced, so a barge-in drops it like the received frames before the abort */
+    packet->origin_time = esp_timer_get_time();
+    if (gap == 1) {
+        /* The next frame is buffered, it stays there to be decoded in turn */
+        auto& next = slots_[(next_sequence_ + 1) % slots_.size()];
+        packet->payload.assign(next->data(), next->data() + next->size());
+        packet->decode_fec = true;
+        statistics_.recovered++;
+    } else {
+        statistics_.concealed++;
+    }
+    return Release(std::move(packet));
+}
+
+void JitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    playing_ = false;
+    released_ = false;
+    missing_since_ms_ = -1;
+    arrival_sequence_ = 0;
+    has_transit_ = false;
+}
+
+bool JitterBuffer::Empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ == 0;
+}
+
+int JitterBuffer::GetWaitTimeMs() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        return -1;
+    }
+    int64_t deadline;
+    if (!playing_) {
+        deadline = first_buffered_time_ms_ + int64_t(GetTargetDepth()) * frame_duration_;
+    } else if (missing_since_ms_ >= 0) {
+        deadline = missing_since_ms_ + frame_duration_;
+    } else {
+        return 0;
+    }
+    return std::max<int64_t>(deadline - NowMs(), 1);
+}
+
+JitterBufferStatistics JitterBuffer::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
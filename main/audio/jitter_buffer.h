@@ -0,0 +1,79 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MIN_FRAMES 1
+#define JITTER_BUFFER_MAX_FRAMES 8
+
+struct JitterBufferStatistics {
+    uint32_t received = 0;
+    uint32_t late = 0;              // Arrived after its frame was played or concealed
+    uint32_t duplicated = 0;
+    uint32_t overflowed = 0;        // Too far ahead of the playout point
+    uint32_t reordered = 0;         // Arrived out of order but still in time
+    uint32_t concealed = 0;         // Frames replaced by packet loss concealment
+    uint32_t recovered = 0;         // Frames decoded from the in-band FEC data of the next frame
+    uint32_t underruns = 0;
+    uint32_t target_depth = 0;      // Frames
+    uint32_t jitter_ms = 0;
+};
+
+/*
+ * Reorders the downlink Opus packets by sequence number and releases them at playout time.
+ *
+ * Packets without a sequence number (WebSocket, has_sequence not set) are numbered in arrival order.
+ * The target depth follows the interarrival jitter (RFC 3550 estimator). Playback starts or restarts
+ * after an underrun once the target depth is buffered, or once the oldest packet has waited that long.
+ * A missing frame is waited for one frame duration (or until the buffer is over the target depth),
+ * then replaced. If the next frame is buffered, Get() returns a copy of it with decode_fec set, and the
+ * decoder recovers the missing frame from its in-band FEC data (Opus falls back to packet loss concealment
+ * when the sender did not encode any). Otherwise Get() returns a packet with an empty payload, which makes
+ * the decoder run packet loss concealment. Either way its origin_time is the time it was replaced.
+ *
+ * Put() is called by the network task, Get() by the decode task.
+ */
+class JitterBuffer {
+public:
+    // Holds at most `capacity` packets and `max_duration_ms` of audio
+    JitterBuffer(size_t capacity, int max_duration_ms);
+
+    bool Put(std::unique_ptr<AudioStreamPacket> packet);
+    std::unique_ptr<AudioStreamPacket> Get();
+    void Reset();
+    bool Empty();
+    // How long the decode task may sleep before Get() can return something new, -1 for until the next Put()
+    int GetWaitTimeMs();
+    JitterBufferStatistics GetStatistics();
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> slots_;
+    int max_duration_ms_;
+    size_t count_ = 0;
+    bool playing_ = false;
+    bool released_ = false;         // released_sequence_ is valid
+    uint32_t next_sequence_ = 0;
+    uint32_t released_sequence_ = 0; // Everything before it was played or concealed
+    uint32_t highest_sequence_ = 0;
+    uint32_t arrival_sequence_ = 0;
+    int64_t first_buffered_time_ms_ = 0;
+    int64_t missing_since_ms_ = -1; // When the frame at next_sequence_ was found missing
+    int64_t last_transit_ms_ = 0;
+    bool has_transit_ = false;
+    int jitter_x16_ = 0;            // Jitter estimate in 1/16 ms
+    int sample_rate_ = 0;
+    int frame_duration_ = 0;
+    JitterBufferStatistics statistics_;
+
+    void UpdateJitter(uint32_t sequence, int frame_duration);
+    int GetTargetDepth() const;
+    std::unique_ptr<AudioStreamPacket> Release(std::unique_ptr<AudioStreamPacket> packet);
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,129 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "LatencyTracer"
+
+static const uint32_t kEdgesMs[LATENCY_HISTOGRAM_BUCKETS - 1] = { LATENCY_HISTOGRAM_EDGES_MS };
+
+static const char* const kStageNames[kLatencyStageCount] = {
+    "uplink_process",
+    "uplink_encode_queue",
+    "uplink_encode",
+    "uplink_send_queue",
+    "uplink_send",
+    "uplink_total",
+    "downlink_jitter_buffer",
+    "downlink_decode",
+    "downlink_playback_queue",
+    "downlink_output",
+    "downlink_total",
+    "barge_in",
+};
+
+const char* LatencyTracer::GetStageName(LatencyStage stage) {
+    return stage < kLatencyStageCount ? kStageNames[stage] : "unknown";
+}
+
+void LatencyTracer::Record(LatencyStage stage, int64_t from_us, int64_t to_us) {
+    if (from_us == 0 || stage >= kLatencyStageCount) {
+        return;
+    }
+    uint32_t latency_us = to_us > from_us ? uint32_t(std::min<int64_t>(to_us - from_us, UINT32_MAX)) : 0;
+    int bucket = 0;
+    while (bucket < LATENCY_HISTOGRAM_BUCKETS - 1 && latency_us >= kEdgesMs[bucket] * 1000) {
+        bucket++;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    /* Roll all the stages at once, so their windows cover the same frames */
+    if (to_us - window_start_us_ >= LATENCY_WINDOW_MS * 1000LL) {
+        for (auto& histogram : histograms_) {
+            histogram.previous = histogram.current;
+            histogram.current = Window();
+        }
+        window_start_us_ = to_us;
+    }
+    auto& window = histograms_[stage].current;
+    window.buckets[bucket]++;
+    window.count++;
+    window.max_us = std::max(window.max_us, latency_us);
+}
+
+LatencySummary LatencyTracer::GetSummary(LatencyStage stage) {
+    LatencySummary summary;
+    if (stage >= kLatencyStageCount) {
+        return summary;
+    }
+
+    uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& histogram = histograms_[stage];
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+            buckets[i] = histogram.current.buckets[i] + histogram.previous.buckets[i];
+        }
+        summary.count = histogram.current.count + histogram.previous.count;
+        summary.max_us = std::max(histogram.current.max_us, histogram.previous.max_us);
+    }
+    if (summary.count == 0) {
+        return summary;
+    }
+
+    auto percentile = [&](uint32_t percent) -> uint32_t {
+        uint32_t rank = (uint64_t(summary.count) * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS - 1; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(kEdgesMs[i] * 1000, summary.max_us);
+            }
+        }
+        return summary.max_us;
+    };
+    summary.p50_us = percentile(50);
+    summary.p90_us = percentile(90);
+    summary.p99_us = percentile(99);
+    return summary;
+}
+
+void LatencyTracer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& histogram : histograms_) {
+        histogram = Histogram();
+    }
+    window_start_us_ = 0;
+}
+
+void LatencyTracer::PrintSummary() {
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = LatencyStage(i);
+        auto summary = GetSummary(stage);
+        if (summary.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: n=%lu p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms", GetStageName(stage),
+            (unsigned long)summary.count, summary.p50_us / 1000.0, summary.p90_us / 1000.0,
+            summary.p99_us / 1000.0, summary.max_us / 1000.0);
+    }
+}
+
+cJSON* LatencyTracer::GetSummaryJson() {
+    cJSON* json = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = LatencyStage(i);
+        auto summary = GetSummary(stage);
+        if (summary.count == 0) {
+            continue;
+        }
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "count", summary.count);
+        cJSON_AddNumberToObject(item, "p50_ms", summary.p50_us / 1000.0);
+        cJSON_AddNumberToObject(item, "p90_ms", summary.p90_us / 1000.0);
+        cJSON_AddNumberToObject(item, "p99_ms", summary.p99_us / 1000.0);
+        cJSON_AddNumberToObject(item, "max_ms", summary.max_us / 1000.0);
+        cJSON_AddItemToObject(json, GetStageName(stage), item);
+    }
+    return json;
+}
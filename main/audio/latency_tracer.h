@@ -0,0 +1,77 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include <cJSON.h>
+
+// The percentiles cover the last one to two windows
+#define LATENCY_WINDOW_MS 30000
+// Upper edges in ms, the last bucket is open ended
+#define LATENCY_HISTOGRAM_EDGES_MS 1, 2, 5, 10, 20, 30, 40, 60, 80, 100, 150, 200, 300, 400, 600, 800, 1000, 1500, 2000, 5000
+#define LATENCY_HISTOGRAM_BUCKETS 21
+
+enum LatencyStage {
+    // Uplink: (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
+    kLatencyStageUplinkProcess,         // I2S read -> processor output
+    kLatencyStageUplinkEncodeQueue,     // Processor output -> encode start
+    kLatencyStageUplinkEncode,
+    kLatencyStageUplinkSendQueue,       // Encoded -> popped by the application
+    kLatencyStageUplinkSend,            // Protocol::SendAudio()
+    kLatencyStageUplinkTotal,           // I2S read -> sent
+    // Downlink: (Server) -> {Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+    kLatencyStageDownlinkJitterBuffer,  // Received -> decode start
+    kLatencyStageDownlinkDecode,
+    kLatencyStageDownlinkPlaybackQueue, // Decoded -> output start
+    kLatencyStageDownlinkOutput,        // AudioCodec::OutputData()
+    kLatencyStageDownlinkTotal,         // Received -> written to the speaker
+    kLatencyStageBargeIn,               // AbortPlayback() -> faded out and the DMA buffers drained
+    kLatencyStageCount
+};
+
+struct LatencySummary {
+    uint32_t count = 0;
+    uint32_t p50_us = 0;
+    uint32_t p90_us = 0;
+    uint32_t p99_us = 0;
+    uint32_t max_us = 0;
+};
+
+/*
+ * Rolling latency histograms of the audio pipeline stages.
+ *
+ * The stages are measured between esp_timer_get_time() stamps carried by the frames
+ * (AudioStreamPacket / AudioTask). Each stage keeps the current and the previous window,
+ * the percentiles are read from both and rounded up to the bucket edge.
+ * Record() may be called from any task.
+ */
+class LatencyTracer {
+public:
+    // Adds to_us - from_us to the stage, ignored if from_us is 0 (frame not stamped)
+    void Record(LatencyStage stage, int64_t from_us, int64_t to_us);
+    LatencySummary GetSummary(LatencyStage stage);
+    void Reset();
+
+    void PrintSummary();
+    cJSON* GetSummaryJson();
+    static const char* GetStageName(LatencyStage stage);
+
+private:
+    struct Window {
+        uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+        uint32_t count = 0;
+        uint32_t max_us = 0;
+    };
+    struct Histogram {
+        Window current;
+        Window previous;
+    };
+
+    std::mutex mutex_;
+    Histogram histograms_[kLatencyStageCount];
+    int64_t window_start_us_ = 0;
+};
+
+#endif // LATENCY_TRACER_H
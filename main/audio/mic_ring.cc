@@ -0,0 +1,57 @@
+#include "mic_ring.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "MicRing"
+
+void MicRing::Configure(size_t capacity_frames, int channels) {
+    capacity_ = capacity_frames;
+    channels_ = channels;
+    buffer_.assign(capacity_ * channels_, 0);
+    written_ = 0;
+}
+
+void MicRing::Write(const int16_t* data, size_t frames) {
+    if (capacity_ == 0) {
+        return;
+    }
+    if (frames > capacity_) {
+        data += (frames - capacity_) * channels_;
+        written_ += frames - capacity_;
+        frames = capacity_;
+    }
+    size_t position = written_ % capacity_;
+    size_t first = std::min(frames, capacity_ - position);
+    memcpy(&buffer_[position * channels_], data, first * channels_ * sizeof(int16_t));
+    memcpy(&buffer_[0], data + first * channels_, (frames - first) * channels_ * sizeof(int16_t));
+    written_ += frames;
+}
+
+void MicRing::Activate(MicRingCursor& cursor) {
+    cursor.position = written_;
+    cursor.active = true;
+}
+
+bool MicRing::Read(MicRingCursor& cursor, std::vector<int16_t>& data, size_t frames) {
+    if (frames == 0 || frames > capacity_) {
+        return false;
+    }
+    if (written_ - cursor.position > capacity_) {
+        cursor.overruns++;
+        ESP_LOGW(TAG, "Consumer fell behind by %llu frames, skipping", (unsigned long long)(written_ - cursor.position - capacity_));
+        cursor.position = written_ - capacity_;
+    }
+    if (written_ - cursor.position < frames) {
+        return false;
+    }
+
+    data.resize(frames * channels_);
+    size_t position = cursor.position % capacity_;
+    size_t first = std::min(frames, capacity_ - position);
+    memcpy(data.data(), &buffer_[position * channels_], first * channels_ * sizeof(int16_t));
+    memcpy(data.data() + first * channels_, &buffer_[0], (frames - first) * channels_ * sizeof(int16_t));
+    cursor.position += frames;
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef MIC_RING_H
+#define MIC_RING_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Read position of one consumer of the microphone ring
+struct MicRingCursor {
+    uint64_t position = 0;      // Frames since the ring was created
+    uint32_t overruns = 0;      // Times the consumer fell behind and skipped to the oldest frame
+    bool active = false;
+};
+
+/*
+ * Interleaved 16 kHz microphone frames (one sample per input channel) written once per I2S read
+ * and read by several consumers, each at its own cursor and feed size.
+ *
+ * Used by the audio input task only, so there is no locking.
+ */
+class MicRing {
+public:
+    MicRing() = default;
+    MicRing(const MicRing&) = delete;
+    MicRing& operator=(const MicRing&) = delete;
+
+    void Configure(size_t capacity_frames, int channels);
+    void Write(const int16_t* data, size_t frames);
+    // Start the cursor at the newest frame, the consumer only sees what is written after
+    void Activate(MicRingCursor& cursor);
+    // Copy the next `frames` frames to data, false if the ring does not have that many yet
+    bool Read(MicRingCursor& cursor, std::vector<int16_t>& data, size_t frames);
+
+    int channels() const { return channels_; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    std::vector<int16_t> buffer_;
+    size_t capacity_ = 0;       // Frames
+    int channels_ = 1;
+    uint64_t written_ = 0;      // Frames
+};
+
+#endif // MIC_RING_H
@@ -0,0 +1,80 @@
+#include "opus_complexity_controller.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusComplexity"
+
+OpusComplexityController::OpusComplexityController() {
+    status_.max_complexity = OPUS_ENCODE_MAX_COMPLEXITY;
+    UpdateBitrate();
+}
+
+void OpusComplexityController::UpdateBitrate() {
+    if (status_.max_complexity == 0) {
+        status_.bitrate = OPUS_ENCODE_MIN_BITRATE;
+        return;
+    }
+    status_.bitrate = OPUS_ENCODE_MIN_BITRATE +
+        (OPUS_ENCODE_MAX_BITRATE - OPUS_ENCODE_MIN_BITRATE) * status_.complexity / status_.max_complexity;
+}
+
+bool OpusComplexityController::OnFrameEncoded(int frame_duration_ms, int64_t encode_time_us, size_t frame_bytes,
+    bool queue_backlog) {
+    status_.encoded_bytes += frame_bytes;
+    status_.encoded_time_ms += frame_duration_ms;
+    int bucket = 0;
+    while (bucket < OPUS_ENCODE_TIME_HISTOGRAM_BUCKETS - 1 && encode_time_us >= (1000LL << bucket)) {
+        bucket++;
+    }
+    status_.encode_time_histogram[bucket]++;
+
+    int64_t frame_time_us = int64_t(frame_duration_ms) * 1000;
+    if (encode_time_us >= frame_time_us) {
+        status_.overruns++;
+        window_overrun_ = true;
+    }
+    window_backlog_ |= queue_backlog;
+    window_encode_time_us_ += encode_time_us;
+    window_audio_time_us_ += frame_time_us;
+    if (++window_frames_ < OPUS_COMPLEXITY_WINDOW_FRAMES) {
+        return false;
+    }
+
+    int load = window_encode_time_us_ * 100 / window_audio_time_us_;
+    bool overloaded = load > OPUS_ENCODE_CPU_BUDGET_PERCENT || window_overrun_ || window_backlog_;
+    status_.load_percent = load;
+    window_frames_ = 0;
+    window_encode_time_us_ = 0;
+    window_audio_time_us_ = 0;
+    window_overrun_ = false;
+    window_backlog_ = false;
+    if (backoff_windows_ > 0) {
+        backoff_windows_--;
+    }
+
+    if (overloaded) {
+        idle_windows_ = 0;
+        if (status_.complexity > 0) {
+            ceiling_ = status_.complexity;
+            backoff_windows_ = OPUS_COMPLEXITY_BACKOFF_WINDOWS;
+            status_.complexity--;
+            status_.lowered++;
+            UpdateBitrate();
+            ESP_LOGI(TAG, "Load %d%%, complexity lowered to %d, bitrate %d", load, status_.complexity, status_.bitrate);
+            return true;
+        }
+    } else if (load * 2 < OPUS_ENCODE_CPU_BUDGET_PERCENT) {
+        bool allowed = backoff_windows_ == 0 || status_.complexity + 1 < ceiling_;
+        if (++idle_windows_ >= 2 && allowed && status_.complexity < status_.max_complexity) {
+            idle_windows_ = 0;
+            status_.complexity++;
+            status_.raised++;
+            UpdateBitrate();
+            ESP_LOGI(TAG, "Load %d%%, complexity raised to %d, bitrate %d", load, status_.complexity, status_.bitrate);
+            return true;
+        }
+    } else {
+        idle_windows_ = 0;
+    }
+    return false;
+}
@@ -0,0 +1,76 @@
+#ifndef OPUS_COMPLEXITY_CONTROLLER_H
+#define OPUS_COMPLEXITY_CONTROLLER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef CONFIG_OPUS_ENCODE_ADAPTIVE_COMPLEXITY
+#define OPUS_ENCODE_MAX_COMPLEXITY CONFIG_OPUS_ENCODE_MAX_COMPLEXITY
+#define OPUS_ENCODE_CPU_BUDGET_PERCENT CONFIG_OPUS_ENCODE_CPU_BUDGET_PERCENT
+#define OPUS_ENCODE_MIN_BITRATE CONFIG_OPUS_ENCODE_MIN_BITRATE
+#define OPUS_ENCODE_MAX_BITRATE CONFIG_OPUS_ENCODE_MAX_BITRATE
+#else
+#define OPUS_ENCODE_MAX_COMPLEXITY 0
+#define OPUS_ENCODE_CPU_BUDGET_PERCENT 50
+// 0: the bitrate Opus picks for the frame size
+#define OPUS_ENCODE_MIN_BITRATE 0
+#define OPUS_ENCODE_MAX_BITRATE 0
+#endif
+
+// Frames per decision window
+#define OPUS_COMPLEXITY_WINDOW_FRAMES 25
+// Windows to wait before trying a complexity that was too slow again
+#define OPUS_COMPLEXITY_BACKOFF_WINDOWS 20
+// Power of two buckets of the encode time: <1ms, <2ms, <4ms ... <64ms, >=64ms
+#define OPUS_ENCODE_TIME_HISTOGRAM_BUCKETS 8
+
+struct OpusComplexityStatus {
+    int complexity = 0;
+    int max_complexity = 0;
+    int bitrate = 0;                // bps, 0 for the Opus default
+    uint64_t encoded_bytes = 0;     // Opus frames of all the encoded frames, for the bitrate actually sent
+    uint64_t encoded_time_ms = 0;
+    uint32_t raised = 0;
+    uint32_t lowered = 0;
+    uint32_t overruns = 0;          // Frames that took longer to encode than they last
+    uint32_t load_percent = 0;      // Encode time over audio time in the last window
+    uint32_t encode_time_histogram[OPUS_ENCODE_TIME_HISTOGRAM_BUCKETS] = {};
+};
+
+/*
+ * Picks the Opus encoder complexity and bitrate from the measured encode time.
+ *
+ * The encode task reports every frame. At the end of each window the complexity is lowered at once
+ * if the load exceeds the CPU budget or a frame overran its deadline, and raised one step after
+ * two windows in a row below half of the budget. A level that was too slow is not tried again for
+ * OPUS_COMPLEXITY_BACKOFF_WINDOWS windows. Only the encode task calls it.
+ *
+ * The bitrate follows the complexity from OPUS_ENCODE_MIN_BITRATE at complexity 0 to OPUS_ENCODE_MAX_BITRATE at
+ * the highest one: a chip with headroom spends it on both, a loaded one falls back to the cheapest settings,
+ * which also encode fewer bits.
+ */
+class OpusComplexityController {
+public:
+    OpusComplexityController();
+
+    // Returns true if the complexity and the bitrate changed and must be applied to the encoder
+    bool OnFrameEncoded(int frame_duration_ms, int64_t encode_time_us, size_t frame_bytes, bool queue_backlog);
+    int complexity() const { return status_.complexity; }
+    int bitrate() const { return status_.bitrate; }
+    const OpusComplexityStatus& status() const { return status_; }
+
+private:
+    OpusComplexityStatus status_;
+    int window_frames_ = 0;
+    int64_t window_encode_time_us_ = 0;
+    int64_t window_audio_time_us_ = 0;
+    bool window_overrun_ = false;
+    bool window_backlog_ = false;
+    int idle_windows_ = 0;
+    int ceiling_ = 0;               // Lowest complexity found too slow, valid while backoff_windows_ > 0
+    int backoff_windows_ = 0;
+
+    void UpdateBitrate();
+};
+
+#endif // OPUS_COMPLEXITY_CONTROLLER_H
@@ -0,0 +1,151 @@
+#ifndef PCM_MIX_H
+#define PCM_MIX_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "sdkconfig.h"
+
+/*
+ * Gain and mix kernels of the playback mixer, Q15 gains from 0 to 32768 (unity).
+ *
+ * On the ESP32-S3 the constant gain kernels run the middle of a buffer on the PIE vector unit, 8 samples per
+ * block: the output pointer is brought to 16-byte alignment by the scalar loop, the input is read unaligned.
+ * The ramps change the gain every sample and stay scalar, they run for one chunk per gain change. Elsewhere
+ * the scalar loops run alone. The vector blocks give the same samples as the scalar loops.
+ */
+#define PCM_MIX_ALIGNMENT 16
+#define PCM_MIX_BLOCK_SAMPLES 8
+
+static inline int16_t SaturatePcm(int32_t value) {
+    return int16_t(value > 32767 ? 32767 : (value < -32768 ? -32768 : value));
+}
+
+/* Branch-free loops over plain arrays, so the compiler can vectorize them */
+static inline void ScalePcmScalar(int16_t* out, const int16_t* in, size_t samples, int32_t gain) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = SaturatePcm((int32_t(in[i]) * gain) >> 15);
+    }
+}
+
+static inline void MixPcmScalar(int16_t* out, const int16_t* in, size_t samples, int32_t gain) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = SaturatePcm(int32_t(out[i]) + ((int32_t(in[i]) * gain) >> 15));
+    }
+}
+
+static inline void ScalePcmRamp(int16_t* out, const int16_t* in, size_t samples, int32_t from_gain, int32_t to_gain) {
+    // Gain in Q23 to step by a fraction of a Q15 unit per sample
+    int32_t gain = from_gain << 8;
+    int32_t step = ((to_gain - from_gain) << 8) / int32_t(samples);
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = SaturatePcm((int32_t(in[i]) * (gain >> 8)) >> 15);
+        gain += step;
+    }
+}
+
+static inline void MixPcmRamp(int16_t* out, const int16_t* in, size_t samples, int32_t from_gain, int32_t to_gain) {
+    int32_t gain = from_gain << 8;
+    int32_t step = ((to_gain - from_gain) << 8) / int32_t(samples);
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = SaturatePcm(int32_t(out[i]) + ((int32_t(in[i]) * (gain >> 8)) >> 15));
+        gain += step;
+    }
+}
+
+// The 16-bit multiplier and shift for a Q15 gain: unity does not fit 16 bits, half of it shifted by 14 does
+static inline void PcmMixMultiplier(int32_t gain, int16_t& multiplier, int32_t& shift) {
+    multiplier = int16_t(gain >= 32768 ? 16384 : gain);
+    shift = gain >= 32768 ? 14 : 15;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+/*
+ * PIE blocks of 8 samples, out 16-byte aligned, in shifted out of two aligned loads. The vector multiply keeps
+ * the low 16 bits of the product shifted by SAR, which never exceed 16 bits for gains up to unity, and the mix
+ * adds with 16-bit saturation. The last load reads the aligned block after the input, the caller leaves at
+ * least one sample of the input to the scalar tail so that block is never past the end of the buffer.
+ */
+static inline void ScalePcmBlocks(int16_t* out, const int16_t* in, int blocks, int32_t gain) {
+    int16_t multiplier;
+    int32_t shift;
+    PcmMixMultiplier(gain, multiplier, shift);
+    asm volatile(
+        "wsr.sar            %[shift]\n"
+        "ee.vldbc.16        q7, %[multiplier]\n"
+        "ee.ld.128.usar.ip  q0, %[in], 16\n"
+        "1:\n"
+        "ee.ld.128.usar.ip  q1, %[in], 16\n"
+        "ee.src.q.qup       q2, q0, q1\n"
+        "ee.vmul.s16        q3, q2, q7\n"
+        "ee.vst.128.ip      q3, %[out], 16\n"
+        "addi               %[blocks], %[blocks], -1\n"
+        "bnez               %[blocks], 1b\n"
+        : [out] "+r"(out), [in] "+r"(in), [blocks] "+r"(blocks)
+        : [multiplier] "r"(&multiplier), [shift] "r"(shift)
+        : "memory");
+}
+
+static inline void MixPcmBlocks(int16_t* out, const int16_t* in, int blocks, int32_t gain) {
+    int16_t multiplier;
+    int32_t shift;
+    PcmMixMultiplier(gain, multiplier, shift);
+    const int16_t* mix = out;
+    asm volatile(
+        "wsr.sar            %[shift]\n"
+        "ee.vldbc.16        q7, %[multiplier]\n"
+        "ee.ld.128.usar.ip  q0, %[in], 16\n"
+        "1:\n"
+        "ee.ld.128.usar.ip  q1, %[in], 16\n"
+        "ee.src.q.qup       q2, q0, q1\n"
+        "ee.vmul.s16        q3, q2, q7\n"
+        "ee.vld.128.ip      q4, %[mix], 16\n"
+        "ee.vadds.s16       q4, q4, q3\n"
+        "ee.vst.128.ip      q4, %[out], 16\n"
+        "addi               %[blocks], %[blocks], -1\n"
+        "bnez               %[blocks], 1b\n"
+        : [out] "+r"(out), [in] "+r"(in), [mix] "+r"(mix), [blocks] "+r"(blocks)
+        : [multiplier] "r"(&multiplier), [shift] "r"(shift)
+        : "memory");
+}
+#endif
+
+// Samples before out reaches the vector alignment, and the vector blocks after them
+static inline void PcmMixSplit(const int16_t* out, size_t samples, size_t& head, int& blocks) {
+    head = (PCM_MIX_ALIGNMENT - uintptr_t(out) % PCM_MIX_ALIGNMENT) % PCM_MIX_ALIGNMENT / sizeof(int16_t);
+    blocks = samples > head ? int((samples - head - 1) / PCM_MIX_BLOCK_SAMPLES) : 0;
+}
+
+static inline void ScalePcm(int16_t* out, const int16_t* in, size_t samples, int32_t gain) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    size_t head;
+    int blocks;
+    PcmMixSplit(out, samples, head, blocks);
+    if (blocks > 0) {
+        ScalePcmScalar(out, in, head, gain);
+        ScalePcmBlocks(out + head, in + head, blocks, gain);
+        size_t done = head + blocks * PCM_MIX_BLOCK_SAMPLES;
+        ScalePcmScalar(out + done, in + done, samples - done, gain);
+        return;
+    }
+#endif
+    ScalePcmScalar(out, in, samples, gain);
+}
+
+static inline void MixPcm(int16_t* out, const int16_t* in, size_t samples, int32_t gain) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    size_t head;
+    int blocks;
+    PcmMixSplit(out, samples, head, blocks);
+    if (blocks > 0) {
+        MixPcmScalar(out, in, head, gain);
+        MixPcmBlocks(out + head, in + head, blocks, gain);
+        size_t done = head + blocks * PCM_MIX_BLOCK_SAMPLES;
+        MixPcmScalar(out + done, in + done, samples - done, gain);
+        return;
+    }
+#endif
+    MixPcmScalar(out, in, samples, gain);
+}
+
+#endif // PCM_MIX_H
@@ -0,0 +1,136 @@
+#include "playback_mixer.h"
+#include "pcm_mix.h"
+
+#include <algorithm>
+
+void PlaybackMixer::SetGain(MixerBus bus, int percent) {
+    buses_[bus].gain = std::clamp(percent, 0, 100) * 32768 / 100;
+}
+
+void PlaybackMixer::SetDucking(int percent) {
+    ducking_gain_ = std::clamp(percent, 0, 100) * 32768 / 100;
+}
+
+void PlaybackMixer::Feed(MixerBus bus, AudioTaskPtr task) {
+    if (task->pcm.empty()) {
+        return;
+    }
+    auto& b = buses_[bus];
+    b.task = std::move(task);
+    b.offset = 0;
+    b.end = b.task->pcm.size();
+    b.fade_samples = 0;
+    playing_mask_ |= 1u << bus;
+}
+
+void PlaybackMixer::FadeOut(MixerBus bus, size_t samples) {
+    auto& b = buses_[bus];
+    if (!Active(b) || samples == 0) {
+        return;
+    }
+    /* A fade already running only gets shorter */
+    size_t end = std::min(b.end, b.offset + samples);
+    if (b.fade_samples > 0 && end == b.end) {
+        return;
+    }
+    b.fade_samples = end - b.offset;
+    b.end = end;
+}
+
+int32_t PlaybackMixer::FadeGain(const Bus& bus, size_t position) const {
+    if (bus.fade_samples == 0) {
+        return 32768;
+    }
+    return int32_t(uint64_t(bus.end - position) * 32768 / bus.fade_samples);
+}
+
+bool PlaybackMixer::Finished(MixerBus bus) const {
+    auto& b = buses_[bus];
+    return b.task && b.offset >= b.end;
+}
+
+AudioTaskPtr PlaybackMixer::Release(MixerBus bus) {
+    auto& b = buses_[bus];
+    b.offset = 0;
+    b.end = 0;
+    b.fade_samples = 0;
+    playing_mask_ &= ~(1u << bus);
+    return std::move(b.task);
+}
+
+void PlaybackMixer::Clear() {
+    for (auto& bus : buses_) {
+        bus.task.reset();
+        bus.offset = 0;
+        bus.end = 0;
+        bus.fade_samples = 0;
+    }
+    playing_mask_ = 0;
+    speech_gain_ = 32768;
+}
+
+const int16_t* PlaybackMixer::Mix(size_t max_samples, size_t& samples) {
+    auto& speech = buses_[kMixerBusSpeech];
+    auto& effects = buses_[kMixerBusEffects];
+    bool speech_playing = Active(speech);
+    bool effects_playing = Active(effects);
+    if (!speech_playing && !effects_playing) {
+        return nullptr;
+    }
+    samples = max_samples;
+    for (auto& bus : buses_) {
+        if (Active(bus)) {
+            samples = std::min(samples, bus.end - bus.offset);
+        }
+    }
+
+    int32_t effects_gain = effects.gain;
+    int32_t speech_target = effects_playing ? (speech.gain * ducking_gain_) >> 15 : int32_t(speech.gain);
+
+    if (!effects_playing) {
+        if (speech_gain_ == 32768 && speech_target == 32768 && speech.fade_samples == 0) {
+            const int16_t* pcm = speech.task->pcm.data() + speech.offset;
+            speech.offset += samples;
+            statistics_.passthrough++;
+            return pcm;
+        }
+    } else if (!speech_playing && effects_gain == 32768 && effects.fade_samples == 0) {
+        const int16_t* pcm = effects.task->pcm.data() + effects.offset;
+        effects.offset += samples;
+        statistics_.passthrough++;
+        return pcm;
+    }
+
+    output_.resize(samples);
+    if (speech_playing) {
+        const int16_t* in = speech.task->pcm.data() + speech.offset;
+        int32_t from = (speech_gain_ * FadeGain(speech, speech.offset)) >> 15;
+        int32_t to = (speech_target * FadeGain(speech, speech.offset + samples)) >> 15;
+        if (from == to) {
+            ScalePcm(output_.data(), in, samples, to);
+        } else {
+            ScalePcmRamp(output_.data(), in, samples, from, to);
+        }
+        speech_gain_ = speech_target;
+        speech.offset += samples;
+    }
+    if (effects_playing) {
+        const int16_t* in = effects.task->pcm.data() + effects.offset;
+        int32_t from = (effects_gain * FadeGain(effects, effects.offset)) >> 15;
+        int32_t to = (effects_gain * FadeGain(effects, effects.offset + samples)) >> 15;
+        if (speech_playing) {
+            if (from == to) {
+                MixPcm(output_.data(), in, samples, to);
+            } else {
+                MixPcmRamp(output_.data(), in, samples, from, to);
+            }
+            statistics_.mixed++;
+        } else if (from == to) {
+            ScalePcm(output_.data(), in, samples, to);
+        } else {
+            ScalePcmRamp(output_.data(), in, samples, from, to);
+        }
+        effects.offset += samples;
+    }
+    return output_.data();
+}
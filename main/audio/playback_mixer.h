@@ -0,0 +1,76 @@
+#ifndef PLAYBACK_MIXER_H
+#define PLAYBACK_MIXER_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "audio_task_pool.h"
+
+// Speech volume while a sound plays, in percent, 100 disables ducking
+#define PLAYBACK_MIXER_DUCKING_PERCENT 40
+
+enum MixerBus {
+    kMixerBusSpeech,    // Server speech and audio testing
+    kMixerBusEffects,   // Local sounds
+    kMixerBusCount,
+};
+
+struct PlaybackMixerStatistics {
+    uint32_t mixed = 0;         // Output chunks with both buses playing
+    uint32_t passthrough = 0;   // Chunks written straight from the decoded task, no copy
+};
+
+/*
+ * Mixes the playback buses in front of the codec, so a sound does not wait behind the queued speech.
+ *
+ * Each bus plays one decoded AudioTask at a time. Mix() returns at most max_samples that every playing
+ * bus still has, so frames of different sizes stay aligned, and a single bus at unity gain is passed
+ * through without a copy. While a sound plays, the speech bus is ducked with a gain ramp over one output
+ * chunk. FadeOut() cuts a bus short after a ramp to silence, for barge-in.
+ *
+ * Only the audio output task plays the buses, the gains can be set from any task.
+ */
+class PlaybackMixer {
+public:
+    void SetGain(MixerBus bus, int percent);
+    void SetDucking(int percent);
+
+    // Start the next task of a bus that is not playing
+    void Feed(MixerBus bus, AudioTaskPtr task);
+    bool Playing(MixerBus bus) const { return bool(buses_[bus].task); }
+    // No bus holds a task, including one that is fading out, safe to call from any task
+    bool Idle() const { return playing_mask_ == 0; }
+    // Ramp the playing task of the bus to silence over the next samples and drop the rest of it
+    void FadeOut(MixerBus bus, size_t samples);
+    // The task was written out completely, Release() it before feeding the bus again
+    bool Finished(MixerBus bus) const;
+    AudioTaskPtr Release(MixerBus bus);
+    void Clear();
+
+    // The next output chunk, either in the mix buffer or in the buffer of a playing task, nullptr if nothing plays
+    const int16_t* Mix(size_t max_samples, size_t& samples);
+    PlaybackMixerStatistics GetStatistics() const { return statistics_; }
+
+private:
+    struct Bus {
+        AudioTaskPtr task;
+        size_t offset = 0;
+        size_t end = 0;             // Played up to here, before the end of the task when it fades out
+        size_t fade_samples = 0;    // The fade runs over [end - fade_samples, end), 0 if not fading
+        std::atomic<int32_t> gain{32768};   // Q15
+    };
+
+    Bus buses_[kMixerBusCount];
+    std::atomic<uint32_t> playing_mask_{0};  // Bit per bus holding a task, for Idle()
+    std::atomic<int32_t> ducking_gain_{PLAYBACK_MIXER_DUCKING_PERCENT * 32768 / 100};
+    int32_t speech_gain_ = 32768;           // Applied to the last frame, the start of the next ramp
+    std::vector<int16_t> output_;
+    PlaybackMixerStatistics statistics_;
+
+    bool Active(const Bus& bus) const { return bus.task && bus.offset < bus.end; }
+    int32_t FadeGain(const Bus& bus, size_t position) const;
+};
+
+#endif // PLAYBACK_MIXER_H
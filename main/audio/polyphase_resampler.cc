@@ -0,0 +1,35 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <numeric>
+
+#define TAG "PolyphaseResampler"
+
+std::unique_ptr<Resampler> CreatePolyphaseResampler(int input_sample_rate, int output_sample_rate, int channels) {
+    if (input_sample_rate <= 0 || output_sample_rate <= 0 || channels <= 0) {
+        return nullptr;
+    }
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    int up = output_sample_rate / divisor;
+    int down = input_sample_rate / divisor;
+
+    /* The ratios of our boards and servers: 24k mics and codecs, 16k audio, 48k codecs */
+    std::unique_ptr<Resampler> resampler;
+    if (up == 2 && down == 3) {
+        resampler = std::make_unique<PolyphaseResampler<2, 3>>(channels);
+    } else if (up == 3 && down == 2) {
+        resampler = std::make_unique<PolyphaseResampler<3, 2>>(channels);
+    } else if (up == 1 && down == 3) {
+        resampler = std::make_unique<PolyphaseResampler<1, 3>>(channels);
+    } else if (up == 3 && down == 1) {
+        resampler = std::make_unique<PolyphaseResampler<3, 1>>(channels);
+    } else if (up == 1 && down == 2) {
+        resampler = std::make_unique<PolyphaseResampler<1, 2>>(channels);
+    } else if (up == 2 && down == 1) {
+        resampler = std::make_unique<PolyphaseResampler<2, 1>>(channels);
+    } else {
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "%d -> %d Hz, %d channel(s)", input_sample_rate, output_sample_rate, channels);
+    return resampler;
+}
@@ -0,0 +1,302 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "sdkconfig.h"
+
+// Zero crossings of the windowed sinc on each side of its center, sets the taps per output sample
+#define POLYPHASE_RESAMPLER_ZERO_CROSSINGS 16
+// Kaiser window beta, about 80 dB of stopband attenuation
+#define POLYPHASE_RESAMPLER_KAISER_BETA 8.0
+// -6 dB point relative to the lower Nyquist frequency, 0.85 puts 6.8 kHz at 16 kHz
+#define POLYPHASE_RESAMPLER_CUTOFF 0.85
+// Samples after the input the vector loads may read, they are never used
+#define POLYPHASE_RESAMPLER_PADDING 16
+
+// Interleaved 16-bit PCM sample rate conversion
+class Resampler {
+public:
+    virtual ~Resampler() = default;
+    // Output samples of the next Process() call, exact for the current filter phase
+    virtual size_t GetOutputSamples(size_t input_samples) const = 0;
+    virtual size_t Process(const int16_t* input, size_t input_samples, int16_t* output) = 0;
+    virtual void Reset() = 0;
+};
+
+namespace polyphase_resampler {
+
+constexpr double kPi = 3.14159265358979323846;
+
+constexpr double Sin(double x) {
+    while (x > kPi) {
+        x -= 2 * kPi;
+    }
+    while (x < -kPi) {
+        x += 2 * kPi;
+    }
+    double term = x;
+    double sum = x;
+    for (int i = 1; i < 14; i++) {
+        term *= -x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double Sqrt(double x) {
+    if (x <= 0) {
+        return 0;
+    }
+    double root = x > 1 ? x : 1;
+    for (int i = 0; i < 40; i++) {
+        root = 0.5 * (root + x / root);
+    }
+    return root;
+}
+
+constexpr double BesselI0(double x) {
+    double term = 1;
+    double sum = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+ * Kaiser windowed sinc for upsampling by L and downsampling by M, split into L phases of Q15
+ * coefficients. Built at compile time. Each phase is normalized to unity DC gain and stored in
+ * reverse, so it is a plain dot product with the oldest-first input window.
+ */
+template <int L, int M>
+struct Filter {
+    static constexpr int kPhases = L;
+    static constexpr int kTaps = 2 * POLYPHASE_RESAMPLER_ZERO_CROSSINGS * (L > M ? L : M) / L;
+    static constexpr int kLength = L * kTaps;
+
+    // Each phase starts 16-byte aligned for the vector loads
+    alignas(16) int16_t coefficients[L][kTaps];
+
+    constexpr Filter() : coefficients() {
+        double prototype[kLength] = {};
+        double cutoff = POLYPHASE_RESAMPLER_CUTOFF * 0.5 / (L > M ? L : M);
+        double center = (kLength - 1) / 2.0;
+        double window_gain = BesselI0(POLYPHASE_RESAMPLER_KAISER_BETA);
+        for (int n = 0; n < kLength; n++) {
+            double t = n - center;
+            double sinc = t == 0 ? 2 * cutoff : Sin(2 * kPi * cutoff * t) / (kPi * t);
+            double r = 2.0 * n / (kLength - 1) - 1;
+            prototype[n] = sinc * BesselI0(POLYPHASE_RESAMPLER_KAISER_BETA * Sqrt(1 - r * r)) / window_gain;
+        }
+
+        for (int p = 0; p < L; p++) {
+            double sum = 0;
+            for (int j = 0; j < kTaps; j++) {
+                sum += prototype[p + j * L];
+            }
+            for (int j = 0; j < kTaps; j++) {
+                double value = prototype[p + j * L] / sum * 32768;
+                int rounded = int(value + (value >= 0 ? 0.5 : -0.5));
+                coefficients[p][kTaps - 1 - j] = int16_t(rounded > 32767 ? 32767 : (rounded < -32768 ? -32768 : rounded));
+            }
+        }
+    }
+
+    // Largest sum of absolute coefficients of a phase, bounds the accumulator
+    constexpr int32_t MaxAbsoluteSum() const {
+        int32_t max_sum = 0;
+        for (int p = 0; p < L; p++) {
+            int32_t sum = 0;
+            for (int j = 0; j < kTaps; j++) {
+                sum += coefficients[p][j] < 0 ? -coefficients[p][j] : coefficients[p][j];
+            }
+            max_sum = sum > max_sum ? sum : max_sum;
+        }
+        return max_sum;
+    }
+};
+
+template <int L, int M>
+inline constexpr Filter<L, M> kFilter{};
+
+inline int16_t Saturate(int32_t acc) {
+    acc = (acc + (1 << 14)) >> 15;
+    return int16_t(acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc));
+}
+
+/* Two accumulators, so the multiply-accumulates of consecutive taps do not wait on each other */
+template <int kTaps>
+inline int32_t DotMono(const int16_t* h, const int16_t* x) {
+    int32_t acc0 = 0;
+    int32_t acc1 = 0;
+    int j = 0;
+    for (; j + 1 < kTaps; j += 2) {
+        acc0 += int32_t(h[j]) * x[j];
+        acc1 += int32_t(h[j + 1]) * x[j + 1];
+    }
+    if (j < kTaps) {
+        acc0 += int32_t(h[j]) * x[j];
+    }
+    return acc0 + acc1;
+}
+
+// One channel of an interleaved stereo window
+template <int kTaps>
+inline int32_t DotStereo(const int16_t* h, const int16_t* x) {
+    int32_t acc = 0;
+    for (int j = 0; j < kTaps; j++) {
+        acc += int32_t(h[j]) * x[2 * j];
+    }
+    return acc;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+/*
+ * PIE dot products over blocks of 8 taps: h is 16-byte aligned, x is not, each unaligned block of x is
+ * shifted out of two aligned loads. ACCX sums the products in 40 bits, the filter gain keeps the result
+ * within its low 32 bits, so it is the scalar sum. The loads read up to 16 bytes past the window.
+ */
+inline int32_t DotMonoBlocks(const int16_t* h, const int16_t* x, int blocks) {
+    int32_t acc;
+    asm volatile(
+        "ee.zero.accx\n"
+        "ee.ld.128.usar.ip  q0, %[x], 16\n"
+        "1:\n"
+        "ee.ld.128.usar.ip  q1, %[x], 16\n"
+        "ee.vld.128.ip      q2, %[h], 16\n"
+        "ee.src.q.qup       q3, q0, q1\n"
+        "ee.vmulas.s16.accx q3, q2\n"
+        "addi               %[blocks], %[blocks], -1\n"
+        "bnez               %[blocks], 1b\n"
+        "rur.accx_0         %[acc]\n"
+        : [x] "+r"(x), [h] "+r"(h), [blocks] "+r"(blocks), [acc] "=r"(acc)
+        :
+        : "memory");
+    return acc;
+}
+
+/* Two unaligned blocks of the interleaved window, the even samples are the channel x points to */
+inline int32_t DotStereoBlocks(const int16_t* h, const int16_t* x, int blocks) {
+    int32_t acc;
+    asm volatile(
+        "ee.zero.accx\n"
+        "ee.ld.128.usar.ip  q0, %[x], 16\n"
+        "1:\n"
+        "ee.ld.128.usar.ip  q1, %[x], 16\n"
+        "ee.src.q.qup       q3, q0, q1\n"
+        "ee.ld.128.usar.ip  q1, %[x], 16\n"
+        "ee.src.q.qup       q4, q0, q1\n"
+        "ee.vunzip.16       q3, q4\n"
+        "ee.vld.128.ip      q2, %[h], 16\n"
+        "ee.vmulas.s16.accx q3, q2\n"
+        "addi               %[blocks], %[blocks], -1\n"
+        "bnez               %[blocks], 1b\n"
+        "rur.accx_0         %[acc]\n"
+        : [x] "+r"(x), [h] "+r"(h), [blocks] "+r"(blocks), [acc] "=r"(acc)
+        :
+        : "memory");
+    return acc;
+}
+#endif
+
+} // namespace polyphase_resampler
+
+/*
+ * Fixed-point polyphase resampler by L/M with a compile-time filter table.
+ *
+ * All channels of an interleaved frame are filtered in the same pass, sharing the coefficient loads,
+ * so the microphone and the AEC reference need one instance and no deinterleaving. The last
+ * kTaps - 1 input frames are kept between calls, the output is delayed by half the filter length.
+ */
+template <int L, int M>
+class PolyphaseResampler : public Resampler {
+public:
+    using FilterType = polyphase_resampler::Filter<L, M>;
+    static constexpr int kTaps = FilterType::kTaps;
+    // Sum of |h| below 2.0 keeps the Q15 x Q15 accumulator within 32 bits
+    static_assert(polyphase_resampler::kFilter<L, M>.MaxAbsoluteSum() < 65536, "Filter gain overflows the accumulator");
+    static_assert(kTaps % 8 == 0, "The vector dot products take blocks of 8 taps");
+
+    explicit PolyphaseResampler(int channels) : channels_(channels) {
+        Reset();
+    }
+
+    size_t GetOutputSamples(size_t input_samples) const override {
+        size_t span = input_samples / channels_ * L;
+        return span > next_ ? (span - next_ + M - 1) / M * channels_ : 0;
+    }
+
+    size_t Process(const int16_t* input, size_t input_samples, int16_t* output) override {
+        const size_t history = (kTaps - 1) * channels_;
+        size_t frames = input_samples / channels_;
+        /* buffer_ keeps its capacity, so only the first call of a size allocates */
+        buffer_.resize(history + frames * channels_ + POLYPHASE_RESAMPLER_PADDING);
+        memcpy(buffer_.data() + history, input, frames * channels_ * sizeof(int16_t));
+
+        const auto& filter = polyphase_resampler::kFilter<L, M>;
+        const size_t span = frames * L;
+        int16_t* out = output;
+        for (; next_ < span; next_ += M) {
+            /* The window ends at input frame next_ / L, which is buffer frame next_ / L + kTaps - 1 */
+            const int16_t* x = buffer_.data() + next_ / L * channels_;
+            const int16_t* h = filter.coefficients[next_ % L];
+            if (channels_ == 1) {
+                *out++ = polyphase_resampler::Saturate(DotMono(h, x));
+            } else if (channels_ == 2) {
+                *out++ = polyphase_resampler::Saturate(DotStereo(h, x));
+                *out++ = polyphase_resampler::Saturate(DotStereo(h, x + 1));
+            } else {
+                for (int c = 0; c < channels_; c++) {
+                    int32_t acc = 0;
+                    for (int j = 0; j < kTaps; j++) {
+                        acc += int32_t(h[j]) * x[j * channels_ + c];
+                    }
+                    *out++ = polyphase_resampler::Saturate(acc);
+                }
+            }
+        }
+        next_ -= span;
+
+        memmove(buffer_.data(), buffer_.data() + frames * channels_, history * sizeof(int16_t));
+        buffer_.resize(history);
+        return out - output;
+    }
+
+    void Reset() override {
+        buffer_.assign((kTaps - 1) * channels_, 0);
+        next_ = 0;
+    }
+
+private:
+    const int channels_;
+    std::vector<int16_t> buffer_;
+    // Position of the next output at the upsampled rate, relative to the first frame of the next input
+    size_t next_ = 0;
+
+    static inline int32_t DotMono(const int16_t* h, const int16_t* x) {
+#if CONFIG_IDF_TARGET_ESP32S3
+        return polyphase_resampler::DotMonoBlocks(h, x, kTaps / 8);
+#else
+        return polyphase_resampler::DotMono<kTaps>(h, x);
+#endif
+    }
+
+    static inline int32_t DotStereo(const int16_t* h, const int16_t* x) {
+#if CONFIG_IDF_TARGET_ESP32S3
+        return polyphase_resampler::DotStereoBlocks(h, x, kTaps / 8);
+#else
+        return polyphase_resampler::DotStereo<kTaps>(h, x);
+#endif
+    }
+};
+
+// A polyphase resampler if there is a filter table for the rate pair, nullptr otherwise
+std::unique_ptr<Resampler> CreatePolyphaseResampler(int input_sample_rate, int output_sample_rate, int channels);
+
+#endif // POLYPHASE_RESAMPLER_H
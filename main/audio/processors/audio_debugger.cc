@@ -3,6 +3,8 @@
 
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
@@ -20,16 +22,16 @@ AudioDebugger::AudioDebugger() {
         // 解析配置的服务器地址 "IP:PORT"
         std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
         size_t colon_pos = server_addr.find(':');
-        
+
         if (colon_pos != std::string::npos) {
             std::string ip = server_addr.substr(0, colon_pos);
             int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
+
             memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
             udp_server_addr_.sin_family = AF_INET;
             udp_server_addr_.sin_port = htons(port);
             inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
+
             ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
         } else {
             ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
@@ -39,11 +41,48 @@ AudioDebugger::AudioDebugger() {
     } else {
         ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
     }
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+
+    /* The ring lives in PSRAM, only its control block has to be internal. Without PSRAM a smaller
+       internal ring drops more frames on a slow network, but the capture still works */
+    ring_struct_ = (StaticRingbuffer_t*)heap_caps_malloc(sizeof(StaticRingbuffer_t), MALLOC_CAP_INTERNAL);
+    size_t ring_size = AUDIO_DEBUGGER_RING_SIZE;
+    ring_storage_ = (uint8_t*)heap_caps_malloc(ring_size, MALLOC_CAP_SPIRAM);
+    if (ring_storage_ == nullptr) {
+        ring_size = AUDIO_DEBUGGER_INTERNAL_RING_SIZE;
+        ring_storage_ = (uint8_t*)heap_caps_malloc(ring_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (ring_storage_ != nullptr) {
+            ESP_LOGW(TAG, "No PSRAM, using a %u bytes internal capture ring", (unsigned)ring_size);
+        }
+    }
+    if (ring_struct_ == nullptr || ring_storage_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the capture ring");
+        return;
+    }
+    ring_ = xRingbufferCreateStatic(ring_size, RINGBUF_TYPE_NOSPLIT, ring_storage_, ring_struct_);
+    xTaskCreate([](void* arg) {
+        auto this_ = (AudioDebugger*)arg;
+        this_->SenderTask();
+    }, "audio_debugger", 4096, this, 1, &sender_task_);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    if (sender_task_ != nullptr) {
+        vTaskDelete(sender_task_);
+    }
+    if (ring_ != nullptr) {
+        vRingbufferDelete(ring_);
+    }
+    if (ring_storage_ != nullptr) {
+        heap_caps_free(ring_storage_);
+    }
+    if (ring_struct_ != nullptr) {
+        heap_caps_free(ring_struct_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +90,63 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+void AudioDebugger::Capture(AudioDebugStream stream, const int16_t* data, size_t frames, int channels, int channel,
+    int sample_rate) {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
-                             (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+    if (ring_ == nullptr || stream >= kAudioDebugStreamCount || frames == 0 || frames > UINT16_MAX) {
+        return;
+    }
+    /* The sequence advances for dropped frames too, so the receiver sees the gap */
+    uint32_t sequence = sequences_[stream]++;
+    size_t size = sizeof(AudioDebugFrameHeader) + frames * sizeof(int16_t);
+    void* item = nullptr;
+    if (xRingbufferSendAcquire(ring_, &item, size, 0) != pdTRUE) {
+        dropped_++;
+        return;
+    }
+
+    AudioDebugFrameHeader header = {
+        .magic = AUDIO_DEBUGGER_FRAME_MAGIC,
+        .version = AUDIO_DEBUGGER_FRAME_VERSION,
+        .stream = stream,
+        .samples = uint16_t(frames),
+        .sequence = sequence,
+        .sample_rate = uint32_t(sample_rate),
+        .timestamp_us = esp_timer_get_time(),
+    };
+    memcpy(item, &header, sizeof(header));
+    int16_t* samples = (int16_t*)((uint8_t*)item + sizeof(header));
+    if (channels == 1) {
+        memcpy(samples, data, frames * sizeof(int16_t));
+    } else {
+        for (size_t i = 0; i < frames; i++) {
+            samples[i] = data[i * channels + channel];
+        }
+    }
+    xRingbufferSendComplete(ring_, item);
+#endif
+}
+
+void AudioDebugger::SenderTask() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    uint32_t reported_dropped = 0;
+    while (true) {
+        size_t size = 0;
+        void* item = xRingbufferReceive(ring_, &size, portMAX_DELAY);
+        if (item == nullptr) {
+            continue;
+        }
+        ssize_t sent = sendto(udp_sockfd_, item, size, 0, (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+        vRingbufferReturnItem(ring_, item);
         if (sent < 0) {
             ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
-        } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+        }
+
+        uint32_t dropped = dropped_;
+        if (dropped != reported_dropped) {
+            ESP_LOGW(TAG, "Capture ring full, %lu frames dropped", (unsigned long)dropped);
+            reported_dropped = dropped;
         }
     }
 #endif
 }
-
- 
\ No newline at end of file
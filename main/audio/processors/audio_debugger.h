@@ -1,22 +1,69 @@
 #ifndef AUDIO_DEBUGGER_H
 #define AUDIO_DEBUGGER_H
 
-#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/ringbuf.h>
+
+#include <atomic>
 #include <cstdint>
+#include <cstddef>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+// Frames waiting for the sender task, a capture that does not fit is dropped instead of waiting
+#define AUDIO_DEBUGGER_RING_SIZE (64 * 1024)
+// Used when there is no PSRAM, enough for a few frames of each stream
+#define AUDIO_DEBUGGER_INTERNAL_RING_SIZE (16 * 1024)
+#define AUDIO_DEBUGGER_FRAME_MAGIC 0x44415A58   // "XZAD" in little-endian
+#define AUDIO_DEBUGGER_FRAME_VERSION 1
+
+enum AudioDebugStream : uint8_t {
+    kAudioDebugStreamMic,           // Microphone at 16 kHz, as fed to the wake word and the processor
+    kAudioDebugStreamReference,     // AEC reference, captured with the same frames as the microphone
+    kAudioDebugStreamProcessed,     // Audio processor output
+    kAudioDebugStreamPlayback,      // Mixer output written to the codec
+    kAudioDebugStreamCount,
+};
+
+// Each UDP datagram is this header followed by the 16-bit samples, all little-endian
+struct __attribute__((packed)) AudioDebugFrameHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t stream;
+    uint16_t samples;
+    uint32_t sequence;          // Per stream, a gap means the frames were dropped
+    uint32_t sample_rate;
+    int64_t timestamp_us;       // esp_timer_get_time() when captured
+};
+static_assert(sizeof(AudioDebugFrameHeader) == 24, "The header is part of the capture format");
+
+/*
+ * Captures the audio streams to a UDP server (scripts/audio_debug_server.py) in framed datagrams.
+ *
+ * Capture() copies the frame into a ring buffer and returns at once, it never waits for the network,
+ * so the audio tasks are not slowed down. A sender task drains the ring to the socket.
+ */
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    // Capture one channel of interleaved frames, called from any task
+    void Capture(AudioDebugStream stream, const int16_t* data, size_t frames, int channels, int channel, int sample_rate);
 
 private:
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+    RingbufHandle_t ring_ = nullptr;
+    StaticRingbuffer_t* ring_struct_ = nullptr;
+    uint8_t* ring_storage_ = nullptr;
+    TaskHandle_t sender_task_ = nullptr;
+    std::atomic<uint32_t> sequences_[kAudioDebugStreamCount] = {};
+    std::atomic<uint32_t> dropped_{0};
+
+    void SenderTask();
 };
 
-#endif 
\ No newline at end of file
+#endif
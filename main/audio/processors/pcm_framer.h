@@ -0,0 +1,47 @@
+#ifndef PCM_FRAMER_H
+#define PCM_FRAMER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/*
+ * Cuts a stream of PCM chunks of any size into frames of a fixed size.
+ *
+ * Every sample is copied once, straight from the chunk into the frame buffer, and the frame buffer
+ * is reused, whatever the chunk and frame sizes are.
+ */
+class PcmFramer {
+public:
+    // Calls on_frame(std::vector<int16_t>&&) for every frame completed by the chunk
+    template <typename Callback>
+    void Push(const int16_t* data, size_t samples, size_t frame_samples, Callback&& on_frame) {
+        if (buffer_.size() > frame_samples) {
+            // Left from a session with longer frames
+            buffer_.clear();
+        }
+        while (samples > 0) {
+            size_t taken = std::min(samples, frame_samples - buffer_.size());
+            buffer_.insert(buffer_.end(), data, data + taken);
+            data += taken;
+            samples -= taken;
+            if (buffer_.size() == frame_samples) {
+                on_frame(std::move(buffer_));
+                // Only allocates if the callback kept the buffer
+                buffer_.clear();
+                buffer_.reserve(frame_samples);
+            }
+        }
+    }
+
+    void Reserve(size_t frame_samples) { buffer_.reserve(frame_samples); }
+    // Drop the partial frame, keeps the buffer
+    void Clear() { buffer_.clear(); }
+    size_t pending() const { return buffer_.size(); }
+
+private:
+    std::vector<int16_t> buffer_;
+};
+
+#endif // PCM_FRAMER_H
@@ -0,0 +1,268 @@
+#include "sound_player.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#define TAG "SoundPlayer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+
+std::shared_ptr<const OggPacketIndex> OggPacketIndex::Parse(const std::string_view& ogg) {
+    auto index = std::make_shared<OggPacketIndex>();
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
+    size_t size = ogg.size();
+    size_t offset = 0;
+    bool seen_head = false;
+    bool seen_tags = false;
+
+    while (offset + OGG_PAGE_HEADER_SIZE <= size) {
+        const uint8_t* page = buf + offset;
+        if (std::memcmp(page, "OggS", 4) != 0) {
+            // Lost sync, look for the next capture pattern
+            offset++;
+            continue;
+        }
+        uint8_t page_segments = page[26];
+        size_t body_off = offset + OGG_PAGE_HEADER_SIZE + page_segments;
+        if (body_off > size) {
+            break;
+        }
+        size_t body_size = 0;
+        for (size_t i = 0; i < page_segments; ++i) {
+            body_size += page[OGG_PAGE_HEADER_SIZE + i];
+        }
+        if (body_off + body_size > size) {
+            break;
+        }
+
+        // Parse packets using lacing
+        bool skip_first = page[5] & OGG_HEADER_TYPE_CONTINUED;
+        size_t cur = body_off;
+        size_t seg_idx = 0;
+        while (seg_idx < page_segments) {
+            size_t pkt_start = cur;
+            size_t pkt_len = 0;
+            uint8_t l;
+            do {
+                l = page[OGG_PAGE_HEADER_SIZE + seg_idx++];
+                pkt_len += l;
+                cur += l;
+            } while (l == 255 && seg_idx < page_segments);
+
+            if (skip_first) {
+                skip_first = false;
+                continue;
+            }
+            if (l == 255) {
+                ESP_LOGW(TAG, "Packet spanning pages is not supported, dropped");
+                continue;
+            }
+            if (pkt_len == 0) {
+                continue;
+            }
+
+            const uint8_t* pkt_ptr = buf + pkt_start;
+            if (!seen_head) {
+                // OpusHead: [0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip,
+                // [12-15] input_sample_rate (little-endian), [16-17] output_gain, [18] mapping_family
+                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
+                    seen_head = true;
+                    index->sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
+                }
+                continue;
+            }
+            if (!seen_tags) {
+                // Expect OpusTags in second packet
+                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
+                    seen_tags = true;
+                }
+                continue;
+            }
+            index->packets.push_back({static_cast<uint32_t>(pkt_start), static_cast<uint32_t>(pkt_len)});
+        }
+
+        offset = body_off + body_size;
+    }
+
+    index->packets.shrink_to_fit();
+    ESP_LOGI(TAG, "Indexed %u packets, sample_rate=%d", (unsigned)index->packets.size(), index->sample_rate);
+    return index;
+}
+
+SoundPcm::SoundPcm(size_t capacity) {
+    data = (int16_t*)heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (data != nullptr) {
+        this->capacity = capacity;
+    }
+}
+
+SoundPcm::~SoundPcm() {
+    if (data != nullptr) {
+        heap_caps_free(data);
+    }
+}
+
+void SoundPlayback::SetDone() {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    done_cv.notify_all();
+}
+
+void SoundHandle::Cancel() {
+    if (playback_) {
+        playback_->cancelled = true;
+        playback_->SetDone();
+    }
+}
+
+bool SoundHandle::Wait(int timeout_ms) {
+    if (!playback_) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(playback_->mutex);
+    if (timeout_ms < 0) {
+        playback_->done_cv.wait(lock, [this]() { return playback_->done; });
+        return true;
+    }
+    return playback_->done_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return playback_->done; });
+}
+
+bool SoundHandle::IsDone() const {
+    if (!playback_) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(playback_->mutex);
+    return playback_->done;
+}
+
+SoundHandle SoundPlayer::Play(const std::string_view& ogg) {
+    auto playback = std::make_shared<SoundPlayback>();
+    playback->data = reinterpret_cast<const uint8_t*>(ogg.data());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pcm = pcm_cache_.find(ogg.data());
+    if (pcm != pcm_cache_.end()) {
+        cache_statistics_.hits++;
+        playback->pcm = pcm->second;
+    } else {
+        auto it = index_cache_.find(ogg.data());
+        if (it == index_cache_.end()) {
+            it = index_cache_.emplace(ogg.data(), OggPacketIndex::Parse(ogg)).first;
+        }
+        playback->index = it->second;
+        if (ogg.size() <= size_t(SOUND_PCM_CACHE_MAX_SOUND_SIZE)) {
+            cache_statistics_.misses++;
+        } else {
+            playback->fill_failed = true;
+        }
+    }
+    playbacks_.push_back(playback);
+    return SoundHandle(playback);
+}
+
+void SoundPlayer::FinishPlayback(SoundPlayback& playback) {
+    if (!playback.cancelled && !playback.fill_failed && playback.fill && playback.fill->samples > 0) {
+        const char* key = reinterpret_cast<const char*>(playback.data);
+        size_t bytes = playback.fill->capacity * sizeof(int16_t);
+        if (pcm_cache_.find(key) == pcm_cache_.end() && cache_statistics_.bytes + bytes <= SOUND_PCM_CACHE_SIZE) {
+            pcm_cache_.emplace(key, std::shared_ptr<const SoundPcm>(std::move(playback.fill)));
+            cache_statistics_.sounds++;
+            cache_statistics_.bytes += bytes;
+        }
+    }
+    playback.fill.reset();
+    playback.SetDone();
+}
+
+bool SoundPlayer::Next(SoundFrame& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decoding_.reset();
+    while (!playbacks_.empty()) {
+        auto& playback = playbacks_.front();
+        if (playback->pcm) {
+            auto& pcm = *playback->pcm;
+            if (playback->cancelled || playback->next_sample >= pcm.samples) {
+                FinishPlayback(*playback);
+                playbacks_.pop_front();
+                continue;
+            }
+            frame.pcm = pcm.data + playback->next_sample;
+            frame.samples = std::min(pcm.frame_samples, pcm.samples - playback->next_sample);
+            playback->next_sample += frame.samples;
+            return true;
+        }
+
+        if (playback->cancelled || playback->next_packet >= playback->index->packets.size()) {
+            FinishPlayback(*playback);
+            playbacks_.pop_front();
+            continue;
+        }
+
+        auto& entry = playback->index->packets[playback->next_packet++];
+        const uint8_t* payload = playback->data + entry.offset;
+        frame.pcm = nullptr;
+        frame.samples = 0;
+        frame.packet.sample_rate = playback->index->sample_rate;
+        frame.packet.frame_duration = 60;
+        frame.packet.timestamp = 0;
+        frame.packet.sequence = 0;
+        frame.packet.payload.assign(payload, payload + entry.size);
+        decoding_ = playback;
+        return true;
+    }
+    return false;
+}
+
+void SoundPlayer::OnDecoded(const std::vector<int16_t>* pcm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!decoding_ || decoding_->fill_failed) {
+        return;
+    }
+    auto& playback = *decoding_;
+    if (pcm == nullptr) {
+        playback.fill_failed = true;
+        return;
+    }
+    if (!playback.fill) {
+        // Every packet of a sound decodes to the same frame size
+        size_t capacity = playback.index->packets.size() * pcm->size();
+        if (cache_statistics_.bytes + capacity * sizeof(int16_t) > SOUND_PCM_CACHE_SIZE) {
+            playback.fill_failed = true;
+            return;
+        }
+        playback.fill = std::make_unique<SoundPcm>(capacity);
+        playback.fill->frame_samples = pcm->size();
+    }
+    auto& fill = *playback.fill;
+    if (fill.samples + pcm->size() > fill.capacity) {
+        ESP_LOGW(TAG, "Sound is not cached, not enough PSRAM or variable frame size");
+        playback.fill_failed = true;
+        playback.fill.reset();
+        return;
+    }
+    std::memcpy(fill.data + fill.samples, pcm->data(), pcm->size() * sizeof(int16_t));
+    fill.samples += pcm->size();
+}
+
+void SoundPlayer::CancelAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& playback : playbacks_) {
+        playback->cancelled = true;
+        playback->SetDone();
+    }
+    playbacks_.clear();
+}
+
+bool SoundPlayer::Empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return playbacks_.empty();
+}
+
+SoundPcmCacheStatistics SoundPlayer::GetCacheStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cache_statistics_;
+}
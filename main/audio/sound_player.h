@@ -0,0 +1,127 @@
+#ifndef SOUND_PLAYER_H
+#define SOUND_PLAYER_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+
+#include "protocol.h"
+
+#ifdef CONFIG_USE_SOUND_PCM_CACHE
+#define SOUND_PCM_CACHE_MAX_SOUND_SIZE CONFIG_SOUND_PCM_CACHE_MAX_SOUND_SIZE
+#define SOUND_PCM_CACHE_SIZE (CONFIG_SOUND_PCM_CACHE_SIZE_KB * 1024)
+#else
+#define SOUND_PCM_CACHE_MAX_SOUND_SIZE 0
+#define SOUND_PCM_CACHE_SIZE 0
+#endif
+
+// Opus packets of an embedded OGG file, located once and played straight from the flash mapping
+struct OggPacketIndex {
+    struct Entry {
+        uint32_t offset;
+        uint32_t size;
+    };
+    int sample_rate = 16000;
+    std::vector<Entry> packets;
+
+    static std::shared_ptr<const OggPacketIndex> Parse(const std::string_view& ogg);
+};
+
+// Decoded PCM of a sound at the codec output rate, kept in PSRAM
+struct SoundPcm {
+    int16_t* data = nullptr;
+    size_t capacity = 0;
+    size_t samples = 0;
+    size_t frame_samples = 0;
+
+    explicit SoundPcm(size_t capacity);
+    ~SoundPcm();
+    SoundPcm(const SoundPcm&) = delete;
+    SoundPcm& operator=(const SoundPcm&) = delete;
+};
+
+struct SoundPcmCacheStatistics {
+    uint32_t hits = 0;
+    uint32_t misses = 0;        // Plays of a cacheable sound that had to be decoded
+    uint32_t sounds = 0;
+    uint32_t bytes = 0;
+};
+
+struct SoundPlayback {
+    std::shared_ptr<const OggPacketIndex> index;
+    const uint8_t* data = nullptr;
+    size_t next_packet = 0;
+    std::shared_ptr<const SoundPcm> pcm;    // Set on a cache hit, then index is not used
+    size_t next_sample = 0;
+    std::unique_ptr<SoundPcm> fill;         // Collects the decoded frames on a cache miss
+    bool fill_failed = false;
+    std::atomic<bool> cancelled{false};
+
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+
+    void SetDone();
+};
+
+// Returned by AudioService::PlaySound(), can be dropped if the caller does not care
+class SoundHandle {
+public:
+    SoundHandle() = default;
+    explicit SoundHandle(std::shared_ptr<SoundPlayback> playback) : playback_(std::move(playback)) {}
+
+    // Stop feeding the sound to the decoder, frames already decoded still play
+    void Cancel();
+    // Wait until the last frame is decoded or the sound is cancelled, -1 waits forever
+    bool Wait(int timeout_ms = -1);
+    bool IsDone() const;
+
+private:
+    std::shared_ptr<SoundPlayback> playback_;
+};
+
+// One step of a sound: either an Opus packet to decode or a cached PCM frame to play as is
+struct SoundFrame {
+    AudioStreamPacket packet;
+    const int16_t* pcm = nullptr;
+    size_t samples = 0;
+};
+
+/*
+ * Plays the sounds one after another without blocking the caller.
+ * Play() is called from any task, Next() and OnDecoded() only from the Opus decode task,
+ * which pulls one frame at a time.
+ *
+ * Sounds up to SOUND_PCM_CACHE_MAX_SOUND_SIZE bytes are decoded normally the first time and the
+ * decoded frames are kept, later plays skip the Opus decoder and the resampler.
+ */
+class SoundPlayer {
+public:
+    SoundHandle Play(const std::string_view& ogg);
+    // Fill the next frame (the packet payload buffer is reused), false if there is nothing to play
+    bool Next(SoundFrame& frame);
+    // Hand back the PCM decoded from the last packet, nullptr if decoding failed
+    void OnDecoded(const std::vector<int16_t>* pcm);
+    void CancelAll();
+    bool Empty();
+    SoundPcmCacheStatistics GetCacheStatistics();
+
+private:
+    std::mutex mutex_;
+    std::deque<std::shared_ptr<SoundPlayback>> playbacks_;
+    // Keyed by the address of the embedded file
+    std::map<const char*, std::shared_ptr<const OggPacketIndex>> index_cache_;
+    std::map<const char*, std::shared_ptr<const SoundPcm>> pcm_cache_;
+    SoundPcmCacheStatistics cache_statistics_;
+    std::shared_ptr<SoundPlayback> decoding_;   // Owner of the packet last returned by Next()
+
+    void FinishPlayback(SoundPlayback& playback);
+};
+
+#endif // SOUND_PLAYER_H
@@ -0,0 +1,102 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * Bounded single-producer / single-consumer ring queue.
+ *
+ * Push() must only be called from one producer task and Pop() from one consumer task.
+ * Size(), Empty(), Full() and Clear() may be called from any task.
+ *
+ * Clear() does not touch the slots: it records the current tail and the consumer
+ * drops everything before it on its next Pop(), so the queue looks empty to
+ * everyone immediately and the items are still destroyed on the consumer side.
+ *
+ * The queue never blocks. Wakeups are left to the owner (AudioService uses event group bits).
+ */
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots_(capacity) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool Push(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+            return false;
+        }
+        slots_[tail % slots_.size()] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        size_t head = DropCleared();
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        auto& slot = slots_[head % slots_.size()];
+        item = std::move(slot);
+        slot = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Clear() {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t until = clear_until_.load(std::memory_order_relaxed);
+        while (static_cast<ptrdiff_t>(tail - until) > 0 &&
+            !clear_until_.compare_exchange_weak(until, tail, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    /* Head and the clear mark are loaded before the tail: they only move up to a tail that was already
+       published, so the later tail is never behind them. The tail may run ahead while they are loaded,
+       hence the clamp */
+    size_t Size() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t until = clear_until_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        if (static_cast<ptrdiff_t>(until - head) > 0) {
+            head = until;
+        }
+        return std::min(tail - head, slots_.size());
+    }
+
+    bool Empty() const { return Size() == 0; }
+    bool Full() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head >= slots_.size();
+    }
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    std::vector<T> slots_;
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    std::atomic<size_t> clear_until_{0};
+
+    // Consumer side only: release the items discarded by Clear()
+    size_t DropCleared() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t until = clear_until_.load(std::memory_order_acquire);
+        if (static_cast<ptrdiff_t>(until - head) <= 0) {
+            return head;
+        }
+        while (head != until) {
+            slots_[head % slots_.size()] = T();
+            head++;
+        }
+        head_.store(head, std::memory_order_release);
+        return head;
+    }
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,62 @@
+#include "uplink_encoder.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "UplinkEncoder"
+
+bool UplinkEncoder::Configure(int sample_rate, int frame_duration) {
+    if (encoder_ && sample_rate == sample_rate_ && frame_duration == frame_duration_) {
+        return true;
+    }
+    sample_rate_ = sample_rate;
+    frame_duration_ = frame_duration;
+    encoder_.reset();
+    int error = OPUS_OK;
+    encoder_.reset(opus_encoder_create(sample_rate, 1, OPUS_APPLICATION_VOIP, &error));
+    if (!encoder_) {
+        ESP_LOGE(TAG, "Failed to create the encoder, error code: %d", error);
+        return false;
+    }
+    /* The settings of the OpusEncoderWrapper it replaces */
+    opus_encoder_ctl(encoder_.get(), OPUS_SET_DTX(1));
+    opus_encoder_ctl(encoder_.get(), OPUS_SET_COMPLEXITY(complexity_));
+    opus_encoder_ctl(encoder_.get(), OPUS_SET_BITRATE(bitrate_ > 0 ? bitrate_ : OPUS_AUTO));
+    return true;
+}
+
+void UplinkEncoder::SetComplexity(int complexity) {
+    complexity_ = complexity;
+    if (encoder_) {
+        opus_encoder_ctl(encoder_.get(), OPUS_SET_COMPLEXITY(complexity_));
+    }
+}
+
+void UplinkEncoder::SetBitrate(int bitrate) {
+    bitrate_ = bitrate;
+    if (encoder_) {
+        opus_encoder_ctl(encoder_.get(), OPUS_SET_BITRATE(bitrate_ > 0 ? bitrate_ : OPUS_AUTO));
+    }
+}
+
+bool UplinkEncoder::Encode(const std::vector<int16_t>& pcm, AudioStreamPacket& packet) {
+    int frame_size = sample_rate_ * frame_duration_ / 1000;
+    if (!encoder_ || (int)pcm.size() != frame_size) {
+        ESP_LOGE(TAG, "Frame of %u samples, the encoder takes %d", (unsigned)pcm.size(), frame_size);
+        return false;
+    }
+
+    /* The whole reserved capacity is offered to the encoder, resizing within it does not allocate */
+    auto& payload = packet.payload;
+    packet.headroom = AUDIO_PACKET_HEADROOM;
+    payload.resize(std::max<size_t>(payload.capacity(), AUDIO_PACKET_HEADROOM + 1));
+    int size = opus_encode(encoder_.get(), pcm.data(), frame_size, payload.data() + AUDIO_PACKET_HEADROOM,
+        payload.size() - AUDIO_PACKET_HEADROOM);
+    if (size < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", size);
+        payload.resize(AUDIO_PACKET_HEADROOM);
+        return false;
+    }
+    payload.resize(AUDIO_PACKET_HEADROOM + size);
+    return true;
+}
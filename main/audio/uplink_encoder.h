@@ -0,0 +1,41 @@
+#ifndef UPLINK_ENCODER_H
+#define UPLINK_ENCODER_H
+
+#include <opus.h>
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+/*
+ * The uplink Opus encoder, a plain libopus one like the decoders of DecoderPool, so a frame is encoded straight
+ * into its packet behind AUDIO_PACKET_HEADROOM bytes and the transport frames it in place. The PCM frame is only
+ * read, its pooled buffer stays with the AudioTask. The complexity and the bitrate come from OpusComplexityController.
+ */
+class UplinkEncoder {
+public:
+    UplinkEncoder() = default;
+
+    UplinkEncoder(const UplinkEncoder&) = delete;
+    UplinkEncoder& operator=(const UplinkEncoder&) = delete;
+
+    // (Re)create the encoder for the frame duration, the complexity and the bitrate are kept
+    bool Configure(int sample_rate, int frame_duration);
+    void SetComplexity(int complexity);
+    // Bits per second, 0 for the bitrate Opus picks for the frame size
+    void SetBitrate(int bitrate);
+    // Encode one frame of pcm into the payload of packet, which must have room for the headroom and the frame
+    bool Encode(const std::vector<int16_t>& pcm, AudioStreamPacket& packet);
+    int frame_duration() const { return frame_duration_; }
+
+private:
+    std::unique_ptr<OpusEncoder, void (*)(OpusEncoder*)> encoder_{nullptr, opus_encoder_destroy};
+    int sample_rate_ = 0;
+    int frame_duration_ = 0;
+    int complexity_ = 0;
+    int bitrate_ = 0;
+};
+
+#endif // UPLINK_ENCODER_H
@@ -0,0 +1,185 @@
+#include "wake_word_preroll.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <opus_encoder.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <cassert>
+
+#define TAG "WakeWordPreroll"
+
+#define PREROLL_EVENT_STORED (1 << 0)
+#define PREROLL_EVENT_ENCODE (1 << 1)
+
+WakeWordPreroll::WakeWordPreroll(int frame_duration_ms, bool incremental)
+    : frame_duration_ms_(frame_duration_ms),
+      frame_samples_(frame_duration_ms * 16000 / 1000),
+      incremental_(incremental) {
+    event_group_ = xEventGroupCreate();
+
+    capacity_ = WAKE_WORD_PREROLL_DURATION_MS * 16000 / 1000;
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the pre-roll buffer");
+        capacity_ = 0;
+    }
+
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_PREROLL_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    assert(encode_task_stack_ != nullptr);
+    encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+    assert(encode_task_buffer_ != nullptr);
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordPreroll*)arg;
+        this_->EncodeTask();
+    }, "encode_wake_word", WAKE_WORD_PREROLL_TASK_STACK_SIZE, this, 2, encode_task_stack_, encode_task_buffer_);
+}
+
+WakeWordPreroll::~WakeWordPreroll() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (encode_task_buffer_ != nullptr) {
+        heap_caps_free(encode_task_buffer_);
+    }
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void WakeWordPreroll::Store(const int16_t* data, size_t samples) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    bool frame_ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (samples > capacity_) {
+            data += samples - capacity_;
+            written_ += samples - capacity_;
+            samples = capacity_;
+        }
+        size_t position = written_ % capacity_;
+        size_t first = std::min(samples, capacity_ - position);
+        memcpy(buffer_ + position, data, first * sizeof(int16_t));
+        memcpy(buffer_, data + first, (samples - first) * sizeof(int16_t));
+        written_ += samples;
+        frame_ready = written_ - encoded_ >= frame_samples_;
+    }
+
+    if (incremental_ && frame_ready) {
+        xEventGroupSetBits(event_group_, PREROLL_EVENT_STORED);
+    }
+}
+
+void WakeWordPreroll::Encode() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        opus_.clear();
+        encode_request_time_ = esp_timer_get_time();
+    }
+    xEventGroupSetBits(event_group_, PREROLL_EVENT_ENCODE);
+}
+
+bool WakeWordPreroll::GetOpus(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    opus_cv_.wait(lock, [this]() {
+        return !opus_.empty();
+    });
+    opus.swap(opus_.front());
+    opus_.pop_front();
+    return !opus.empty();
+}
+
+bool WakeWordPreroll::ReadFrame(std::vector<int16_t>& pcm) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (written_ - encoded_ > capacity_) {
+        // Overwritten before it was encoded
+        encoded_ = written_ - capacity_;
+    }
+    if (written_ - encoded_ < frame_samples_) {
+        return false;
+    }
+
+    pcm.resize(frame_samples_);
+    size_t position = encoded_ % capacity_;
+    size_t first = std::min(frame_samples_, capacity_ - position);
+    memcpy(pcm.data(), buffer_ + position, first * sizeof(int16_t));
+    memcpy(pcm.data() + first, buffer_, (frame_samples_ - first) * sizeof(int16_t));
+    encoded_ += frame_samples_;
+    return true;
+}
+
+void WakeWordPreroll::EncodeTask() {
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration_ms_);
+    encoder->SetComplexity(0); // 0 is the fastest
+    std::vector<int16_t> pcm;
+    std::vector<uint8_t> opus;
+    size_t max_ready_packets = capacity_ / frame_samples_;
+
+    while (true) {
+        auto bits = xEventGroupWaitBits(event_group_, PREROLL_EVENT_STORED | PREROLL_EVENT_ENCODE,
+            pdTRUE, pdFALSE, portMAX_DELAY);
+
+        if (!(bits & PREROLL_EVENT_ENCODE)) {
+            /* Incremental mode, keep the last WAKE_WORD_PREROLL_DURATION_MS encoded */
+            while (ReadFrame(pcm)) {
+                if (encoder->Encode(std::move(pcm), opus)) {
+                    ready_.emplace_back(std::move(opus));
+                    if (ready_.size() > max_ready_packets) {
+                        ready_.pop_front();
+                    }
+                }
+            }
+            continue;
+        }
+
+        int64_t request_time;
+        int64_t first_packet_time = 0;
+        int packets = ready_.size();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            request_time = encode_request_time_;
+            if (!ready_.empty()) {
+                std::move(ready_.begin(), ready_.end(), std::back_inserter(opus_));
+                first_packet_time = esp_timer_get_time();
+                opus_cv_.notify_all();
+            }
+        }
+        ready_.clear();
+
+        while (ReadFrame(pcm)) {
+            if (!encoder->Encode(std::move(pcm), opus)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            opus_.emplace_back(std::move(opus));
+            opus_cv_.notify_all();
+            packets++;
+            if (first_packet_time == 0) {
+                first_packet_time = esp_timer_get_time();
+            }
+        }
+
+        /* The partial frame is dropped, the next wake word starts with a fresh encoder */
+        encoder->ResetState();
+        auto end_time = esp_timer_get_time();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            encoded_ = written_;
+            opus_.push_back(std::vector<uint8_t>());
+            opus_cv_.notify_all();
+        }
+        ESP_LOGI(TAG, "Encode wake word opus %d packets (%s), first packet in %ld ms, all in %ld ms", packets,
+            incremental_ ? "incremental" : "on detection",
+            first_packet_time > 0 ? (long)((first_packet_time - request_time) / 1000) : -1L,
+            (long)((end_time - request_time) / 1000));
+    }
+}
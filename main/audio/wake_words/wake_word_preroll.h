@@ -0,0 +1,70 @@
+#ifndef WAKE_WORD_PREROLL_H
+#define WAKE_WORD_PREROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// Audio kept before the wake word, sent to the server for voice recognition (like who is speaking)
+#define WAKE_WORD_PREROLL_DURATION_MS 2000
+#define WAKE_WORD_PREROLL_TASK_STACK_SIZE (4096 * 7)
+#ifdef CONFIG_WAKE_WORD_PREROLL_INCREMENTAL_ENCODE
+#define WAKE_WORD_PREROLL_INCREMENTAL_ENCODE true
+#else
+#define WAKE_WORD_PREROLL_INCREMENTAL_ENCODE false
+#endif
+
+/*
+ * The audio before a wake word, in one ring buffer in PSRAM, and its Opus encoding.
+ *
+ * Store() is called by the detection task for every chunk. Encode() is called after the wake word is
+ * detected and GetOpus() then returns the packets in order, an empty packet marks the end.
+ *
+ * With incremental encoding the encode task keeps encoding the ring in the background (complexity 0),
+ * so only the last partial frames are left when Encode() is called. Otherwise everything is encoded
+ * after the detection. Both modes log the time from Encode() to the first and the last packet.
+ */
+class WakeWordPreroll {
+public:
+    WakeWordPreroll(int frame_duration_ms, bool incremental);
+    ~WakeWordPreroll();
+
+    WakeWordPreroll(const WakeWordPreroll&) = delete;
+    WakeWordPreroll& operator=(const WakeWordPreroll&) = delete;
+
+    void Store(const int16_t* data, size_t samples);
+    void Encode();
+    bool GetOpus(std::vector<uint8_t>& opus);
+
+private:
+    const int frame_duration_ms_;
+    const size_t frame_samples_;
+    const bool incremental_;
+    int16_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    // Sample positions since the start, the ring holds [written_ - capacity_, written_)
+    uint64_t written_ = 0;
+    uint64_t encoded_ = 0;
+    int64_t encode_request_time_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable opus_cv_;
+    std::deque<std::vector<uint8_t>> opus_;     // Handed to GetOpus()
+    std::deque<std::vector<uint8_t>> ready_;    // Encoded in the background, only used by the encode task
+
+    EventGroupHandle_t event_group_ = nullptr;
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+
+    bool ReadFrame(std::vector<int16_t>& pcm);
+    void EncodeTask();
+};
+
+#endif // WAKE_WORD_PREROLL_H
@@ -11,6 +11,7 @@
 #include "audio_codec.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "message_router.h"
 
 #define TAG "Display"
 
@@ -54,3 +55,50 @@ void Display::SetTheme(Theme* theme) {
 void Display::SetPowerSaveMode(bool on) {
     ESP_LOGW(TAG, "SetPowerSaveMode: %d", on);
 }
+
+void Display::SubscribeMessages(MessageRouter& router) {
+    /* The display is updated on the main task, the handlers run on the network task */
+    router.Subscribe("tts", [this](const cJSON* root) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        if (!cJSON_IsString(state) || strcmp(state->valuestring, "sentence_start") != 0) {
+            return;
+        }
+        auto text = cJSON_GetObjectItem(root, "text");
+        if (cJSON_IsString(text)) {
+            ESP_LOGI(TAG, "<< %s", text->valuestring);
+            Application::GetInstance().Schedule([this, message = std::string(text->valuestring)]() {
+                SetChatMessage("assistant", message.c_str());
+            });
+        }
+    });
+    router.Subscribe("stt", [this](const cJSON* root) {
+        auto text = cJSON_GetObjectItem(root, "text");
+        if (cJSON_IsString(text)) {
+            ESP_LOGI(TAG, ">> %s", text->valuestring);
+            Application::GetInstance().Schedule([this, message = std::string(text->valuestring)]() {
+                SetChatMessage("user", message.c_str());
+            });
+        }
+    });
+    router.Subscribe("llm", [this](const cJSON* root) {
+        auto emotion = cJSON_GetObjectItem(root, "emotion");
+        if (cJSON_IsString(emotion)) {
+            Application::GetInstance().Schedule([this, emotion_str = std::string(emotion->valuestring)]() {
+                SetEmotion(emotion_str.c_str());
+            });
+        }
+    });
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+    router.Subscribe("custom", [this](const cJSON* root) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
+        if (cJSON_IsObject(payload)) {
+            Application::GetInstance().Schedule([this, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
+                SetChatMessage("system", payload_str.c_str());
+            });
+        } else {
+            ESP_LOGW(TAG, "Invalid custom message format: missing payload");
+        }
+    });
+#endif
+}
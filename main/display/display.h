@@ -15,6 +15,8 @@
 #include <string>
 #include <chrono>
 
+class MessageRouter;
+
 class Theme {
 public:
     Theme(const std::string& name) : name_(name) {}
@@ -39,6 +41,8 @@ public:
     virtual Theme* GetTheme() { return current_theme_; }
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
+    // Show the server text, emotions and custom messages
+    void SubscribeMessages(MessageRouter& router);
 
     inline int width() const { return width_; }
     inline int height() const { return height_; }
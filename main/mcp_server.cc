@@ -17,6 +17,7 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#include "message_router.h"
 
 #define TAG "MCP"
 
@@ -135,6 +136,14 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.audio.get_latency",
+        "Get the latency percentiles of each audio pipeline stage (microphone to server, server to speaker) over the last 30 to 60 seconds",
+        PropertyList(),
+        [this](const PropertyList& properties) -> ReturnValue {
+            auto& app = Application::GetInstance();
+            return app.GetAudioService().GetLatencyTracer().GetSummaryJson();
+        });
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -352,6 +361,15 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
     }
 }
 
+void McpServer::SubscribeMessages(MessageRouter& router) {
+    router.Subscribe("mcp", [this](const cJSON* root) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        if (cJSON_IsObject(payload)) {
+            ParseMessage(payload);
+        }
+    });
+}
+
 void McpServer::ParseMessage(const cJSON* json) {
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
@@ -311,6 +311,8 @@ public:
     }
 };
 
+class MessageRouter;
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -325,6 +327,8 @@ public:
     void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    // Take the "mcp" messages of the server
+    void SubscribeMessages(MessageRouter& router);
 
 private:
     McpServer();
@@ -2,6 +2,8 @@
 #include "system_info.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "application.h"
+#include "message_router.h"
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -240,6 +242,23 @@ bool Ota::CheckVersion() {
     return true;
 }
 
+void Ota::SubscribeMessages(MessageRouter& router) {
+    router.Subscribe("system", [](const cJSON* root) {
+        auto command = cJSON_GetObjectItem(root, "command");
+        if (cJSON_IsString(command)) {
+            ESP_LOGI(TAG, "System command: %s", command->valuestring);
+            if (strcmp(command->valuestring, "reboot") == 0) {
+                // Do a reboot if user requests a OTA update
+                Application::GetInstance().Schedule([]() {
+                    Application::GetInstance().Reboot();
+                });
+            } else {
+                ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+            }
+        }
+    });
+}
+
 void Ota::MarkCurrentVersionValid() {
     auto partition = esp_ota_get_running_partition();
     if (strcmp(partition->label, "factory") == 0) {
@@ -7,6 +7,8 @@
 #include <esp_err.h>
 #include "board.h"
 
+class MessageRouter;
+
 class Ota {
 public:
     Ota();
@@ -23,6 +25,8 @@ public:
     bool StartUpgrade(std::function<void(int progress, size_t speed)> callback);
     bool StartUpgradeFromUrl(const std::string& url, std::function<void(int progress, size_t speed)> callback);
     void MarkCurrentVersionValid();
+    // Take the "system" commands of the server, a reboot after an upgrade
+    static void SubscribeMessages(MessageRouter& router);
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
     const std::string& GetCurrentVersion() const { return current_version_; }
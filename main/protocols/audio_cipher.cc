@@ -0,0 +1,31 @@
+#include "audio_cipher.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "AudioCipher"
+
+AudioCipher::AudioCipher() {
+    mbedtls_aes_init(&context_);
+}
+
+AudioCipher::~AudioCipher() {
+    mbedtls_aes_free(&context_);
+}
+
+bool AudioCipher::SetKey(const std::string& key) {
+    if (mbedtls_aes_setkey_enc(&context_, (const unsigned char*)key.data(), key.size() * 8) != 0) {
+        ESP_LOGE(TAG, "Invalid key of %u bytes", (unsigned)key.size());
+        return false;
+    }
+    return true;
+}
+
+bool AudioCipher::Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size) {
+    // The cipher advances the counter block, the nonce in the datagram must stay as sent
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, nonce, sizeof(nonce_counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    return mbedtls_aes_crypt_ctr(&context_, size, &nc_off, nonce_counter, stream_block, input, output) == 0;
+}
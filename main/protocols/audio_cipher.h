@@ -0,0 +1,31 @@
+#ifndef AUDIO_CIPHER_H
+#define AUDIO_CIPHER_H
+
+#include <mbedtls/aes.h>
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * AES-CTR of the MQTT/UDP audio datagrams, with the 16-byte datagram nonce as the initial counter block,
+ * so encryption and decryption are the same. With CONFIG_MBEDTLS_HARDWARE_AES (the default) mbedtls runs it
+ * on the AES peripheral, in DMA mode on the chips that have it, otherwise in software.
+ */
+class AudioCipher {
+public:
+    AudioCipher();
+    ~AudioCipher();
+    AudioCipher(const AudioCipher&) = delete;
+    AudioCipher& operator=(const AudioCipher&) = delete;
+
+    // A key of 16, 24 or 32 bytes
+    bool SetKey(const std::string& key);
+    // The output may be the input buffer, the nonce is not modified
+    bool Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size);
+
+private:
+    mbedtls_aes_context context_;
+};
+
+#endif // AUDIO_CIPHER_H
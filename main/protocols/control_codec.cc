@@ -0,0 +1,535 @@
+#include "control_codec.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_INFO_FALSE 20
+#define CBOR_INFO_TRUE 21
+#define CBOR_INFO_NULL 22
+#define CBOR_INFO_FLOAT16 25
+#define CBOR_INFO_FLOAT32 26
+#define CBOR_INFO_FLOAT64 27
+#define CBOR_INFO_INDEFINITE 31
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+#define CBOR_BREAK 0xFF
+
+// The initial byte and the big-endian argument, in the shortest form
+static void WriteHead(std::string& out, int major, uint64_t argument) {
+    uint8_t head[9];
+    int size;
+    if (argument < 24) {
+        head[0] = (major << 5) | argument;
+        size = 1;
+    } else if (argument <= 0xFF) {
+        head[0] = (major << 5) | 24;
+        size = 2;
+    } else if (argument <= 0xFFFF) {
+        head[0] = (major << 5) | 25;
+        size = 3;
+    } else if (argument <= 0xFFFFFFFF) {
+        head[0] = (major << 5) | 26;
+        size = 5;
+    } else {
+        head[0] = (major << 5) | 27;
+        size = 9;
+    }
+    for (int i = size - 1; i > 0; i--) {
+        head[i] = argument & 0xFF;
+        argument >>= 8;
+    }
+    out.append((const char*)head, size);
+}
+
+static void WriteDouble(std::string& out, double value) {
+    float single = float(value);
+    uint8_t bytes[9];
+    int size;
+    if (double(single) == value) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        bytes[0] = CBOR_FLOAT32;
+        for (int i = 4; i > 0; i--, bits >>= 8) {
+            bytes[i] = bits & 0xFF;
+        }
+        size = 5;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bytes[0] = CBOR_FLOAT64;
+        for (int i = 8; i > 0; i--, bits >>= 8) {
+            bytes[i] = bits & 0xFF;
+        }
+        size = 9;
+    }
+    out.append((const char*)bytes, size);
+}
+
+static void WriteUtf8(std::string& out, uint32_t code) {
+    if (code < 0x80) {
+        out += char(code);
+    } else if (code < 0x800) {
+        out += char(0xC0 | (code >> 6));
+        out += char(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += char(0xE0 | (code >> 12));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    } else {
+        out += char(0xF0 | (code >> 18));
+        out += char(0x80 | ((code >> 12) & 0x3F));
+        out += char(0x80 | ((code >> 6) & 0x3F));
+        out += char(0x80 | (code & 0x3F));
+    }
+}
+
+static bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// JSON text to CBOR in one pass, the output is appended as the text is read
+class JsonTranscoder {
+public:
+    JsonTranscoder(const char* json, std::string& out) : p_(json), out_(out) {}
+
+    bool Run() {
+        if (!Value(0)) {
+            return false;
+        }
+        SkipSpace();
+        return *p_ == '\0';
+    }
+
+private:
+    const char* p_;
+    std::string& out_;
+    std::string scratch_;   // Strings with escapes, unescaped before their length is known
+
+    void SkipSpace() {
+        while (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r') {
+            p_++;
+        }
+    }
+
+    bool Value(int depth) {
+        SkipSpace();
+        switch (*p_) {
+        case '{':
+            return Container(depth, CBOR_MAJOR_MAP, '}');
+        case '[':
+            return Container(depth, CBOR_MAJOR_ARRAY, ']');
+        case '"':
+            return String();
+        case 't':
+            return Literal("true", CBOR_TRUE);
+        case 'f':
+            return Literal("false", CBOR_FALSE);
+        case 'n':
+            return Literal("null", CBOR_NULL);
+        default:
+            return Number();
+        }
+    }
+
+    bool Literal(const char* text, uint8_t value) {
+        size_t length = strlen(text);
+        if (strncmp(p_, text, length) != 0) {
+            return false;
+        }
+        p_ += length;
+        out_ += char(value);
+        return true;
+    }
+
+    bool Container(int depth, int major, char close) {
+        if (depth >= CONTROL_CODEC_MAX_DEPTH) {
+            return false;
+        }
+        p_++;
+        out_ += char((major << 5) | CBOR_INFO_INDEFINITE);
+        SkipSpace();
+        if (*p_ == close) {
+            p_++;
+            out_ += char(CBOR_BREAK);
+            return true;
+        }
+        while (true) {
+            if (major == CBOR_MAJOR_MAP) {
+                SkipSpace();
+                if (*p_ != '"' || !String()) {
+                    return false;
+                }
+                SkipSpace();
+                if (*p_ != ':') {
+                    return false;
+                }
+                p_++;
+            }
+            if (!Value(depth + 1)) {
+                return false;
+            }
+            SkipSpace();
+            if (*p_ == ',') {
+                p_++;
+            } else if (*p_ == close) {
+                p_++;
+                out_ += char(CBOR_BREAK);
+                return true;
+            } else {
+                return false;
+            }
+        }
+    }
+
+    bool Hex4(uint32_t& code) {
+        code = 0;
+        for (int i = 0; i < 4; i++, p_++) {
+            char c = *p_;
+            int digit = IsDigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            code = (code << 4) | digit;
+        }
+        return true;
+    }
+
+    // After "\u", a surrogate pair is one code point
+    bool Unicode() {
+        uint32_t code;
+        if (!Hex4(code) || (code >= 0xDC00 && code <= 0xDFFF)) {
+            return false;
+        }
+        if (code >= 0xD800 && code <= 0xDBFF) {
+            uint32_t low;
+            if (p_[0] != '\\' || p_[1] != 'u') {
+                return false;
+            }
+            p_ += 2;
+            if (!Hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+                return false;
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        WriteUtf8(scratch_, code);
+        return true;
+    }
+
+    bool String() {
+        const char* start = ++p_;
+        const char* end = start;
+        while (*end != '"' && *end != '\\' && *end != '\0') {
+            end++;
+        }
+        /* Most strings have no escapes, they are copied straight from the text */
+        if (*end == '"') {
+            WriteHead(out_, CBOR_MAJOR_TEXT, end - start);
+            out_.append(start, end - start);
+            p_ = end + 1;
+            return true;
+        }
+
+        scratch_.assign(start, end - start);
+        p_ = end;
+        while (*p_ != '"') {
+            if (*p_ == '\0') {
+                return false;
+            }
+            if (*p_ != '\\') {
+                scratch_ += *p_++;
+                continue;
+            }
+            p_++;
+            switch (*p_++) {
+            case '"': scratch_ += '"'; break;
+            case '\\': scratch_ += '\\'; break;
+            case '/': scratch_ += '/'; break;
+            case 'b': scratch_ += '\b'; break;
+            case 'f': scratch_ += '\f'; break;
+            case 'n': scratch_ += '\n'; break;
+            case 'r': scratch_ += '\r'; break;
+            case 't': scratch_ += '\t'; break;
+            case 'u':
+                if (!Unicode()) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+        p_++;
+        WriteHead(out_, CBOR_MAJOR_TEXT, scratch_.size());
+        out_ += scratch_;
+        return true;
+    }
+
+    bool Number() {
+        const char* start = p_;
+        bool negative = *p_ == '-';
+        if (negative) {
+            p_++;
+        }
+        /* JSON numbers have no leading zeros */
+        if (!IsDigit(*p_) || (*p_ == '0' && IsDigit(p_[1]))) {
+            return false;
+        }
+        uint64_t magnitude = 0;
+        bool overflow = false;
+        for (; IsDigit(*p_); p_++) {
+            uint64_t digit = *p_ - '0';
+            if (magnitude > (UINT64_MAX - digit) / 10) {
+                overflow = true;
+            } else {
+                magnitude = magnitude * 10 + digit;
+            }
+        }
+        bool integer = true;
+        if (*p_ == '.') {
+            integer = false;
+            p_++;
+            if (!IsDigit(*p_)) {
+                return false;
+            }
+            while (IsDigit(*p_)) {
+                p_++;
+            }
+        }
+        if (*p_ == 'e' || *p_ == 'E') {
+            integer = false;
+            p_++;
+            if (*p_ == '+' || *p_ == '-') {
+                p_++;
+            }
+            if (!IsDigit(*p_)) {
+                return false;
+            }
+            while (IsDigit(*p_)) {
+                p_++;
+            }
+        }
+
+        /* -0 is a float, CBOR integers have no negative zero */
+        if (integer && !overflow && !(negative && magnitude == 0)) {
+            if (negative) {
+                WriteHead(out_, CBOR_MAJOR_NEGATIVE, magnitude - 1);
+            } else {
+                WriteHead(out_, CBOR_MAJOR_UNSIGNED, magnitude);
+            }
+        } else {
+            WriteDouble(out_, strtod(start, nullptr));
+        }
+        return true;
+    }
+};
+
+// CBOR to a cJSON tree, every length is checked against the data left before it is used
+class CborParser {
+public:
+    CborParser(const uint8_t* data, size_t size) : p_(data), end_(data + size) {}
+
+    cJSON* Run() {
+        cJSON* root = Item(0);
+        if (root != nullptr && p_ != end_) {
+            cJSON_Delete(root);
+            return nullptr;
+        }
+        return root;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    std::string scratch_;   // The last text string, null terminated for cJSON
+
+    bool Head(int& major, int& info, uint64_t& argument) {
+        if (p_ >= end_) {
+            return false;
+        }
+        major = *p_ >> 5;
+        info = *p_ & 0x1F;
+        p_++;
+        argument = 0;
+        if (info < 24) {
+            argument = info;
+            return true;
+        }
+        if (info == CBOR_INFO_INDEFINITE) {
+            return true;
+        }
+        if (info > 27) {
+            return false;
+        }
+        int bytes = 1 << (info - 24);
+        if (end_ - p_ < bytes) {
+            return false;
+        }
+        for (int i = 0; i < bytes; i++) {
+            argument = (argument << 8) | *p_++;
+        }
+        return true;
+    }
+
+    // Consumes the break that ends an indefinite-length item
+    bool AtBreak() {
+        if (p_ < end_ && *p_ == CBOR_BREAK) {
+            p_++;
+            return true;
+        }
+        return false;
+    }
+
+    // A definite or chunked text string into scratch_
+    bool Text(int info, uint64_t length) {
+        if (info != CBOR_INFO_INDEFINITE) {
+            if (length > uint64_t(end_ - p_)) {
+                return false;
+            }
+            scratch_.assign((const char*)p_, length);
+            p_ += length;
+            return true;
+        }
+        scratch_.clear();
+        while (!AtBreak()) {
+            int major, chunk_info;
+            uint64_t chunk;
+            if (!Head(major, chunk_info, chunk) || major != CBOR_MAJOR_TEXT || chunk_info == CBOR_INFO_INDEFINITE ||
+                chunk > uint64_t(end_ - p_)) {
+                return false;
+            }
+            scratch_.append((const char*)p_, chunk);
+            p_ += chunk;
+        }
+        return true;
+    }
+
+    cJSON* Simple(int info, uint64_t argument) {
+        switch (info) {
+        case CBOR_INFO_FALSE:
+            return cJSON_CreateBool(false);
+        case CBOR_INFO_TRUE:
+            return cJSON_CreateBool(true);
+        case CBOR_INFO_NULL:
+            return cJSON_CreateNull();
+        case CBOR_INFO_FLOAT16: {
+            int exponent = (argument >> 10) & 0x1F;
+            int mantissa = argument & 0x3FF;
+            double value;
+            if (exponent == 0) {
+                value = ldexp(mantissa, -24);
+            } else if (exponent != 31) {
+                value = ldexp(mantissa + 1024, exponent - 25);
+            } else {
+                value = mantissa == 0 ? INFINITY : NAN;
+            }
+            return cJSON_CreateNumber(argument & 0x8000 ? -value : value);
+        }
+        case CBOR_INFO_FLOAT32: {
+            uint32_t bits = argument;
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return cJSON_CreateNumber(value);
+        }
+        case CBOR_INFO_FLOAT64: {
+            double value;
+            memcpy(&value, &argument, sizeof(value));
+            return cJSON_CreateNumber(value);
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    cJSON* Container(int depth, int major, int info, uint64_t count) {
+        bool indefinite = info == CBOR_INFO_INDEFINITE;
+        /* Every item takes a byte at least, a count beyond the data is malformed */
+        if (depth >= CONTROL_CODEC_MAX_DEPTH || (!indefinite && count > uint64_t(end_ - p_))) {
+            return nullptr;
+        }
+        cJSON* container = major == CBOR_MAJOR_MAP ? cJSON_CreateObject() : cJSON_CreateArray();
+        for (uint64_t i = 0; indefinite ? !AtBreak() : i < count; i++) {
+            std::string key;
+            if (major == CBOR_MAJOR_MAP) {
+                int key_major, key_info;
+                uint64_t key_argument;
+                if (!Head(key_major, key_info, key_argument) || key_major != CBOR_MAJOR_TEXT ||
+                    !Text(key_info, key_argument)) {
+                    cJSON_Delete(container);
+                    return nullptr;
+                }
+                key = scratch_;
+            }
+            cJSON* item = Item(depth + 1);
+            if (item == nullptr) {
+                cJSON_Delete(container);
+                return nullptr;
+            }
+            if (major == CBOR_MAJOR_MAP) {
+                cJSON_AddItemToObject(container, key.c_str(), item);
+            } else {
+                cJSON_AddItemToArray(container, item);
+            }
+        }
+        return container;
+    }
+
+    cJSON* Item(int depth) {
+        int major, info;
+        uint64_t argument;
+        if (!Head(major, info, argument)) {
+            return nullptr;
+        }
+        /* Only strings, arrays and maps have an indefinite length, a break outside of them is malformed */
+        if (info == CBOR_INFO_INDEFINITE && major != CBOR_MAJOR_TEXT && major != CBOR_MAJOR_ARRAY &&
+            major != CBOR_MAJOR_MAP) {
+            return nullptr;
+        }
+        switch (major) {
+        case CBOR_MAJOR_UNSIGNED:
+            return cJSON_CreateNumber(double(argument));
+        case CBOR_MAJOR_NEGATIVE:
+            return cJSON_CreateNumber(-1.0 - double(argument));
+        case CBOR_MAJOR_TEXT:
+            return Text(info, argument) ? cJSON_CreateString(scratch_.c_str()) : nullptr;
+        case CBOR_MAJOR_ARRAY:
+        case CBOR_MAJOR_MAP:
+            return Container(depth, major, info, argument);
+        case CBOR_MAJOR_TAG:
+            // The tag says how to read the item, the JSON data model has no use for it
+            return depth < CONTROL_CODEC_MAX_DEPTH ? Item(depth + 1) : nullptr;
+        case CBOR_MAJOR_SIMPLE:
+            return Simple(info, argument);
+        default:
+            return nullptr;
+        }
+    }
+};
+
+bool JsonToCbor(const std::string& json, std::string& cbor) {
+    size_t size = cbor.size();
+    JsonTranscoder transcoder(json.c_str(), cbor);
+    if (!transcoder.Run()) {
+        cbor.resize(size);
+        return false;
+    }
+    return true;
+}
+
+cJSON* ParseCbor(const uint8_t* data, size_t size) {
+    CborParser parser(data, size);
+    return parser.Run();
+}
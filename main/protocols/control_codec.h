@@ -0,0 +1,28 @@
+#ifndef CONTROL_CODEC_H
+#define CONTROL_CODEC_H
+
+#include <cJSON.h>
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Deepest nesting of arrays and objects the codec accepts, the MCP tool schemas need less than 10
+#define CONTROL_CODEC_MAX_DEPTH 32
+
+/*
+ * The CBOR (RFC 8949) encoding of the control messages of protocol version 4.
+ *
+ * The device builds its control messages as JSON text, JsonToCbor() transcodes the text in one pass without
+ * building a tree: objects and arrays become indefinite-length maps and arrays so no element count is needed
+ * up front, integers take 1 to 9 bytes, other numbers a float32 when it holds them exactly and a float64
+ * otherwise, strings are unescaped. ParseCbor() builds the same cJSON tree cJSON_Parse() builds from the JSON
+ * text, so the handlers do not see a difference, but it does not scan the text for escapes and numbers.
+ * Byte strings, undefined and simple values have no JSON equivalent and are refused.
+ */
+// Append the CBOR encoding of the JSON text to cbor, false if the text is not valid JSON
+bool JsonToCbor(const std::string& json, std::string& cbor);
+// nullptr if the data is not one well-formed CBOR item of the JSON data model, the caller deletes the tree
+cJSON* ParseCbor(const uint8_t* data, size_t size);
+
+#endif // CONTROL_CODEC_H
@@ -0,0 +1,59 @@
+#include "message_router.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "MessageRouter"
+
+void MessageRouter::Subscribe(const std::string& type, Handler handler) {
+    routes_[type].handlers.push_back(std::move(handler));
+}
+
+bool MessageRouter::Dispatch(const cJSON* root) {
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGW(TAG, "Message without a type");
+        return false;
+    }
+
+    auto it = routes_.find(type->valuestring);
+    if (it == routes_.end()) {
+        ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+        std::lock_guard<std::mutex> lock(mutex_);
+        unknown_count_++;
+        return false;
+    }
+
+    auto& route = it->second;
+    auto start_time = esp_timer_get_time();
+    for (auto& handler : route.handlers) {
+        handler(root);
+    }
+    uint32_t time_us = esp_timer_get_time() - start_time;
+    if (time_us > MESSAGE_ROUTER_SLOW_HANDLER_US) {
+        ESP_LOGW(TAG, "Handling %s took %lu ms", it->first.c_str(), (unsigned long)(time_us / 1000));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    route.statistics.count++;
+    route.statistics.time_sum_us += time_us;
+    if (time_us > route.statistics.time_max_us) {
+        route.statistics.time_max_us = time_us;
+    }
+    return true;
+}
+
+void MessageRouter::PrintStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [type, route] : routes_) {
+        auto& statistics = route.statistics;
+        if (statistics.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: count=%lu time avg=%lluus max=%luus", type.c_str(), (unsigned long)statistics.count,
+            (unsigned long long)(statistics.time_sum_us / statistics.count), (unsigned long)statistics.time_max_us);
+    }
+    if (unknown_count_ > 0) {
+        ESP_LOGI(TAG, "unknown: count=%lu", (unsigned long)unknown_count_);
+    }
+}
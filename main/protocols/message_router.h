@@ -0,0 +1,50 @@
+#ifndef MESSAGE_ROUTER_H
+#define MESSAGE_ROUTER_H
+
+#include <cJSON.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+// Handlers running longer than this block the network task, they are logged
+#define MESSAGE_ROUTER_SLOW_HANDLER_US 20000
+
+struct MessageRouteStatistics {
+    uint32_t count = 0;
+    uint64_t time_sum_us = 0;
+    uint32_t time_max_us = 0;
+};
+
+/*
+ * Dispatches the incoming server JSON messages by their "type" through a hash map.
+ *
+ * Modules subscribe to the types they handle before the protocol starts, a type may have several handlers.
+ * Dispatch() runs on the network task, so the handlers should only parse and Schedule() the real work;
+ * the router counts the messages and times the handlers of every type to find the ones that do not.
+ */
+class MessageRouter {
+public:
+    using Handler = std::function<void(const cJSON* root)>;
+
+    void Subscribe(const std::string& type, Handler handler);
+    // Returns false if the message has no type or nobody subscribed to it
+    bool Dispatch(const cJSON* root);
+
+    void PrintStatistics();
+
+private:
+    struct Route {
+        std::vector<Handler> handlers;
+        MessageRouteStatistics statistics;
+    };
+
+    std::mutex mutex_;      // Guards the statistics, the routes do not change after the protocol starts
+    std::unordered_map<std::string, Route> routes_;
+    uint32_t unknown_count_ = 0;
+};
+
+#endif // MESSAGE_ROUTER_H
@@ -3,10 +3,10 @@
 
 
 #include "protocol.h"
+#include "audio_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -27,7 +27,6 @@ public:
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -40,8 +39,9 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
+    AudioCipher audio_cipher_;
     std::string aes_nonce_;
+    std::string udp_buffer_;    // Encrypted audio datagrams, reused under channel_mutex_
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
@@ -52,6 +52,7 @@ private:
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
+    bool SendAudioMessage(AudioStreamPacket& packet, int frames) override;
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
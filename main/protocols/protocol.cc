@@ -1,9 +1,65 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
 
 #define TAG "Protocol"
 
+static void FillBinaryProtocol2(BinaryProtocol2* bp2, const AudioStreamPacket& packet) {
+    bp2->version = htons(2);
+    bp2->type = 0;
+    bp2->reserved = 0;
+    bp2->timestamp = htonl(packet.timestamp);
+    bp2->payload_size = htonl(packet.size());
+}
+
+static void FillBinaryProtocol3(BinaryProtocol3* bp3, const AudioStreamPacket& packet) {
+    bp3->type = BINARY_PROTOCOL3_TYPE_AUDIO;
+    bp3->reserved = 0;
+    bp3->payload_size = htons(packet.size());
+}
+
+uint8_t* FrameBinaryProtocol2(AudioStreamPacket& packet) {
+    if (packet.headroom < sizeof(BinaryProtocol2)) {
+        return nullptr;
+    }
+    auto bp2 = (BinaryProtocol2*)(packet.data() - sizeof(BinaryProtocol2));
+    FillBinaryProtocol2(bp2, packet);
+    return (uint8_t*)bp2;
+}
+
+uint8_t* FrameBinaryProtocol3(AudioStreamPacket& packet) {
+    if (packet.headroom < sizeof(BinaryProtocol3)) {
+        return nullptr;
+    }
+    auto bp3 = (BinaryProtocol3*)(packet.data() - sizeof(BinaryProtocol3));
+    FillBinaryProtocol3(bp3, packet);
+    return (uint8_t*)bp3;
+}
+
+void SerializeBinaryProtocol2(const AudioStreamPacket& packet, std::string& buffer) {
+    buffer.resize(sizeof(BinaryProtocol2) + packet.size());
+    auto bp2 = (BinaryProtocol2*)buffer.data();
+    FillBinaryProtocol2(bp2, packet);
+    memcpy(bp2->payload, packet.data(), packet.size());
+}
+
+void SerializeBinaryProtocol3(const AudioStreamPacket& packet, std::string& buffer) {
+    buffer.resize(sizeof(BinaryProtocol3) + packet.size());
+    auto bp3 = (BinaryProtocol3*)buffer.data();
+    FillBinaryProtocol3(bp3, packet);
+    memcpy(bp3->payload, packet.data(), packet.size());
+}
+
+Protocol::~Protocol() {
+    if (aggregate_timer_ != nullptr) {
+        esp_timer_stop(aggregate_timer_);
+        esp_timer_delete(aggregate_timer_);
+    }
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
@@ -32,6 +88,10 @@ void Protocol::OnDisconnected(std::function<void()> callback) {
     on_disconnected_ = callback;
 }
 
+void Protocol::OnAudioFlushNeeded(std::function<void()> callback) {
+    on_audio_flush_needed_ = callback;
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -49,6 +109,8 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+    // The wake word audio goes out before the detect message
+    FlushAudio();
     std::string json = "{\"session_id\":\"" + session_id_ + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
     SendText(json);
@@ -64,11 +126,13 @@ void Protocol::SendStartListening(ListeningMode mode) {
     } else {
         message += ",\"mode\":\"manual\"";
     }
+    message += ",\"frame_duration\":" + std::to_string(frame_duration_);
     message += "}";
     SendText(message);
 }
 
 void Protocol::SendStopListening() {
+    FlushAudio();
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
     SendText(message);
 }
@@ -88,3 +152,124 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+void Protocol::SetFrameDuration(int frame_duration) {
+    frame_duration_ = server_uplink_frame_duration_ > 0 ? server_uplink_frame_duration_ : frame_duration;
+}
+
+void Protocol::SetServerUplinkFrameDuration(int frame_duration) {
+    if (frame_duration != 0 && frame_duration != 20 && frame_duration != 40 && frame_duration != 60) {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration from server: %d ms", frame_duration);
+        frame_duration = 0;
+    }
+    server_uplink_frame_duration_ = frame_duration;
+    if (frame_duration > 0) {
+        frame_duration_ = frame_duration;
+    }
+}
+
+void Protocol::SetFramesPerPacket(int frames) {
+    frames_per_packet_ = std::clamp(frames, 1, CONFIG_AUDIO_FRAMES_PER_PACKET);
+    aggregate_.payload.clear();
+    aggregate_.headroom = 0;
+    aggregate_frames_ = 0;
+    if (frames_per_packet_ == 1) {
+        return;
+    }
+    ESP_LOGI(TAG, "Audio frame aggregation: %d frames per packet", frames_per_packet_);
+
+    if (aggregate_timer_ == nullptr) {
+        // The frames stop coming at the end of speech, send what was packed when the delay budget runs out
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                auto protocol = (Protocol*)arg;
+                if (protocol->on_audio_flush_needed_ != nullptr) {
+                    protocol->on_audio_flush_needed_();
+                }
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "audio_aggregate",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_create(&timer_args, &aggregate_timer_);
+    }
+}
+
+bool Protocol::SendAudio(AudioStreamPacket& packet) {
+    if (frames_per_packet_ == 1) {
+        return SendAudioMessage(packet, 1);
+    }
+
+    // The first frame waits (frames - 1) frame durations, at least one frame less than the delay budget
+    int frame_duration = packet.frame_duration > 0 ? packet.frame_duration : frame_duration_;
+    int frames = std::clamp(AUDIO_AGGREGATION_MAX_DELAY_MS / frame_duration, 1, frames_per_packet_);
+    if (aggregate_frames_ == 0) {
+        /* The payload is cleared, not released, so after the first messages packing does not allocate.
+         * The frames are copied once, behind the headroom the transport frames the message in */
+        aggregate_.sample_rate = packet.sample_rate;
+        aggregate_.frame_duration = packet.frame_duration;
+        aggregate_.timestamp = packet.timestamp;
+        aggregate_.origin_time = packet.origin_time;
+        aggregate_.queue_time = packet.queue_time;
+        aggregate_.headroom = AUDIO_PACKET_HEADROOM;
+        aggregate_.payload.resize(AUDIO_PACKET_HEADROOM);
+        aggregate_.payload.reserve(AUDIO_PACKET_HEADROOM + frames * (2 + packet.size()));
+        esp_timer_start_once(aggregate_timer_, AUDIO_AGGREGATION_MAX_DELAY_MS * 1000);
+    }
+
+    auto& payload = aggregate_.payload;
+    size_t size = packet.size();
+    payload.push_back(size >> 8);
+    payload.push_back(size & 0xFF);
+    payload.insert(payload.end(), packet.data(), packet.data() + size);
+    if (++aggregate_frames_ < frames) {
+        return true;
+    }
+    return FlushAudio();
+}
+
+bool Protocol::FlushAudio() {
+    if (aggregate_frames_ == 0) {
+        return true;
+    }
+    esp_timer_stop(aggregate_timer_);
+    int frames = aggregate_frames_;
+    aggregate_frames_ = 0;
+    return SendAudioMessage(aggregate_, frames);
+}
+
+int Protocol::ReceiveAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (frames_per_packet_ == 1) {
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        }
+        return 1;
+    }
+
+    auto& payload = packet->payload;
+    size_t offset = packet->headroom;
+    int frames = 0;
+    while (offset + 2 <= payload.size()) {
+        size_t size = (payload[offset] << 8) | payload[offset + 1];
+        offset += 2;
+        if (offset + size > payload.size()) {
+            ESP_LOGW(TAG, "Audio frame of %u bytes truncated at %u", (unsigned)size, (unsigned)(payload.size() - offset));
+            break;
+        }
+        auto frame = std::make_unique<AudioStreamPacket>();
+        frame->sample_rate = packet->sample_rate;
+        frame->frame_duration = packet->frame_duration;
+        frame->timestamp = packet->timestamp + frames * packet->frame_duration;
+        frame->sequence = packet->has_sequence ? packet->sequence + frames : 0;
+        frame->has_sequence = packet->has_sequence;
+        frame->origin_time = packet->origin_time;
+        frame->payload.assign(payload.begin() + offset, payload.begin() + offset + size);
+        offset += size;
+        frames++;
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(frame));
+        }
+    }
+    return frames;
+}
@@ -2,9 +2,11 @@
 #define PROTOCOL_H
 
 #include <cJSON.h>
+#include <esp_timer.h>
 #include <string>
 #include <functional>
 #include <chrono>
+#include <memory>
 #include <vector>
 
 struct AudioStreamPacket {
@@ -12,8 +14,26 @@ struct AudioStreamPacket {
     int frame_duration = 0;
     uint32_t timestamp = 0;
     std::vector<uint8_t> payload;
+    uint32_t sequence = 0;  // Transport sequence number, valid if has_sequence
+    // esp_timer_get_time() stamps for the latency tracer, 0 if not stamped
+    int64_t origin_time = 0;    // Uplink: read from the microphone, downlink: received from the network or concealed
+    int64_t queue_time = 0;     // Uplink: pushed to the send queue
+    // Bytes at the front of payload kept free for the transport header, the audio data follows them
+    size_t headroom = 0;
+    bool has_sequence = false;  // The transport numbers its packets (MQTT/UDP), 0 is a valid sequence
+    bool decode_fec = false;    // Downlink: payload is the next frame, decode its in-band FEC data for this one
+
+    // The audio data, after the headroom
+    uint8_t* data() { return payload.data() + headroom; }
+    const uint8_t* data() const { return payload.data() + headroom; }
+    size_t size() const { return payload.size() - headroom; }
 };
 
+// Longest the first uplink frame of an aggregated message may wait for the others, also the flush timeout
+#define AUDIO_AGGREGATION_MAX_DELAY_MS 180
+// Headroom of the uplink packets, enough for the largest transport header (BinaryProtocol2, the MQTT nonce)
+#define AUDIO_PACKET_HEADROOM 16
+
 struct BinaryProtocol2 {
     uint16_t version;
     uint16_t type;          // Message type (0: OPUS, 1: JSON)
@@ -23,13 +43,25 @@ struct BinaryProtocol2 {
     uint8_t payload[];      // Payload data
 } __attribute__((packed));
 
+// BinaryProtocol3 message types, protocol version 4 adds the CBOR control messages of control_codec.h
+#define BINARY_PROTOCOL3_TYPE_AUDIO 0
+#define BINARY_PROTOCOL3_TYPE_CONTROL 1
+
 struct BinaryProtocol3 {
-    uint8_t type;
+    uint8_t type;           // BINARY_PROTOCOL3_TYPE_*
     uint8_t reserved;
     uint16_t payload_size;
     uint8_t payload[];
 } __attribute__((packed));
 
+// Write the binary protocol header into the headroom of the packet, right in front of its data, and return the
+// start of the message. nullptr if the headroom is too small for the header
+uint8_t* FrameBinaryProtocol2(AudioStreamPacket& packet);
+uint8_t* FrameBinaryProtocol3(AudioStreamPacket& packet);
+// Copy the packet behind its binary protocol header into buffer, for packets without headroom
+void SerializeBinaryProtocol2(const AudioStreamPacket& packet, std::string& buffer);
+void SerializeBinaryProtocol3(const AudioStreamPacket& packet, std::string& buffer);
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -41,9 +73,14 @@ enum ListeningMode {
     kListeningModeRealtime // 需要 AEC 支持
 };
 
+/*
+ * With frame aggregation (frames_per_packet negotiated in the hello), every audio message carries one or more
+ * Opus frames, each prefixed with its 16-bit big-endian size: |size 2u|opus size|size 2u|opus size|...
+ * The timestamp and the sequence of the message are those of its first frame.
+ */
 class Protocol {
 public:
-    virtual ~Protocol() = default;
+    virtual ~Protocol();
 
     inline int server_sample_rate() const {
         return server_sample_rate_;
@@ -54,6 +91,13 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Requested uplink frame duration, announced in the hello and in every listen start message. Set it before
+    // OpenAudioChannel(): once the server hello answered a duration, that one is used instead
+    void SetFrameDuration(int frame_duration);
+    // Negotiated uplink frame duration, the encoder must follow it
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -62,12 +106,18 @@ public:
     void OnNetworkError(std::function<void(const std::string& message)> callback);
     void OnConnected(std::function<void()> callback);
     void OnDisconnected(std::function<void()> callback);
+    // Packed frames reached the delay budget, called from the timer task: call FlushAudio() from the task sending the audio
+    void OnAudioFlushNeeded(std::function<void()> callback);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Sends the frame, or packs it with the next ones when frame aggregation was negotiated. The packet is only
+    // borrowed, the caller recycles it when this returns; the transport may write its header into the headroom
+    bool SendAudio(AudioStreamPacket& packet);
+    // Sends the frames packed so far
+    bool FlushAudio();
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -82,16 +132,31 @@ protected:
     std::function<void(const std::string& message)> on_network_error_;
     std::function<void()> on_connected_;
     std::function<void()> on_disconnected_;
+    std::function<void()> on_audio_flush_needed_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int frame_duration_ = 60;
+    int server_uplink_frame_duration_ = 0;  // Answered in the server hello, 0 if the server accepts any
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    int frames_per_packet_ = 1;     // Frames per audio message, negotiated in the hello
+    AudioStreamPacket aggregate_;   // Reused for every message with the same headroom, the payload keeps its capacity
+    int aggregate_frames_ = 0;
+    esp_timer_handle_t aggregate_timer_ = nullptr;
 
+    // Send one audio message of the given number of frames, the packet is not kept after the call
+    virtual bool SendAudioMessage(AudioStreamPacket& packet, int frames) = 0;
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    // Apply the frames per packet of the server hello, capped by CONFIG_AUDIO_FRAMES_PER_PACKET
+    void SetFramesPerPacket(int frames);
+    // Apply the uplink frame duration of the server hello, 0 if it did not answer one
+    void SetServerUplinkFrameDuration(int frame_duration);
+    // Pass the frames of a received audio message to on_incoming_audio_, returns the number of frames
+    int ReceiveAudio(std::unique_ptr<AudioStreamPacket> packet);
 };
 
 #endif // PROTOCOL_H
@@ -3,10 +3,12 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "control_codec.h"
 
 #include <cstring>
 #include <cJSON.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -25,35 +27,29 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool WebsocketProtocol::SendAudioMessage(AudioStreamPacket& packet, int frames) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    /* The header is written into the headroom in front of the payload and the message is sent from the packet,
+     * only packets without headroom (the wake word audio) are copied into send_buffer_ */
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        auto message = FrameBinaryProtocol2(packet);
+        if (message != nullptr) {
+            return websocket_->Send(message, sizeof(BinaryProtocol2) + packet.size(), true);
+        }
+        SerializeBinaryProtocol2(packet, send_buffer_);
+        return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+    } else if (version_ == 3 || version_ == 4) {
+        auto message = FrameBinaryProtocol3(packet);
+        if (message != nullptr) {
+            return websocket_->Send(message, sizeof(BinaryProtocol3) + packet.size(), true);
+        }
+        SerializeBinaryProtocol3(packet, send_buffer_);
+        return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        return websocket_->Send(packet.data(), packet.size(), true);
     }
 }
 
@@ -62,6 +58,24 @@ bool WebsocketProtocol::SendText(const std::string& text) {
         return false;
     }
 
+    /* Version 4 sends the control messages as CBOR behind a BinaryProtocol3 header, a message too large for the
+     * 16-bit payload size goes out as JSON text, which the server takes in every version */
+    if (cbor_control_) {
+        std::string message(sizeof(BinaryProtocol3), '\0');
+        if (JsonToCbor(text, message) && message.size() - sizeof(BinaryProtocol3) <= UINT16_MAX) {
+            auto bp3 = (BinaryProtocol3*)message.data();
+            bp3->type = BINARY_PROTOCOL3_TYPE_CONTROL;
+            bp3->payload_size = htons(message.size() - sizeof(BinaryProtocol3));
+            if (!websocket_->Send(message.data(), message.size(), true)) {
+                ESP_LOGE(TAG, "Failed to send control message: %s", text.c_str());
+                SetError(Lang::Strings::SERVER_ERROR);
+                return false;
+            }
+            return true;
+        }
+        ESP_LOGW(TAG, "Sending a control message of %u bytes as JSON text", (unsigned)text.size());
+    }
+
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -89,6 +103,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    // The hello is JSON text in every version, the server hello decides the rest
+    cbor_control_ = false;
 
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
@@ -110,53 +126,56 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+            if (version_ == 2) {
+                BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
+                bp2->version = ntohs(bp2->version);
+                bp2->type = ntohs(bp2->type);
+                bp2->timestamp = ntohl(bp2->timestamp);
+                bp2->payload_size = ntohl(bp2->payload_size);
+                auto payload = (uint8_t*)bp2->payload;
+                ReceiveAudio(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+                    .sample_rate = server_sample_rate_,
+                    .frame_duration = server_frame_duration_,
+                    .timestamp = bp2->timestamp,
+                    .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size),
+                    .origin_time = esp_timer_get_time()
+                }));
+            } else if (version_ == 3 || version_ == 4) {
+                BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
+                bp3->type = bp3->type;
+                bp3->payload_size = ntohs(bp3->payload_size);
+                auto payload = (uint8_t*)bp3->payload;
+                if (version_ == 4 && bp3->type == BINARY_PROTOCOL3_TYPE_CONTROL) {
+                    auto root = sizeof(BinaryProtocol3) + bp3->payload_size <= len ?
+                        ParseCbor(payload, bp3->payload_size) : nullptr;
+                    if (root == nullptr) {
+                        ESP_LOGE(TAG, "Malformed CBOR control message of %u bytes", (unsigned)len);
+                    } else if (!OnControlMessage(root)) {
+                        ESP_LOGE(TAG, "Missing message type in a CBOR control message");
+                    }
+                    cJSON_Delete(root);
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+                    ReceiveAudio(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
+                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size),
+                        .origin_time = esp_timer_get_time()
                     }));
                 }
+            } else {
+                ReceiveAudio(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+                    .sample_rate = server_sample_rate_,
+                    .frame_duration = server_frame_duration_,
+                    .timestamp = 0,
+                    .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len),
+                    .origin_time = esp_timer_get_time()
+                }));
             }
         } else {
             // Parse JSON data
             auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
-            } else {
+            if (!OnControlMessage(root)) {
                 ESP_LOGE(TAG, "Missing message type, data: %s", data);
             }
             cJSON_Delete(root);
@@ -199,6 +218,21 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+bool WebsocketProtocol::OnControlMessage(const cJSON* root) {
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        return false;
+    }
+    if (strcmp(type->valuestring, "hello") == 0) {
+        ParseServerHello(root);
+    } else {
+        if (on_incoming_json_ != nullptr) {
+            on_incoming_json_(root);
+        }
+    }
+    return true;
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     cJSON* root = cJSON_CreateObject();
@@ -215,7 +249,10 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", frame_duration_);
+#if CONFIG_AUDIO_FRAMES_PER_PACKET > 1
+    cJSON_AddNumberToObject(audio_params, "frames_per_packet", CONFIG_AUDIO_FRAMES_PER_PACKET);
+#endif
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -231,12 +268,26 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         return;
     }
 
+    /* A server that speaks version 4 answers it in the hello. Any other answer keeps the control messages in
+     * JSON text, and a lower version frames the audio as that version too */
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (version_ == 4 && cJSON_IsNumber(version)) {
+        if (version->valueint == 4) {
+            cbor_control_ = true;
+        } else if (version->valueint >= 1 && version->valueint < 4) {
+            ESP_LOGW(TAG, "The server speaks protocol version %d, control messages stay JSON", version->valueint);
+            version_ = version->valueint;
+        }
+    }
+
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
         session_id_ = session_id->valuestring;
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    int frames_per_packet = 1;
+    int uplink_frame_duration = 0;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -247,7 +298,17 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        auto frames = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+        if (cJSON_IsNumber(frames)) {
+            frames_per_packet = frames->valueint;
+        }
+        auto uplink_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        if (cJSON_IsNumber(uplink_duration)) {
+            uplink_frame_duration = uplink_duration->valueint;
+        }
     }
+    SetFramesPerPacket(frames_per_packet);
+    SetServerUplinkFrameDuration(uplink_frame_duration);
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
@@ -16,7 +16,6 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -25,8 +24,13 @@ private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    bool cbor_control_ = false; // Control messages in CBOR, the server hello accepted version 4
+    std::string send_buffer_;   // Framed audio packets without headroom, only used by the task sending the audio
 
     void ParseServerHello(const cJSON* root);
+    // The JSON text and the CBOR messages alike, false if the message has no type
+    bool OnControlMessage(const cJSON* root);
+    bool SendAudioMessage(AudioStreamPacket& packet, int frames) override;
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
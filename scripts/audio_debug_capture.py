@@ -0,0 +1,124 @@
+import argparse
+import math
+import os
+import struct
+import wave
+from array import array
+
+
+'''
+  Turn an AudioDebugger capture (see audio_debug_server.py) into WAV files, or compare two captures.
+
+  extract: write one WAV file per stream, lost frames are filled with silence so the streams stay
+           aligned for an editor or an offline AEC / VAD evaluation.
+  compare: compare a stream of two captures sample by sample, like the processor output before and
+           after a change on the same device, or a capture and its replay by the host tool
+           tests/host audio_replay, and report whether they are bit-exact. A replay runs on after the
+           end of its input, so only the samples both captures have are compared.
+'''
+HEADER = struct.Struct('<IBBHIIq')
+MAGIC = 0x44415A58
+STREAMS = ['mic', 'reference', 'processed', 'playback']
+
+
+def read_capture(filename):
+    # Returns {stream name: {'sample_rate': int, 'frames': {sequence: (timestamp_us, array)}}}
+    streams = {}
+    with open(filename, 'rb') as f:
+        data = f.read()
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        magic, version, stream, samples, sequence, sample_rate, timestamp = HEADER.unpack_from(data, offset)
+        if magic != MAGIC:
+            raise ValueError(f"Bad frame magic at offset {offset}")
+        offset += HEADER.size
+        pcm = array('h', data[offset:offset + samples * 2])
+        offset += samples * 2
+        name = STREAMS[stream] if stream < len(STREAMS) else str(stream)
+        entry = streams.setdefault(name, {'sample_rate': sample_rate, 'frames': {}})
+        entry['frames'][sequence] = (timestamp, pcm)
+    return streams
+
+
+def contiguous(entry):
+    # Samples of the stream in sequence order, lost frames become silence of the previous frame size
+    frames = entry['frames']
+    pcm = array('h')
+    lost = 0
+    frame_size = 0
+    for sequence in range(min(frames), max(frames) + 1):
+        if sequence in frames:
+            frame_size = len(frames[sequence][1])
+            pcm.extend(frames[sequence][1])
+        else:
+            lost += 1
+            pcm.extend(array('h', bytes(frame_size * 2)))
+    return pcm, lost
+
+
+def write_wav(filename, pcm, sample_rate, channels=1):
+    with wave.open(filename, 'wb') as wav_file:
+        wav_file.setnchannels(channels)
+        wav_file.setsampwidth(2)
+        wav_file.setframerate(sample_rate)
+        wav_file.writeframes(pcm.tobytes())
+
+
+def extract(capture, output_dir):
+    streams = read_capture(capture)
+    os.makedirs(output_dir, exist_ok=True)
+    for name, entry in streams.items():
+        pcm, lost = contiguous(entry)
+        write_wav(os.path.join(output_dir, f"{name}.wav"), pcm, entry['sample_rate'])
+        print(f"{name}: {len(entry['frames'])} frames, {lost} lost, {len(pcm)} samples at {entry['sample_rate']} Hz")
+
+
+def compare(capture_a, capture_b, stream):
+    a = read_capture(capture_a).get(stream)
+    b = read_capture(capture_b).get(stream)
+    if a is None or b is None:
+        print(f"Stream '{stream}' is missing")
+        return False
+    pcm_a, lost_a = contiguous(a)
+    pcm_b, lost_b = contiguous(b)
+    length = min(len(pcm_a), len(pcm_b))
+    signal = 0
+    error = 0
+    max_diff = 0
+    first_mismatch = None
+    for i in range(length):
+        diff = pcm_a[i] - pcm_b[i]
+        if diff != 0 and first_mismatch is None:
+            first_mismatch = i
+        max_diff = max(max_diff, abs(diff))
+        signal += pcm_a[i] * pcm_a[i]
+        error += diff * diff
+    exact = first_mismatch is None and length > 0
+    print(f"{stream}: {len(pcm_a)} vs {len(pcm_b)} samples, lost {lost_a} / {lost_b} frames")
+    if exact:
+        print(f"Bit-exact over the first {length} samples")
+    else:
+        snr = 10 * math.log10(signal / error) if error > 0 and signal > 0 else float('inf')
+        print(f"First mismatch at sample {first_mismatch}, max diff {max_diff}, SNR {snr:.1f} dB")
+    return exact
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='音频调试抓包转换和比较工具')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    parser_extract = subparsers.add_parser('extract', help='导出每路音频的 WAV 文件')
+    parser_extract.add_argument('capture', help='抓包文件')
+    parser_extract.add_argument('--output', '-o', default='capture', help='输出目录 (默认: capture)')
+
+    parser_compare = subparsers.add_parser('compare', help='逐帧比较两个抓包的同一路音频')
+    parser_compare.add_argument('capture_a', help='抓包文件 A')
+    parser_compare.add_argument('capture_b', help='抓包文件 B')
+    parser_compare.add_argument('--stream', '-s', default='processed', choices=STREAMS,
+                                help='比较的音频流 (默认: processed)')
+
+    args = parser.parse_args()
+    if args.command == 'extract':
+        extract(args.capture, args.output)
+    else:
+        exit(0 if compare(args.capture_a, args.capture_b, args.stream) else 1)
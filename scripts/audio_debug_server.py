@@ -1,54 +1,69 @@
 import socket
-import wave
 import argparse
+import struct
 
 
 '''
   Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Receive the framed AudioDebugger datagrams and append them to a capture file.
+  The capture can be turned into WAV files or compared with audio_debug_capture.py.
+
+  Frame header (little-endian, 24 bytes), followed by the 16-bit samples:
+    uint32 magic "XZAD", uint8 version, uint8 stream, uint16 samples,
+    uint32 sequence, uint32 sample_rate, int64 timestamp_us
 '''
-def main(samplerate, channels):
+HEADER = struct.Struct('<IBBHIIq')
+MAGIC = 0x44415A58
+STREAMS = ['mic', 'reference', 'processed', 'playback']
+
+
+def main(port, filename):
     # Create a UDP socket
     server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
-
-    # Create WAV file with parameters
-    filename = f"{samplerate}_{channels}.wav"
-    wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
-
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
-
-    try:
-        while True:
-            # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
-
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
-    
-    except KeyboardInterrupt:
-        print("\nStopping recording...")
-    
-    finally:
-        # Close files and socket
-        wav_file.close()
-        server_socket.close()
-        print(f"WAV file '{filename}' saved successfully")
+    server_socket.bind(('0.0.0.0', port))
+
+    print(f"Start saving audio from 0.0.0.0:{port} to {filename}...")
+
+    next_sequence = {}
+    frames = {}
+    lost = {}
+    with open(filename, 'wb') as capture:
+        try:
+            while True:
+                # Receive a frame from the client
+                message, address = server_socket.recvfrom(65536)
+                if len(message) < HEADER.size:
+                    continue
+                magic, version, stream, samples, sequence, sample_rate, timestamp = HEADER.unpack_from(message)
+                if magic != MAGIC or len(message) != HEADER.size + samples * 2:
+                    print(f"Dropping an invalid datagram of {len(message)} bytes from {address}")
+                    continue
+
+                capture.write(message)
+                name = STREAMS[stream] if stream < len(STREAMS) else str(stream)
+                if stream in next_sequence and sequence != next_sequence[stream]:
+                    gap = (sequence - next_sequence[stream]) & 0xFFFFFFFF
+                    lost[name] = lost.get(name, 0) + gap
+                    print(f"{name}: {gap} frames lost before #{sequence}")
+                next_sequence[stream] = (sequence + 1) & 0xFFFFFFFF
+                frames[name] = frames.get(name, 0) + 1
+
+        except KeyboardInterrupt:
+            print("\nStopping recording...")
+
+        finally:
+            server_socket.close()
+            for name, count in frames.items():
+                print(f"{name}: {count} frames, {lost.get(name, 0)} lost")
+            print(f"Capture '{filename}' saved successfully")
 
 
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser = argparse.ArgumentParser(description='UDP音频调试数据接收器，保存为带帧头的抓包文件')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='监听端口 (默认: 8000)')
+    parser.add_argument('--output', '-o', default='capture.xzad',
+                        help='抓包文件 (默认: capture.xzad)')
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.port, args.output)
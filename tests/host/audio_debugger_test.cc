@@ -0,0 +1,174 @@
+// AudioDebugger capture format: the datagrams received on loopback must decode with the layout of
+// scripts/audio_debug_server.py ('<IBBHIIq' and the samples), and a full ring, in PSRAM or the internal
+// fallback, drops whole frames and leaves a sequence gap instead of blocking the capturing task.
+#include "host_test.h"
+#include "audio_debugger.h"
+
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include <cstring>
+#include <memory>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// CONFIG_AUDIO_DEBUG_UDP_SERVER of this test
+static const int kPort = 39911;
+
+struct ReceivedFrame {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t stream;
+    uint16_t samples;
+    uint32_t sequence;
+    uint32_t sample_rate;
+    int64_t timestamp_us;
+    std::vector<int16_t> pcm;
+};
+
+// Little-endian fields at the offsets of the Python struct, independent of the C++ header struct
+template <typename T>
+static T Read(const uint8_t* data, size_t offset) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value |= T(uint64_t(data[offset + i]) << (8 * i));
+    }
+    return value;
+}
+
+static bool Receive(int sockfd, ReceivedFrame& frame) {
+    uint8_t datagram[4096];
+    ssize_t size = recv(sockfd, datagram, sizeof(datagram), 0);
+    if (size < 0) {
+        return false;
+    }
+    CHECK(size >= 24);
+    frame.magic = Read<uint32_t>(datagram, 0);
+    frame.version = datagram[4];
+    frame.stream = datagram[5];
+    frame.samples = Read<uint16_t>(datagram, 6);
+    frame.sequence = Read<uint32_t>(datagram, 8);
+    frame.sample_rate = Read<uint32_t>(datagram, 12);
+    frame.timestamp_us = int64_t(Read<uint64_t>(datagram, 16));
+    CHECK(size == 24 + frame.samples * 2);
+    frame.pcm.resize(frame.samples);
+    for (size_t i = 0; i < frame.samples; i++) {
+        frame.pcm[i] = int16_t(Read<uint16_t>(datagram, 24 + i * 2));
+    }
+    CHECK(memcmp(datagram, "XZAD", 4) == 0);
+    return true;
+}
+
+static int OpenReceiver() {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sockfd >= 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(sockfd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    int buffer_size = 1 << 20;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    timeval timeout = {0, 500000};
+    CHECK(setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    return sockfd;
+}
+
+static void TestFormat(int sockfd) {
+    auto debugger = std::make_unique<AudioDebugger>();
+
+    std::vector<int16_t> mic(320);
+    std::vector<int16_t> stereo(320 * 2);
+    for (size_t i = 0; i < mic.size(); i++) {
+        mic[i] = int16_t(i * 97 - 16000);
+        stereo[i * 2] = int16_t(i);
+        stereo[i * 2 + 1] = int16_t(-int(i) * 3);
+    }
+
+    int64_t first_time = esp_timer_get_time();
+    debugger->Capture(kAudioDebugStreamMic, mic.data(), mic.size(), 1, 0, 16000);
+    debugger->Capture(kAudioDebugStreamReference, stereo.data(), 320, 2, 1, 16000);
+    HostAdvanceTime(20000);
+    debugger->Capture(kAudioDebugStreamMic, mic.data(), mic.size(), 1, 0, 16000);
+    debugger->Capture(kAudioDebugStreamPlayback, stereo.data(), 320, 2, 0, 24000);
+
+    ReceivedFrame frame;
+    CHECK(Receive(sockfd, frame));
+    CHECK(frame.magic == AUDIO_DEBUGGER_FRAME_MAGIC);
+    CHECK(frame.version == AUDIO_DEBUGGER_FRAME_VERSION);
+    CHECK(frame.stream == kAudioDebugStreamMic);
+    CHECK(frame.sequence == 0);
+    CHECK(frame.sample_rate == 16000);
+    CHECK(frame.timestamp_us == first_time);
+    CHECK(frame.pcm == mic);
+
+    CHECK(Receive(sockfd, frame));
+    CHECK(frame.stream == kAudioDebugStreamReference);
+    CHECK(frame.sequence == 0);
+    CHECK(frame.samples == 320);
+    for (size_t i = 0; i < 320; i++) {
+        CHECK(frame.pcm[i] == stereo[i * 2 + 1]);
+    }
+
+    CHECK(Receive(sockfd, frame));
+    CHECK(frame.stream == kAudioDebugStreamMic);
+    CHECK(frame.sequence == 1);
+    CHECK(frame.timestamp_us == first_time + 20000);
+
+    CHECK(Receive(sockfd, frame));
+    CHECK(frame.stream == kAudioDebugStreamPlayback);
+    CHECK(frame.sample_rate == 24000);
+    for (size_t i = 0; i < 320; i++) {
+        CHECK(frame.pcm[i] == stereo[i * 2]);
+    }
+    CHECK(!Receive(sockfd, frame));
+}
+
+// The sender task is held back until the ring is full, the frames that did not fit must leave a gap
+static void TestFullRing(int sockfd, bool without_spiram) {
+    host_heap_without_spiram = without_spiram;
+    host_tasks_paused = true;
+    auto debugger = std::make_unique<AudioDebugger>();
+
+    const size_t frame_samples = 960;
+    const uint32_t captures = 100;
+    std::vector<int16_t> pcm(frame_samples, 7);
+    for (uint32_t i = 0; i < captures; i++) {
+        debugger->Capture(kAudioDebugStreamProcessed, pcm.data(), pcm.size(), 1, 0, 16000);
+    }
+    HostResumeTasks();
+
+    size_t ring_size = without_spiram ? AUDIO_DEBUGGER_INTERNAL_RING_SIZE : AUDIO_DEBUGGER_RING_SIZE;
+    uint32_t fitting = ring_size / (8 + sizeof(AudioDebugFrameHeader) + frame_samples * 2);
+    ReceivedFrame frame;
+    for (uint32_t i = 0; i < fitting; i++) {
+        CHECK(Receive(sockfd, frame));
+        CHECK(frame.sequence == i);
+        CHECK(frame.pcm == pcm);
+    }
+    CHECK(!Receive(sockfd, frame));
+
+    // Drained, the next frame fits again
+    debugger->Capture(kAudioDebugStreamProcessed, pcm.data(), pcm.size(), 1, 0, 16000);
+    CHECK(Receive(sockfd, frame));
+    CHECK(frame.sequence == captures);
+    CHECK(!Receive(sockfd, frame));
+    printf("%s ring: %u of %u frames kept while the sender was stalled\n", without_spiram ? "internal" : "PSRAM",
+        (unsigned)fitting, (unsigned)captures);
+
+    debugger.reset();
+    host_heap_without_spiram = false;
+}
+
+int main() {
+    static_assert(sizeof(AudioDebugFrameHeader) == 24, "Must match the '<IBBHIIq' header of the scripts");
+    int sockfd = OpenReceiver();
+    TestFormat(sockfd);
+    TestFullRing(sockfd, false);
+    TestFullRing(sockfd, true);
+    close(sockfd);
+    printf("audio_debugger_test passed\n");
+    return 0;
+}
@@ -0,0 +1,246 @@
+// AudioService end to end: FileAudioCodec reads a WAV file as the microphone and writes the speaker to a WAV file,
+// every task runs on a thread, and the uplink frames come back as downlink audio like a server echo. The benchmark
+// reports the frames per second, the latency of every stage and the heap allocations per frame of the service
+// tasks, paced like the I2S clock and unpaced.
+#include "host_test.h"
+#include "audio_service.h"
+#include "file_audio_codec.h"
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#define INPUT_PATH "/tmp/xiaozhi_pipeline_input.wav"
+#define OUTPUT_PATH "/tmp/xiaozhi_pipeline_output.wav"
+#define OUTPUT_SAMPLE_RATE 24000
+#define INPUT_AMPLITUDE 8000
+
+// Allocations of the service tasks, the test threads (main and the echo) turn the counting off for themselves
+static std::atomic<uint64_t> heap_allocations{0};
+static thread_local bool count_allocations = true;
+
+void* operator new(size_t size) {
+    if (count_allocations) {
+        heap_allocations++;
+    }
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static void WriteLe(FILE* file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc(int(value >> (8 * i)) & 0xFF, file);
+    }
+}
+
+// 16 kHz mono 16-bit WAV of a 300 Hz tone, low enough for the 8-sample means of the toy codec
+static void WriteInput(int seconds) {
+    const int sample_rate = 16000;
+    uint32_t data_size = seconds * sample_rate * sizeof(int16_t);
+    FILE* file = fopen(INPUT_PATH, "wb");
+    CHECK(file != nullptr);
+    fwrite("RIFF", 1, 4, file);
+    WriteLe(file, 36 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    WriteLe(file, 16, 4);
+    WriteLe(file, 1, 2);
+    WriteLe(file, 1, 2);
+    WriteLe(file, sample_rate, 4);
+    WriteLe(file, sample_rate * sizeof(int16_t), 4);
+    WriteLe(file, sizeof(int16_t), 2);
+    WriteLe(file, 16, 2);
+    fwrite("data", 1, 4, file);
+    WriteLe(file, data_size, 4);
+    for (int i = 0; i < seconds * sample_rate; i++) {
+        WriteLe(file, uint16_t(int16_t(INPUT_AMPLITUDE * sin(2 * M_PI * 300 * i / sample_rate))), 2);
+    }
+    fclose(file);
+}
+
+// RMS of the samples of the output file after the first `skip_seconds`
+static double OutputRms(double skip_seconds) {
+    FILE* file = fopen(OUTPUT_PATH, "rb");
+    CHECK(file != nullptr);
+    uint8_t header[44];
+    CHECK(fread(header, 1, sizeof(header), file) == sizeof(header));
+    CHECK(memcmp(header, "RIFF", 4) == 0 && memcmp(header + 36, "data", 4) == 0);
+    CHECK((header[24] | (header[25] << 8) | (header[26] << 16)) == OUTPUT_SAMPLE_RATE);
+    fseek(file, long(skip_seconds * OUTPUT_SAMPLE_RATE) * sizeof(int16_t), SEEK_CUR);
+    int16_t sample;
+    double sum = 0;
+    size_t count = 0;
+    while (fread(&sample, sizeof(sample), 1, file) == 1) {
+        sum += double(sample) * sample;
+        count++;
+    }
+    fclose(file);
+    return count > 0 ? sqrt(sum / count) : 0;
+}
+
+struct PipelineResult {
+    double uplink_fps;
+    double playback_fps;
+    double allocations_per_frame;
+};
+
+/*
+ * Streams `frames` uplink frames and plays them back. speed is the FileAudioCodec pace, 0 runs as fast as the
+ * tasks go. Paced, the echo goes through the jitter buffer like the server audio; unpaced, the jitter buffer
+ * would drop what is ahead of its playout time, so it goes through the decode queue, which waits for the decoder.
+ */
+static PipelineResult RunPipeline(const char* name, float speed, int frames) {
+    const int frame_duration = OPUS_FRAME_DURATION_MS;
+    const uint64_t frame_samples = frame_duration * OUTPUT_SAMPLE_RATE / 1000;
+    // The first frames wait for the warm up of the input and fill the pools, they are not counted
+    const int warmup_frames = 10;
+
+    auto codec = std::make_unique<FileAudioCodec>(INPUT_PATH, OUTPUT_PATH, OUTPUT_SAMPLE_RATE, speed);
+    AudioService service;
+    service.Initialize(codec.get());
+
+    std::mutex mutex;
+    std::condition_variable send_queue_available;
+    AudioServiceCallbacks callbacks;
+    callbacks.on_send_queue_available = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        send_queue_available.notify_one();
+    };
+    service.SetCallbacks(callbacks);
+    service.Start();
+    service.EnableVoiceProcessing(true);
+
+    std::atomic<int> sent{0};
+    std::atomic<bool> echo_done{false};
+    std::atomic<uint64_t> measure_allocations{0};
+    std::atomic<int64_t> measure_start{0};
+    std::atomic<int64_t> last_sent_time{0};
+    std::thread echo([&]() {
+        count_allocations = false;
+        auto& tracer = service.GetLatencyTracer();
+        uint32_t sequence = 0;
+        while (!echo_done) {
+            auto packet = service.PopPacketFromSendQueue();
+            if (!packet) {
+                std::unique_lock<std::mutex> lock(mutex);
+                send_queue_available.wait_for(lock, std::chrono::milliseconds(5));
+                continue;
+            }
+            if (sent >= frames) {
+                continue;
+            }
+            // Protocol::SendAudio() borrows the packet, the server answers with a packet of its own
+            auto echoed = std::make_unique<AudioStreamPacket>();
+            echoed->sample_rate = packet->sample_rate;
+            echoed->frame_duration = packet->frame_duration;
+            echoed->timestamp = packet->timestamp;
+            echoed->sequence = sequence++;
+            echoed->has_sequence = true;
+            echoed->payload.assign(packet->data(), packet->data() + packet->size());
+            int64_t now = esp_timer_get_time();
+            echoed->origin_time = now;
+            tracer.Record(kLatencyStageUplinkTotal, packet->origin_time, now);
+            packet.reset();
+
+            if (speed > 0) {
+                CHECK(service.PushPacketToJitterBuffer(std::move(echoed)));
+            } else {
+                CHECK(service.PushPacketToDecodeQueue(std::move(echoed), true));
+            }
+            if (++sent == warmup_frames) {
+                measure_allocations = heap_allocations.load();
+                measure_start = HostNowNs();
+            } else if (sent == frames) {
+                last_sent_time = HostNowNs();
+            }
+        }
+    });
+
+    // Until every frame was sent and played, or a timeout far beyond the slowest pace
+    int64_t deadline = HostNowNs() + int64_t(frames) * frame_duration * 1000000 * 2 + 10000000000LL;
+    while ((sent < frames || codec->output_samples() < frames * frame_samples) && HostNowNs() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    int64_t elapsed_ns = HostNowNs() - measure_start;
+    uint64_t allocations = heap_allocations - measure_allocations;
+    uint64_t output_samples = codec->output_samples();
+    auto encode_statistics = service.GetEncodeTaskStatistics();
+    auto jitter_statistics = service.GetJitterBufferStatistics();
+    CHECK(sent == frames);
+    CHECK(output_samples >= frames * frame_samples);
+
+    auto& tracer = service.GetLatencyTracer();
+    printf("%s: %d frames of %d ms\n", name, frames, frame_duration);
+    printf("  %-26s %8s %8s %8s %8s %8s\n", "stage", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = LatencyStage(i);
+        auto summary = tracer.GetSummary(stage);
+        if (summary.count == 0) {
+            continue;
+        }
+        printf("  %-26s %8lu %8.1f %8.1f %8.1f %8.1f\n", LatencyTracer::GetStageName(stage),
+            (unsigned long)summary.count, summary.p50_us / 1000.0, summary.p90_us / 1000.0,
+            summary.p99_us / 1000.0, summary.max_us / 1000.0);
+    }
+    // The frames after the warm up, until the last one was sent, and until it was played
+    double measured_frames = frames - warmup_frames;
+    PipelineResult result = {
+        measured_frames * 1e9 / (last_sent_time - measure_start),
+        (double(output_samples) / frame_samples - warmup_frames) * 1e9 / elapsed_ns,
+        allocations / measured_frames,
+    };
+    auto send_pool = service.GetSendPacketPoolStatistics();
+    printf("  %.1f uplink frames/s, %.1f played frames/s (%.1fx real time), %.2f allocations per frame\n",
+        result.uplink_fps, result.playback_fps, result.uplink_fps * frame_duration / 1000,
+        result.allocations_per_frame);
+    printf("  encoded %lu, send pool %lu acquired %lu missed, jitter buffer received %lu concealed %lu\n",
+        (unsigned long)encode_statistics.frames, (unsigned long)send_pool.acquire_count,
+        (unsigned long)(send_pool.packet_misses + send_pool.buffer_misses),
+        (unsigned long)jitter_statistics.received, (unsigned long)jitter_statistics.concealed);
+
+    echo_done = true;
+    echo.join();
+    service.EnableVoiceProcessing(false);
+    service.Stop();
+    HostWaitTasks();
+    // Closing the codec writes the sizes into the WAV header
+    codec.reset();
+
+    // The echo plays the tone again, with the error of the toy codec; the start may be the warm up silence
+    double rms = OutputRms(1.0);
+    double input_rms = INPUT_AMPLITUDE / sqrt(2.0);
+    printf("  output RMS %.0f, input RMS %.0f\n", rms, input_rms);
+    CHECK(rms > input_rms * 0.5 && rms < input_rms * 1.5);
+    return result;
+}
+
+int main() {
+    count_allocations = false;
+    host_time_realtime = true;
+    WriteInput(10);
+
+    auto paced = RunPipeline("paced x4", 4.0f, 60);
+    auto unpaced = RunPipeline("unpaced", 0, 200);
+    // Paced, the tasks keep up with the clock; unpaced, they go faster than it
+    CHECK(paced.uplink_fps > 0.8 * 4 * 1000 / OPUS_FRAME_DURATION_MS);
+    CHECK(unpaced.uplink_fps > paced.uplink_fps);
+    // The pools and the scratch buffers cover the steady state, the frames do not allocate. Unpaced, the encoder
+    // outruns the playback the echo waits for, and the send queue backlog borrows heap packets by design
+    CHECK(paced.allocations_per_frame < 1);
+    printf("audio_pipeline_test passed\n");
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include "audio_replay.h"
+#include "audio_service.h"
+#include "file_audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define TAG "AudioReplay"
+
+// Every stream is quiet this long after the service stopped when the sender has drained the capture ring
+#define REPLAY_DRAIN_MS 300
+#define REPLAY_TIMEOUT_MS 600000
+
+static uint32_t ReadLe(const uint8_t* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= uint32_t(p[i]) << (8 * i);
+    }
+    return value;
+}
+
+static void WriteLe(FILE* file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc(int(value >> (8 * i)) & 0xFF, file);
+    }
+}
+
+std::vector<int16_t> CaptureStream::Contiguous(size_t* lost) const {
+    std::vector<int16_t> pcm;
+    size_t lost_frames = 0;
+    if (!frames.empty()) {
+        size_t frame_size = 0;
+        for (uint32_t sequence = frames.begin()->first; sequence <= frames.rbegin()->first; sequence++) {
+            auto it = frames.find(sequence);
+            if (it != frames.end()) {
+                frame_size = it->second.size();
+                pcm.insert(pcm.end(), it->second.begin(), it->second.end());
+            } else {
+                lost_frames++;
+                pcm.resize(pcm.size() + frame_size);
+            }
+        }
+    }
+    if (lost != nullptr) {
+        *lost = lost_frames;
+    }
+    return pcm;
+}
+
+// One datagram of the capture format, false if it is not one
+static bool ParseDatagram(const uint8_t* data, size_t size, Capture& capture) {
+    if (size < sizeof(AudioDebugFrameHeader) || ReadLe(data, 4) != AUDIO_DEBUGGER_FRAME_MAGIC) {
+        return false;
+    }
+    size_t samples = ReadLe(data + 6, 2);
+    if (size != sizeof(AudioDebugFrameHeader) + samples * sizeof(int16_t)) {
+        return false;
+    }
+    auto& stream = capture[data[5]];
+    stream.sample_rate = ReadLe(data + 12, 4);
+    auto& pcm = stream.frames[ReadLe(data + 8, 4)];
+    pcm.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = int16_t(ReadLe(data + sizeof(AudioDebugFrameHeader) + i * 2, 2));
+    }
+    return true;
+}
+
+bool ReadCapture(const std::string& path, Capture& capture) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+    fclose(file);
+
+    /* The datagrams one after the other, the header gives the size of each */
+    size_t offset = 0;
+    while (offset + sizeof(AudioDebugFrameHeader) <= data.size()) {
+        size_t size = sizeof(AudioDebugFrameHeader) + ReadLe(data.data() + offset + 6, 2) * sizeof(int16_t);
+        if (offset + size > data.size() || !ParseDatagram(data.data() + offset, size, capture)) {
+            ESP_LOGE(TAG, "Bad frame at offset %zu of %s", offset, path.c_str());
+            return false;
+        }
+        offset += size;
+    }
+    return offset == data.size();
+}
+
+bool WriteCapture(const std::string& path, const std::vector<std::vector<uint8_t>>& datagrams) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+        return false;
+    }
+    for (auto& datagram : datagrams) {
+        fwrite(datagram.data(), 1, datagram.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+// The microphone and the reference interleaved, like the two input channels of a board with a reference
+static bool WriteReplayInput(const std::string& path, const std::vector<int16_t>& mic,
+    const std::vector<int16_t>& reference, uint32_t sample_rate) {
+    int channels = reference.empty() ? 1 : 2;
+    uint32_t data_size = mic.size() * channels * sizeof(int16_t);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+        return false;
+    }
+    fwrite("RIFF", 1, 4, file);
+    WriteLe(file, 36 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    WriteLe(file, 16, 4);
+    WriteLe(file, 1, 2);
+    WriteLe(file, channels, 2);
+    WriteLe(file, sample_rate, 4);
+    WriteLe(file, sample_rate * channels * sizeof(int16_t), 4);
+    WriteLe(file, channels * sizeof(int16_t), 2);
+    WriteLe(file, 16, 2);
+    fwrite("data", 1, 4, file);
+    WriteLe(file, data_size, 4);
+    for (size_t i = 0; i < mic.size(); i++) {
+        WriteLe(file, uint16_t(mic[i]), 2);
+        if (channels == 2) {
+            WriteLe(file, uint16_t(i < reference.size() ? reference[i] : 0), 2);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+// Receives the datagrams of the host AudioDebugger on the CONFIG_AUDIO_DEBUG_UDP_SERVER port
+class CaptureReceiver {
+public:
+    bool Open() {
+        const char* server = CONFIG_AUDIO_DEBUG_UDP_SERVER;
+        const char* colon = strchr(server, ':');
+        sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd_ < 0 || colon == nullptr) {
+            return false;
+        }
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(colon + 1));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int buffer_size = 4 << 20;
+        setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        timeval timeout = {0, 50000};
+        setsockopt(sockfd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (bind(sockfd_, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ESP_LOGE(TAG, "Failed to bind %s", server);
+            return false;
+        }
+        thread_ = std::thread([this]() { Run(); });
+        return true;
+    }
+
+    ~CaptureReceiver() {
+        done_ = true;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        if (sockfd_ >= 0) {
+            close(sockfd_);
+        }
+    }
+
+    // Samples received of a stream so far
+    size_t Samples(int stream) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return samples_[stream];
+    }
+
+    int64_t LastReceiveTime() const { return last_receive_time_; }
+
+    std::vector<std::vector<uint8_t>> Datagrams() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return datagrams_;
+    }
+
+private:
+    int sockfd_ = -1;
+    std::thread thread_;
+    std::atomic<bool> done_{false};
+    std::atomic<int64_t> last_receive_time_{0};
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> datagrams_;
+    size_t samples_[kAudioDebugStreamCount] = {};
+
+    void Run() {
+        uint8_t datagram[65536];
+        while (!done_) {
+            ssize_t size = recv(sockfd_, datagram, sizeof(datagram), 0);
+            if (size < ssize_t(sizeof(AudioDebugFrameHeader))) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            datagrams_.emplace_back(datagram, datagram + size);
+            if (datagram[5] < kAudioDebugStreamCount) {
+                samples_[datagram[5]] += ReadLe(datagram + 6, 2);
+            }
+            last_receive_time_ = esp_timer_get_time();
+        }
+    }
+};
+
+bool ReplayCapture(const Capture& capture, const std::string& output_path, const ReplayOptions& options) {
+    /* The codec paces against the host clock */
+    host_time_realtime = true;
+    auto mic_stream = capture.find(kAudioDebugStreamMic);
+    if (mic_stream == capture.end() || mic_stream->second.frames.empty()) {
+        ESP_LOGE(TAG, "The capture has no microphone stream");
+        return false;
+    }
+    size_t lost = 0;
+    auto mic = mic_stream->second.Contiguous(&lost);
+    std::vector<int16_t> reference;
+    auto reference_stream = capture.find(kAudioDebugStreamReference);
+    if (reference_stream != capture.end()) {
+        size_t reference_lost = 0;
+        reference = reference_stream->second.Contiguous(&reference_lost);
+        lost += reference_lost;
+    }
+    ESP_LOGI(TAG, "Replaying %zu samples at %lu Hz%s, %zu lost frames as silence", mic.size(),
+        (unsigned long)mic_stream->second.sample_rate, reference.empty() ? "" : " with the reference", lost);
+    if (!WriteReplayInput(options.input_path, mic, reference, mic_stream->second.sample_rate)) {
+        return false;
+    }
+
+    CaptureReceiver receiver;
+    if (!receiver.Open()) {
+        return false;
+    }
+    auto codec = std::make_unique<FileAudioCodec>(options.input_path.c_str(), nullptr, 24000, options.speed);
+    auto service = std::make_unique<AudioService>();
+    service->Initialize(codec.get());
+    service->Start();
+    service->EnableVoiceProcessing(true);
+
+    /* The processed stream lags the microphone, it is complete once it covers the input. The send queue is
+       drained like the protocol would, the packets are not part of the capture */
+    int64_t deadline = esp_timer_get_time() + int64_t(REPLAY_TIMEOUT_MS) * 1000;
+    while (receiver.Samples(kAudioDebugStreamProcessed) < mic.size() && esp_timer_get_time() < deadline) {
+        while (service->PopPacketFromSendQueue()) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    service->EnableVoiceProcessing(false);
+    service->Stop();
+    while (esp_timer_get_time() - receiver.LastReceiveTime() < REPLAY_DRAIN_MS * 1000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    /* The debugger sender runs until the service deletes it */
+    HostWaitTasks(1);
+    service.reset();
+    HostWaitTasks();
+    codec.reset();
+
+    Capture replay;
+    auto datagrams = receiver.Datagrams();
+    for (auto& datagram : datagrams) {
+        ParseDatagram(datagram.data(), datagram.size(), replay);
+    }
+    if (!WriteCapture(output_path, datagrams)) {
+        return false;
+    }
+    bool complete = true;
+    for (auto& [stream, entry] : replay) {
+        size_t replay_lost = 0;
+        entry.Contiguous(&replay_lost);
+        if (replay_lost > 0 || entry.frames.begin()->first != 0) {
+            ESP_LOGE(TAG, "Stream %d of the replay lost %zu frames, replay at a lower speed", stream, replay_lost);
+            complete = false;
+        }
+    }
+    if (replay[kAudioDebugStreamProcessed].Contiguous().size() < mic.size()) {
+        ESP_LOGE(TAG, "The replay timed out");
+        complete = false;
+    }
+    return complete;
+}
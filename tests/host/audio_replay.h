@@ -0,0 +1,45 @@
+#ifndef AUDIO_REPLAY_H
+#define AUDIO_REPLAY_H
+
+/*
+ * Replays an AudioDebugger capture through the host build of AudioService.
+ *
+ * The microphone and reference streams of the capture (lost frames as silence) become the input of a
+ * FileAudioCodec at 16 kHz, the rate they were captured at after the input resampler, so the audio processor
+ * gets the same samples as on the recording device. The host AudioDebugger captures the replay to a loopback
+ * receiver, in the format of scripts/audio_debug_server.py, so the two captures can be compared stream by
+ * stream with scripts/audio_debug_capture.py compare.
+ *
+ * The host runs NoAudioProcessor and the toy codec of stubs/opus.h, so the processed stream of a replay is
+ * not the one of the device, but a replay reproduces the input bit for bit, and so does every later stream
+ * from one replay of a capture to the next.
+ */
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+struct CaptureStream {
+    uint32_t sample_rate = 0;
+    std::map<uint32_t, std::vector<int16_t>> frames;    // By sequence
+
+    // The samples in sequence order, a lost frame is silence of the size of the frame before it
+    std::vector<int16_t> Contiguous(size_t* lost = nullptr) const;
+};
+
+// Streams by AudioDebugStream, the file is the datagrams one after the other
+typedef std::map<int, CaptureStream> Capture;
+
+bool ReadCapture(const std::string& path, Capture& capture);
+bool WriteCapture(const std::string& path, const std::vector<std::vector<uint8_t>>& datagrams);
+
+struct ReplayOptions {
+    float speed = 4.0f;     // FileAudioCodec pace, the capture ring drops frames when the replay runs too fast
+    std::string input_path = "/tmp/xiaozhi_replay_input.wav";
+};
+
+// Replays the capture and writes the capture of the replay to output_path, false if the capture has no
+// microphone stream or the replay lost frames
+bool ReplayCapture(const Capture& capture, const std::string& output_path, const ReplayOptions& options = {});
+
+#endif // AUDIO_REPLAY_H
@@ -0,0 +1,96 @@
+// AudioDebugger replay: a capture with a microphone and a reference stream and a lost frame is replayed through
+// the host AudioService, and the capture of the replay must hold the recorded input bit for bit, in the microphone,
+// the reference and the processed stream, and be the same from one replay to the next.
+#include "host_test.h"
+#include "audio_replay.h"
+#include "audio_debugger.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#define CAPTURE_PATH "/tmp/xiaozhi_replay_field.xzad"
+#define REPLAY_PATH "/tmp/xiaozhi_replay_%d.xzad"
+#define FRAME_SAMPLES 960
+#define FRAMES 50
+#define LOST_FRAME 17
+
+static std::vector<uint8_t> Datagram(AudioDebugStream stream, uint32_t sequence, const std::vector<int16_t>& pcm) {
+    AudioDebugFrameHeader header = {
+        .magic = AUDIO_DEBUGGER_FRAME_MAGIC,
+        .version = AUDIO_DEBUGGER_FRAME_VERSION,
+        .stream = stream,
+        .samples = uint16_t(pcm.size()),
+        .sequence = sequence,
+        .sample_rate = 16000,
+        .timestamp_us = int64_t(sequence) * 60000,
+    };
+    std::vector<uint8_t> datagram(sizeof(header) + pcm.size() * sizeof(int16_t));
+    memcpy(datagram.data(), &header, sizeof(header));
+    memcpy(datagram.data() + sizeof(header), pcm.data(), pcm.size() * sizeof(int16_t));
+    return datagram;
+}
+
+// A field capture: speech-like noise on the microphone, a tone on the reference, one frame of each lost
+static void WriteFieldCapture() {
+    std::mt19937 random(11);
+    std::normal_distribution<double> noise(0, 4000);
+    std::vector<std::vector<uint8_t>> datagrams;
+    for (uint32_t sequence = 0; sequence < FRAMES; sequence++) {
+        std::vector<int16_t> mic(FRAME_SAMPLES);
+        std::vector<int16_t> reference(FRAME_SAMPLES);
+        for (int i = 0; i < FRAME_SAMPLES; i++) {
+            mic[i] = int16_t(std::clamp(noise(random), -32768.0, 32767.0));
+            reference[i] = int16_t(lround(10000 * sin(2 * M_PI * 440 * (sequence * FRAME_SAMPLES + i) / 16000)));
+        }
+        if (sequence != LOST_FRAME) {
+            datagrams.push_back(Datagram(kAudioDebugStreamMic, sequence, mic));
+            datagrams.push_back(Datagram(kAudioDebugStreamReference, sequence, reference));
+        }
+    }
+    CHECK(WriteCapture(CAPTURE_PATH, datagrams));
+}
+
+static std::vector<int16_t> Prefix(const Capture& capture, int stream, size_t samples) {
+    auto it = capture.find(stream);
+    CHECK(it != capture.end());
+    auto pcm = it->second.Contiguous();
+    CHECK(pcm.size() >= samples);
+    pcm.resize(samples);
+    return pcm;
+}
+
+int main() {
+    WriteFieldCapture();
+    Capture field;
+    CHECK(ReadCapture(CAPTURE_PATH, field));
+    size_t lost = 0;
+    auto mic = field[kAudioDebugStreamMic].Contiguous(&lost);
+    auto reference = field[kAudioDebugStreamReference].Contiguous();
+    CHECK(lost == 1);
+    CHECK(mic.size() == FRAMES * FRAME_SAMPLES && reference.size() == mic.size());
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+        CHECK(mic[LOST_FRAME * FRAME_SAMPLES + i] == 0);
+    }
+
+    std::vector<int16_t> processed[2];
+    for (int run = 0; run < 2; run++) {
+        char path[64];
+        snprintf(path, sizeof(path), REPLAY_PATH, run);
+        auto start = HostNowNs();
+        CHECK(ReplayCapture(field, path));
+        Capture replay;
+        CHECK(ReadCapture(path, replay));
+        printf("replay %d: %.2f s for %.2f s of audio, %zu frames processed\n", run, (HostNowNs() - start) / 1e9,
+            mic.size() / 16000.0, replay[kAudioDebugStreamProcessed].frames.size());
+
+        CHECK(Prefix(replay, kAudioDebugStreamMic, mic.size()) == mic);
+        CHECK(Prefix(replay, kAudioDebugStreamReference, mic.size()) == reference);
+        // NoAudioProcessor passes the microphone channel through
+        processed[run] = Prefix(replay, kAudioDebugStreamProcessed, mic.size());
+        CHECK(processed[run] == mic);
+    }
+    CHECK(processed[0] == processed[1]);
+    printf("audio_replay_test passed\n");
+    return 0;
+}
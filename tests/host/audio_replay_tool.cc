@@ -0,0 +1,23 @@
+// Replays an AudioDebugger capture through the host build of AudioService, see audio_replay.h:
+//   audio_replay <capture> <replay capture> [speed]
+// then compare the two with scripts/audio_debug_capture.py compare.
+#include "audio_replay.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <capture> <replay capture> [speed, default 4]\n", argv[0]);
+        return 2;
+    }
+    Capture capture;
+    if (!ReadCapture(argv[1], capture)) {
+        return 1;
+    }
+    ReplayOptions options;
+    if (argc > 3) {
+        options.speed = atof(argv[3]);
+    }
+    return ReplayCapture(capture, argv[2], options) ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+// AudioTaskPool and AudioPacketPool: no heap allocation once the pools are warm, checked with the pool counters
+// and by counting the global operator new calls around a simulated steady state of the encode and playback paths,
+// and of the uplink from the encoded packet through the send queue and Protocol::SendAudio() back to the pool.
+#include "host_test.h"
+#include "audio_task_pool.h"
+#include "spsc_queue.h"
+#include "protocol.h"
+
+#include <atomic>
+#include <new>
+
+static std::atomic<uint64_t> heap_allocations{0};
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static void TestRecycling() {
+    AudioTaskPool pool(2, 960);
+    {
+        auto a = pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+        auto b = pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+        CHECK(a->pcm.capacity() >= 960 && b->pcm.capacity() >= 960);
+        // Exhausted: a heap task, released to the heap again
+        auto c = pool.Acquire(kAudioTaskTypeDecodeToPlaybackQueue);
+        CHECK(c->type == kAudioTaskTypeDecodeToPlaybackQueue);
+    }
+    auto statistics = pool.GetStatistics();
+    CHECK(statistics.acquire_count == 3);
+    CHECK(statistics.task_misses == 1);
+    CHECK(statistics.buffer_misses == 1);
+
+    // A frame larger than the pool size grows every buffer from then on, counted once
+    {
+        auto task = pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+        task->pcm.resize(1440);
+    }
+    statistics = pool.GetStatistics();
+    CHECK(statistics.buffer_misses == 2);
+    auto task = pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+    CHECK(task->pcm.capacity() >= 1440);
+    CHECK(task->timestamp == 0 && task->origin_time == 0 && task->pcm.empty());
+}
+
+static void TestSteadyState() {
+    // The pool and queue sizes of AudioService: frames go through a queue and come back to the pool
+    const size_t samples = 60 * 16000 / 1000;
+    AudioTaskPool pool(6, samples);
+    SpscQueue<AudioTaskPtr> queue(2);
+    std::vector<int16_t> mic(samples, 1000);
+
+    auto run = [&](int frames) {
+        for (int i = 0; i < frames; i++) {
+            auto task = pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+            task->pcm.assign(mic.begin(), mic.end());
+            task->timestamp = i;
+            CHECK(queue.Push(std::move(task)));
+            AudioTaskPtr popped;
+            CHECK(queue.Pop(popped));
+            CHECK(popped->pcm.size() == samples);
+        }
+    };
+
+    run(10);
+    auto before = pool.GetStatistics();
+    uint64_t allocations = heap_allocations;
+    run(1000);
+    uint64_t steady_allocations = heap_allocations - allocations;
+    auto after = pool.GetStatistics();
+
+    printf("Steady state: %llu heap allocations over 1000 frames, %lu task misses, %lu buffer misses\n",
+        (unsigned long long)steady_allocations, (unsigned long)(after.task_misses - before.task_misses),
+        (unsigned long)(after.buffer_misses - before.buffer_misses));
+    CHECK(steady_allocations == 0);
+    CHECK(after.task_misses == before.task_misses);
+    CHECK(after.buffer_misses == before.buffer_misses);
+    CHECK(after.acquire_count - before.acquire_count == 1000);
+}
+
+// Counts what a transport would send, the packet is only borrowed
+class CountingProtocol : public Protocol {
+public:
+    size_t messages = 0;
+    size_t frames = 0;
+    size_t bytes = 0;
+
+    bool Start() override { return true; }
+    bool OpenAudioChannel() override { return true; }
+    void CloseAudioChannel() override {}
+    bool IsAudioChannelOpened() const override { return true; }
+
+    using Protocol::SetFramesPerPacket;
+
+protected:
+    bool SendAudioMessage(AudioStreamPacket& packet, int frames) override {
+        messages++;
+        this->frames += frames;
+        bytes += packet.size();
+        return true;
+    }
+    bool SendText(const std::string& text) override { return true; }
+};
+
+static void TestPacketRecycling() {
+    AudioPacketPool pool(2, 512);
+    {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        CHECK(a->payload.capacity() >= 512 && b->payload.capacity() >= 512);
+        // Exhausted: a heap packet, released to the heap again
+        auto c = pool.Acquire();
+        c->payload.assign(100, 1);
+    }
+    auto statistics = pool.GetStatistics();
+    CHECK(statistics.acquire_count == 3);
+    CHECK(statistics.packet_misses == 1);
+    CHECK(statistics.buffer_misses == 1);
+
+    // A frame larger than the pool size grows every buffer from then on, counted once
+    {
+        auto packet = pool.Acquire();
+        packet->payload.resize(1000);
+    }
+    statistics = pool.GetStatistics();
+    CHECK(statistics.buffer_misses == 2);
+    {
+        auto packet = pool.Acquire();
+        CHECK(packet->payload.capacity() >= 1000);
+        packet->timestamp = 7;
+        packet->sequence = 3;
+        packet->origin_time = 1;
+        packet->payload.assign(10, 1);
+    }
+    auto packet = pool.Acquire();
+    CHECK(packet->timestamp == 0 && packet->sequence == 0 && packet->origin_time == 0 && packet->payload.empty());
+
+    // A packet not from a pool is deleted by the default recycler
+    AudioPacketPtr heap_packet(new AudioStreamPacket());
+    heap_packet.reset();
+}
+
+/*
+ * OpusEncodeTask and the Application send loop: a pooled frame is encoded into a pooled packet, queued, sent
+ * (packed with the next ones when frame aggregation is on) and both go back to their pools.
+ */
+static void TestUplinkSteadyState(int frames_per_packet) {
+    const size_t samples = 60 * 16000 / 1000;
+    AudioTaskPool task_pool(5, samples);
+    AudioPacketPool packet_pool(8, 512);
+    SpscQueue<AudioTaskPtr> encode_queue(2);
+    SpscQueue<AudioPacketPtr> send_queue(2400 / 20);
+    CountingProtocol protocol;
+    protocol.SetFramesPerPacket(frames_per_packet);
+    std::vector<int16_t> mic(samples, 1000);
+    std::vector<uint8_t> opus(400, 0x5A);
+
+    auto run = [&](int frames) {
+        for (int i = 0; i < frames; i++) {
+            auto task = task_pool.Acquire(kAudioTaskTypeEncodeToSendQueue);
+            task->pcm.assign(mic.begin(), mic.end());
+            CHECK(encode_queue.Push(std::move(task)));
+
+            CHECK(encode_queue.Pop(task));
+            auto packet = packet_pool.Acquire();
+            packet->frame_duration = 60;
+            packet->sample_rate = 16000;
+            packet->timestamp = task->timestamp;
+            // Opus frames of varying size behind the headroom, as UplinkEncoder writes them
+            packet->headroom = AUDIO_PACKET_HEADROOM;
+            packet->payload.assign(opus.begin(), opus.begin() + AUDIO_PACKET_HEADROOM + 100 + (i * 37) % 300);
+            task.reset();
+            CHECK(send_queue.Push(std::move(packet)));
+
+            // Every few frames the network stalls and the send loop drains a backlog
+            if (i % 5 == 4) {
+                while (send_queue.Pop(packet)) {
+                    CHECK(protocol.SendAudio(*packet));
+                }
+            }
+        }
+    };
+
+    run(50);
+    auto tasks_before = task_pool.GetStatistics();
+    auto packets_before = packet_pool.GetStatistics();
+    uint64_t allocations = heap_allocations;
+    size_t frames_before = protocol.frames;
+    run(1000);
+    uint64_t steady_allocations = heap_allocations - allocations;
+    auto tasks_after = task_pool.GetStatistics();
+    auto packets_after = packet_pool.GetStatistics();
+
+    printf("Uplink, %d frame(s) per packet: %llu heap allocations over 1000 frames, %lu packet misses, "
+        "%lu buffer misses, %zu messages\n", frames_per_packet, (unsigned long long)steady_allocations,
+        (unsigned long)(packets_after.packet_misses - packets_before.packet_misses),
+        (unsigned long)(packets_after.buffer_misses - packets_before.buffer_misses), protocol.messages);
+    CHECK(steady_allocations == 0);
+    CHECK(packets_after.packet_misses == packets_before.packet_misses);
+    CHECK(packets_after.buffer_misses == packets_before.buffer_misses);
+    CHECK(tasks_after.task_misses == tasks_before.task_misses);
+    CHECK(tasks_after.buffer_misses == tasks_before.buffer_misses);
+    // Up to two frames of the last message are still packed
+    CHECK(protocol.frames - frames_before + 2 >= 1000);
+}
+
+int main() {
+    TestRecycling();
+    TestSteadyState();
+    TestPacketRecycling();
+    TestUplinkSteadyState(1);
+    TestUplinkSteadyState(4);
+    printf("audio_task_pool_test passed\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+// Protocol v4 control messages: the CBOR of the transcoder must match the RFC 8949 examples, the CBOR parser must
+// build the tree cJSON_Parse() builds from the JSON text of the device and server messages, malformed JSON and CBOR
+// must be refused, and the benchmark compares the encode and decode time and size with the JSON text.
+#include "host_test.h"
+#include "control_codec.h"
+
+#include <string>
+#include <vector>
+
+static std::string Hex(const std::string& data) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c : data) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xF];
+    }
+    return hex;
+}
+
+static std::string Bytes(const char* hex) {
+    std::string data;
+    for (size_t i = 0; hex[i] != '\0' && hex[i + 1] != '\0'; i += 2) {
+        data += char(strtol(std::string(hex + i, 2).c_str(), nullptr, 16));
+    }
+    return data;
+}
+
+static std::string Print(const cJSON* root) {
+    CHECK(root != nullptr);
+    auto json = cJSON_PrintUnformatted(root);
+    std::string text(json);
+    cJSON_free(json);
+    return text;
+}
+
+static cJSON* Parse(const std::string& cbor) {
+    return ParseCbor((const uint8_t*)cbor.data(), cbor.size());
+}
+
+static void TestEncode() {
+    const struct {
+        const char* json;
+        const char* cbor;
+    } vectors[] = {
+        {"0", "00"},
+        {"23", "17"},
+        {"24", "1818"},
+        {"1000", "1903e8"},
+        {"1000000", "1a000f4240"},
+        {"18446744073709551615", "1bffffffffffffffff"},
+        {"-1", "20"},
+        {"-100", "3863"},
+        {"-0", "fa80000000"},
+        {"1.5", "fa3fc00000"},
+        {"1.1", "fb3ff199999999999a"},
+        {"1e2", "fa42c80000"},
+        {"true", "f5"},
+        {"false", "f4"},
+        {"null", "f6"},
+        {"\"\"", "60"},
+        {"\"IETF\"", "6449455446"},
+        {"\"\\\"\\\\\"", "62225c"},
+        {"\"\\u00fc\"", "62c3bc"},
+        {"\"\\ud800\\udd51\"", "64f0908591"},
+        {"[]", "9fff"},
+        {" [1, [2, 3], [4, 5]] ", "9f019f0203ff9f0405ffff"},
+        {"{\"a\":1,\"b\":[2,3]}", "bf61610161629f0203ffff"},
+        {"{\"Fun\":true,\"Amt\":-2}", "bf6346756ef563416d7421ff"},
+    };
+    for (auto& vector : vectors) {
+        std::string cbor;
+        CHECK(JsonToCbor(vector.json, cbor));
+        if (Hex(cbor) != vector.cbor) {
+            printf("%s: %s, expected %s\n", vector.json, Hex(cbor).c_str(), vector.cbor);
+        }
+        CHECK(Hex(cbor) == vector.cbor);
+    }
+    printf("encode: %zu RFC 8949 examples\n", sizeof(vectors) / sizeof(vectors[0]));
+}
+
+static void TestDecode() {
+    /* Definite lengths, chunked strings, half floats and tags, which the device never sends but a server may */
+    const struct {
+        const char* cbor;
+        const char* json;
+    } vectors[] = {
+        {"1818", "24"},
+        {"3903e7", "-1000"},
+        {"f93c00", "1"},
+        {"f9c400", "-4"},
+        {"f93e00", "1.5"},
+        {"f90001", "5.9604644775390625e-08"},
+        {"fa47c35000", "100000"},
+        {"fb3ff199999999999a", "1.1000000000000001"},
+        {"7f657374726561646d696e67ff", "\"streaming\""},
+        {"83010203", "[1,2,3]"},
+        {"a26161016162820203", "{\"a\":1,\"b\":[2,3]}"},
+        {"826161bf61626163ff", "[\"a\",{\"b\":\"c\"}]"},
+        {"c074323031332d30332d32315432303a30343a30305a", "\"2013-03-21T20:04:00Z\""},
+        {"a0", "{}"},
+        {"80", "[]"},
+    };
+    for (auto& vector : vectors) {
+        auto root = Parse(Bytes(vector.cbor));
+        CHECK(Print(root) == vector.json);
+        cJSON_Delete(root);
+    }
+    printf("decode: %zu RFC 8949 examples\n", sizeof(vectors) / sizeof(vectors[0]));
+}
+
+// A tools/list page of the size McpServer::GetToolsList() sends
+static std::string ToolsListMessage() {
+    std::string tools;
+    for (int i = 0; tools.size() < 7600; i++) {
+        if (!tools.empty()) {
+            tools += ",";
+        }
+        tools += "{\"name\":\"self.board.tool_" + std::to_string(i) + "\",\"description\":\"Set the value " +
+            std::to_string(i) + " of the board.\\nUse it when the user asks \\\"turn it up\\\" or \\\"调高一点\\\".\","
+            "\"inputSchema\":{\"type\":\"object\",\"properties\":{\"value\":{\"type\":\"integer\",\"minimum\":0,"
+            "\"maximum\":100},\"enabled\":{\"type\":\"boolean\"}},\"required\":[\"value\"]}}";
+    }
+    return "{\"session_id\":\"7e9a6d4c\",\"type\":\"mcp\",\"payload\":{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":"
+        "{\"tools\":[" + tools + "],\"nextCursor\":\"self.board.tool_99\"}}}";
+}
+
+static const std::vector<std::string>& Messages() {
+    static const std::vector<std::string> messages = {
+        R"({"type":"hello","version":4,"features":{"mcp":true},"transport":"websocket","audio_params":{"format":"opus","sample_rate":16000,"channels":1,"frame_duration":60}})",
+        R"({"type":"hello","transport":"websocket","session_id":"7e9a6d4c","audio_params":{"format":"opus","sample_rate":24000,"channels":1,"frame_duration":60}})",
+        R"({"session_id":"7e9a6d4c","type":"listen","state":"start","mode":"auto","frame_duration":60})",
+        R"({"type":"stt","text":"今天天气怎么样？","session_id":"7e9a6d4c"})",
+        R"({"type":"llm","text":"😊","emotion":"happy","session_id":"7e9a6d4c"})",
+        R"({"type":"tts","state":"sentence_start","text":"今天\n晴，\"最高\" 25°C\\","session_id":"7e9a6d4c"})",
+        R"({"session_id":"7e9a6d4c","type":"mcp","payload":{"jsonrpc":"2.0","id":3,"result":{"content":[{"type":"text","text":"{\"volume\":80,\"muted\":false}"}],"isError":false}}})",
+        R"({"type":"mcp","payload":{"jsonrpc":"2.0","id":4,"method":"tools/call","params":{"name":"self.audio_speaker.set_volume","arguments":{"volume":-0.25,"ratio":1e-7,"big":12345678901234567890,"list":[null,true,false,[],{}]}}}})",
+        ToolsListMessage(),
+    };
+    return messages;
+}
+
+static void TestRoundTrip() {
+    for (auto& json : Messages()) {
+        std::string cbor;
+        CHECK(JsonToCbor(json, cbor));
+        auto expected = cJSON_Parse(json.c_str());
+        auto root = Parse(cbor);
+        CHECK(Print(root) == Print(expected));
+        cJSON_Delete(root);
+        cJSON_Delete(expected);
+    }
+    printf("round trip: %zu messages parse to the tree of their JSON text\n", Messages().size());
+}
+
+static void TestMalformed() {
+    std::string deep;
+    for (int i = 0; i <= CONTROL_CODEC_MAX_DEPTH; i++) {
+        deep += "[";
+    }
+    for (int i = 0; i <= CONTROL_CODEC_MAX_DEPTH; i++) {
+        deep += "]";
+    }
+    const std::string refused_json[] = {
+        "", " ", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "{a:1}", "01", "1.", "1e", "-", "+1", ".5", "tru", "nul",
+        "\"abc", "\"\\x\"", "\"\\u12\"", "\"\\udc00\"", "\"\\ud800\"", "\"\\ud800\\u0041\"", "[1] 2", "{}}", deep,
+    };
+    for (auto& json : refused_json) {
+        std::string cbor = "kept";
+        CHECK(!JsonToCbor(json, cbor));
+        CHECK(cbor == "kept");
+    }
+    std::string shallow;
+    CHECK(JsonToCbor(deep.substr(1, deep.size() - 2), shallow));
+
+    const char* refused_cbor[] = {
+        "",             // Nothing
+        "18",           // Argument cut short
+        "1c",           // Reserved additional information
+        "4161",         // Byte string
+        "6361",         // Text cut short
+        "7f61",         // Chunked text without a break
+        "7f4161ff",     // Byte chunk in a text string
+        "7f7f6161ffff", // Nested chunked text
+        "83010203ff",   // Trailing byte
+        "830102",       // Array cut short
+        "9bffffffffffffffff00", // Count beyond the data
+        "9f0102",       // Indefinite array without a break
+        "a10102",       // Integer key
+        "a1616101616202", // Two items after a one entry map
+        "ff",           // Break outside of a container
+        "5f",           // Indefinite byte string
+        "1f",           // Indefinite integer
+        "f7",           // Undefined
+        "f818",         // Simple value
+        "c6",           // Tag without an item
+    };
+    for (auto hex : refused_cbor) {
+        auto root = Parse(Bytes(hex));
+        if (root != nullptr) {
+            printf("accepted %s\n", hex);
+        }
+        CHECK(root == nullptr);
+    }
+    std::string nested;
+    for (int i = 0; i <= CONTROL_CODEC_MAX_DEPTH; i++) {
+        nested += char(0x81);
+    }
+    nested += char(0x01);
+    CHECK(Parse(nested) == nullptr);
+    auto root = Parse(nested.substr(1));
+    CHECK(root != nullptr);
+    cJSON_Delete(root);
+
+    /* Every prefix of a message is cut short */
+    std::string cbor;
+    CHECK(JsonToCbor(Messages()[7], cbor));
+    for (size_t size = 0; size < cbor.size(); size++) {
+        CHECK(ParseCbor((const uint8_t*)cbor.data(), size) == nullptr);
+    }
+    printf("malformed: %zu JSON texts, %zu CBOR items and %zu prefixes refused\n",
+        sizeof(refused_json) / sizeof(refused_json[0]), sizeof(refused_cbor) / sizeof(refused_cbor[0]) + 1,
+        cbor.size());
+}
+
+static void Benchmark() {
+    printf("%-12s %6s %6s %12s %12s %12s %12s\n", "message", "json", "cbor", "cJSON_Parse", "ParseCbor",
+        "cJSON_Print", "JsonToCbor");
+    const char* names[] = {"hello", "server hello", "listen", "stt", "llm", "tts", "mcp reply", "mcp call",
+        "tools/list"};
+    for (size_t m = 0; m < Messages().size(); m++) {
+        auto& json = Messages()[m];
+        const int iterations = json.size() > 1000 ? 2000 : 50000;
+        std::string cbor;
+        JsonToCbor(json, cbor);
+
+        auto start = HostNowNs();
+        for (int i = 0; i < iterations; i++) {
+            cJSON_Delete(cJSON_Parse(json.c_str()));
+        }
+        double parse_json = double(HostNowNs() - start) / iterations;
+        start = HostNowNs();
+        for (int i = 0; i < iterations; i++) {
+            cJSON_Delete(Parse(cbor));
+        }
+        double parse_cbor = double(HostNowNs() - start) / iterations;
+
+        auto root = cJSON_Parse(json.c_str());
+        start = HostNowNs();
+        for (int i = 0; i < iterations; i++) {
+            cJSON_free(cJSON_PrintUnformatted(root));
+        }
+        double print_json = double(HostNowNs() - start) / iterations;
+        cJSON_Delete(root);
+        std::string buffer;
+        start = HostNowNs();
+        for (int i = 0; i < iterations; i++) {
+            buffer.clear();
+            JsonToCbor(json, buffer);
+        }
+        double encode_cbor = double(HostNowNs() - start) / iterations;
+        printf("%-12s %6zu %6zu %9.2f us %9.2f us %9.2f us %9.2f us\n", names[m], json.size(), cbor.size(),
+            parse_json / 1000, parse_cbor / 1000, print_json / 1000, encode_cbor / 1000);
+    }
+}
+
+int main() {
+    TestEncode();
+    TestDecode();
+    TestRoundTrip();
+    TestMalformed();
+    Benchmark();
+    printf("control_codec_test passed\n");
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Fails the test with the location of the check, also in release builds. _Exit() does not run the static
+// destructors, which a test task may still be blocked on
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        fflush(stdout); \
+        fflush(stderr); \
+        _Exit(1); \
+    } \
+} while (0)
+
+static inline int64_t HostNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Value at the given percentile (0 to 100) of the samples, sorts them
+template <typename T>
+static T Percentile(std::vector<T>& samples, double percent) {
+    if (samples.empty()) {
+        return T();
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = size_t(percent / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(index, samples.size() - 1)];
+}
+
+#endif // HOST_TEST_H
@@ -0,0 +1,303 @@
+// JitterBuffer: reordering, FEC recovery, concealment and skipping on hand-made sequences, then a 60 ms stream through a
+// network model with loss and jitter, played out by a simulated decode task and speaker on the host clock.
+#include "host_test.h"
+#include "jitter_buffer.h"
+
+#include <deque>
+#include <random>
+
+// Sized like AudioService: MAX_DECODE_PACKETS_IN_QUEUE and MAX_DECODE_QUEUE_DURATION_MS
+static const size_t kCapacity = 120;
+static const int kMaxDurationMs = 2400;
+static const int kFrameMs = 60;
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t sequence) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = 24000;
+    packet->frame_duration = kFrameMs;
+    packet->sequence = sequence;
+    packet->has_sequence = true;
+    packet->origin_time = esp_timer_get_time();
+    packet->payload.assign(4, uint8_t(sequence));
+    return packet;
+}
+
+static bool IsConcealed(const std::unique_ptr<AudioStreamPacket>& packet) {
+    return packet && packet->payload.empty();
+}
+
+static bool IsRecovered(const std::unique_ptr<AudioStreamPacket>& packet) {
+    return packet && packet->decode_fec;
+}
+
+static void TestReorder() {
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(!buffer.Put(MakePacket(2)));
+    for (uint32_t sequence = 1; sequence <= 3; sequence++) {
+        auto packet = buffer.Get();
+        CHECK(packet && packet->sequence == sequence);
+    }
+    CHECK(buffer.Get() == nullptr);
+    // Already played
+    CHECK(!buffer.Put(MakePacket(2)));
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.duplicated == 1 && statistics.late == 1 && statistics.reordered >= 1);
+}
+
+static void TestRecovery() {
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(buffer.Put(MakePacket(4)));
+    CHECK(buffer.Get()->sequence == 1);
+    CHECK(buffer.Get()->sequence == 2);
+
+    // Frame 3 is missing: waited for one frame duration, then recovered from the FEC data of frame 4
+    CHECK(buffer.Get() == nullptr);
+    int wait_ms = buffer.GetWaitTimeMs();
+    CHECK(wait_ms > 0 && wait_ms <= kFrameMs);
+    HostAdvanceTime(int64_t(wait_ms) * 1000);
+    auto packet = buffer.Get();
+    CHECK(IsRecovered(packet));
+    CHECK(packet->payload == MakePacket(4)->payload);
+    CHECK(packet->sample_rate == 24000 && packet->frame_duration == kFrameMs);
+    // Stamped when recovered, so a barge-in flush drops it
+    CHECK(packet->origin_time == esp_timer_get_time());
+    // Frame 4 itself is still decoded in turn
+    packet = buffer.Get();
+    CHECK(packet->sequence == 4 && !packet->decode_fec);
+
+    // Frame 3 arriving now is late
+    CHECK(!buffer.Put(MakePacket(3)));
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.recovered == 1 && statistics.concealed == 0 && statistics.late == 1);
+}
+
+static void TestConcealment() {
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(4)));
+    CHECK(buffer.Get()->sequence == 1);
+
+    // Frames 2 and 3 are missing: 2 has no next frame to recover it from and is concealed, 3 is recovered
+    CHECK(buffer.Get() == nullptr);
+    HostAdvanceTime(int64_t(buffer.GetWaitTimeMs()) * 1000);
+    auto packet = buffer.Get();
+    CHECK(IsConcealed(packet));
+    CHECK(packet->sample_rate == 24000 && packet->frame_duration == kFrameMs);
+    CHECK(packet->origin_time == esp_timer_get_time());
+    // Frame 3 gets its own wait, it may still arrive
+    CHECK(buffer.Get() == nullptr);
+    HostAdvanceTime(int64_t(buffer.GetWaitTimeMs()) * 1000);
+    packet = buffer.Get();
+    CHECK(IsRecovered(packet));
+    CHECK(packet->payload == MakePacket(4)->payload);
+    CHECK(buffer.Get()->sequence == 4);
+
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.concealed == 1 && statistics.recovered == 1);
+}
+
+static void TestSequenceNumbers() {
+    // Numbered by the transport, 0 is just another sequence number as the counter wraps
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    for (uint32_t sequence : {0xFFFFFFFEu, 0u, 0xFFFFFFFFu, 1u}) {
+        CHECK(buffer.Put(MakePacket(sequence)));
+    }
+    for (uint32_t sequence : {0xFFFFFFFEu, 0xFFFFFFFFu, 0u, 1u}) {
+        auto packet = buffer.Get();
+        CHECK(packet && packet->sequence == sequence);
+    }
+    CHECK(buffer.GetStatistics().concealed == 0);
+
+    // Without sequence numbers (websocket) the arrival order is the order, whatever the field holds
+    JitterBuffer unnumbered(kCapacity, kMaxDurationMs);
+    for (uint32_t sequence : {5u, 0u, 3u}) {
+        auto packet = MakePacket(sequence);
+        packet->has_sequence = false;
+        CHECK(unnumbered.Put(std::move(packet)));
+    }
+    for (uint8_t value : {5, 0, 3}) {
+        auto packet = unnumbered.Get();
+        CHECK(packet && packet->payload[0] == value);
+    }
+    CHECK(unnumbered.Get() == nullptr);
+}
+
+static void TestSkipLongGap() {
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Get()->sequence == 1);
+    // 10 frames lost: too long to conceal, playback jumps to the next frame
+    CHECK(buffer.Put(MakePacket(12)));
+    CHECK(buffer.Put(MakePacket(13)));
+    HostAdvanceTime(kFrameMs * 1000);
+    CHECK(buffer.Get()->sequence == 12);
+    CHECK(buffer.GetStatistics().concealed == 0);
+}
+
+static void TestRestartedStream() {
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    for (uint32_t sequence = 1000; sequence < 1003; sequence++) {
+        CHECK(buffer.Put(MakePacket(sequence)));
+        auto packet = buffer.Get();
+        CHECK(packet && packet->sequence == sequence);
+        HostAdvanceTime(kFrameMs * 1000);
+    }
+    // Far behind the playout point: the server started a new stream, which plays at once
+    CHECK(buffer.Put(MakePacket(1)));
+    auto packet = buffer.Get();
+    CHECK(packet && packet->sequence == 1);
+    // The sequence jump is not taken for network jitter
+    CHECK(buffer.GetStatistics().jitter_ms < kFrameMs);
+}
+
+struct NetworkModel {
+    const char* name;
+    double loss;            // Probability that a packet is lost
+    int jitter_ms;          // Extra delay, uniform in [0, jitter_ms]
+    double burst;           // Probability that a packet also waits for a jitter_ms stall
+};
+
+struct PlayoutResult {
+    uint32_t sent = 0;
+    uint32_t lost = 0;
+    uint32_t played = 0;
+    uint32_t concealed = 0;
+    uint32_t recovered = 0;
+    uint32_t glitches = 0;      // Speaker periods with no frame, after playback started
+    uint32_t max_depth = 0;
+    JitterBufferStatistics statistics;
+};
+
+// 1 ms steps: the network delivers, the decode task keeps MAX_PLAYBACK_TASKS_IN_QUEUE frames ahead of the
+// speaker like OpusDecodeTask, and the speaker takes a frame every frame duration
+static PlayoutResult RunModel(const NetworkModel& model, int seconds, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> jitter(0, model.jitter_ms);
+
+    JitterBuffer buffer(kCapacity, kMaxDurationMs);
+    PlayoutResult result;
+    std::deque<std::pair<int64_t, std::unique_ptr<AudioStreamPacket>>> in_flight;
+    std::deque<std::unique_ptr<AudioStreamPacket>> playback;
+    int64_t start = esp_timer_get_time();
+    int64_t next_send = start;
+    int64_t next_output = -1;
+    uint32_t sequence = 1;
+    uint32_t last_sequence = 0;
+    int64_t end = start + int64_t(seconds) * 1000000;
+
+    while (esp_timer_get_time() < end) {
+        int64_t now = esp_timer_get_time();
+        if (now >= next_send) {
+            result.sent++;
+            auto packet = MakePacket(sequence++);
+            if (chance(random) < model.loss) {
+                result.lost++;
+            } else {
+                int delay_ms = 20 + jitter(random) + (chance(random) < model.burst ? model.jitter_ms : 0);
+                auto arrival = now + int64_t(delay_ms) * 1000;
+                auto it = in_flight.begin();
+                while (it != in_flight.end() && it->first <= arrival) {
+                    it++;
+                }
+                in_flight.emplace(it, arrival, std::move(packet));
+            }
+            next_send += kFrameMs * 1000;
+        }
+        while (!in_flight.empty() && in_flight.front().first <= now) {
+            buffer.Put(std::move(in_flight.front().second));
+            in_flight.pop_front();
+        }
+
+        while (playback.size() < 2) {
+            auto packet = buffer.Get();
+            if (!packet) {
+                break;
+            }
+            if (IsConcealed(packet)) {
+                result.concealed++;
+            } else if (IsRecovered(packet)) {
+                result.recovered++;
+            } else {
+                // Played in order, never twice
+                CHECK(packet->sequence > last_sequence);
+                last_sequence = packet->sequence;
+                result.played++;
+            }
+            playback.push_back(std::move(packet));
+        }
+        result.max_depth = std::max(result.max_depth, buffer.GetStatistics().target_depth);
+
+        if (next_output < 0 && !playback.empty()) {
+            next_output = now;
+        }
+        if (next_output >= 0 && now >= next_output) {
+            if (playback.empty()) {
+                result.glitches++;
+            } else {
+                playback.pop_front();
+            }
+            next_output += kFrameMs * 1000;
+        }
+        HostAdvanceTime(1000);
+    }
+    result.statistics = buffer.GetStatistics();
+    return result;
+}
+
+static void TestNetworkModels() {
+    const NetworkModel models[] = {
+        {"clean", 0.0, 0, 0.0},
+        {"loss 5%", 0.05, 5, 0.0},
+        {"jitter 80ms", 0.0, 80, 0.0},
+        {"wifi", 0.02, 40, 0.02},
+        {"4g", 0.05, 120, 0.05},
+    };
+    printf("%-12s %5s %5s %6s %9s %9s %5s %8s %6s %9s %6s\n", "model", "sent", "lost", "played", "recovered",
+        "concealed", "late", "glitches", "depth", "max depth", "jitter");
+    for (auto& model : models) {
+        auto result = RunModel(model, 120, 42);
+        auto& statistics = result.statistics;
+        printf("%-12s %5lu %5lu %6lu %9lu %9lu %5lu %8lu %6lu %9lu %4lums\n", model.name, (unsigned long)result.sent,
+            (unsigned long)result.lost, (unsigned long)result.played, (unsigned long)result.recovered,
+            (unsigned long)result.concealed,
+            (unsigned long)statistics.late, (unsigned long)result.glitches, (unsigned long)statistics.target_depth,
+            (unsigned long)result.max_depth, (unsigned long)statistics.jitter_ms);
+
+        // Every packet that arrived was played, came too late, or is still buffered at the end
+        uint32_t received = result.sent - result.lost;
+        CHECK(statistics.received <= received);
+        CHECK(result.played + statistics.late + statistics.duplicated + statistics.overflowed <= statistics.received);
+        CHECK(statistics.received - result.played - statistics.late <= JITTER_BUFFER_MAX_FRAMES + 4);
+        // Only lost or late frames are recovered or concealed
+        CHECK(result.recovered == statistics.recovered && result.concealed == statistics.concealed);
+        CHECK(result.recovered + result.concealed <= result.lost + statistics.late);
+        if (model.jitter_ms == 0 && model.loss == 0) {
+            CHECK(result.concealed == 0 && result.recovered == 0 && statistics.late == 0 && result.glitches == 0);
+        }
+        if (model.jitter_ms >= kFrameMs) {
+            // The depth follows the jitter
+            CHECK(result.max_depth > JITTER_BUFFER_MIN_FRAMES);
+        }
+        // Jitter alone rarely starves the speaker. A loss that empties the buffer is skipped, not concealed,
+        // since nothing tells the lost frame from a late one until the next arrives: at most one gap each
+        CHECK(result.glitches <= result.lost + result.sent / 50);
+    }
+}
+
+int main() {
+    TestReorder();
+    TestRecovery();
+    TestConcealment();
+    TestSequenceNumbers();
+    TestSkipLongGap();
+    TestRestartedStream();
+    TestNetworkModels();
+    printf("jitter_buffer_test passed\n");
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Server message routing: parsed server messages must reach every handler of their type in subscription order and
+// no other, messages of an unknown type or without one must be refused, and the benchmark reports the dispatch time.
+#include "host_test.h"
+#include "message_router.h"
+
+#include <string>
+#include <vector>
+
+static cJSON* Parse(const char* json) {
+    auto root = cJSON_Parse(json);
+    CHECK(root != nullptr);
+    return root;
+}
+
+static void TestDispatch() {
+    MessageRouter router;
+    std::vector<std::string> calls;
+    router.Subscribe("tts", [&calls](const cJSON* root) {
+        auto state = cJSON_GetObjectItem(root, "state");
+        CHECK(cJSON_IsString(state));
+        calls.push_back(std::string("tts:") + state->valuestring);
+    });
+    router.Subscribe("stt", [&calls](const cJSON* root) {
+        auto text = cJSON_GetObjectItem(root, "text");
+        CHECK(cJSON_IsString(text));
+        calls.push_back(std::string("stt:") + text->valuestring);
+    });
+    router.Subscribe("mcp", [&calls](const cJSON* root) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        CHECK(cJSON_IsObject(payload));
+        auto id = cJSON_GetObjectItem(payload, "id");
+        CHECK(cJSON_IsNumber(id) && id->valueint == 7);
+        calls.push_back("mcp");
+    });
+
+    const char* messages[] = {
+        R"({"type":"tts","state":"start","session_id":"abc"})",
+        R"({"session_id":"abc","type":"stt","text":"你\"hello\"\n"})",
+        R"( { "type" : "mcp", "payload" : {"jsonrpc":"2.0","id":7,"method":"tools/list","params":{}} } )",
+        R"({"type":"tts","state":"stop"})",
+    };
+    for (auto message : messages) {
+        auto root = Parse(message);
+        CHECK(router.Dispatch(root));
+        cJSON_Delete(root);
+    }
+    CHECK(calls.size() == 4);
+    CHECK(calls[0] == "tts:start");
+    CHECK(calls[1] == "stt:你\"hello\"\n");
+    CHECK(calls[2] == "mcp");
+    CHECK(calls[3] == "tts:stop");
+    printf("dispatch: %zu messages reached their handlers\n", calls.size());
+}
+
+static void TestUnknownTypes() {
+    MessageRouter router;
+    int calls = 0;
+    router.Subscribe("llm", [&calls](const cJSON*) { calls++; });
+
+    const char* refused[] = {
+        R"({"type":"goodbye","session_id":"abc"})",
+        R"({"type":"LLM","emotion":"happy"})",
+        R"({"session_id":"abc","text":"no type"})",
+        R"({"type":42})",
+        R"({"type":null})",
+        R"([])",
+    };
+    for (auto message : refused) {
+        auto root = Parse(message);
+        CHECK(!router.Dispatch(root));
+        cJSON_Delete(root);
+    }
+    CHECK(calls == 0);
+
+    auto root = Parse(R"({"type":"llm","emotion":"happy"})");
+    CHECK(router.Dispatch(root));
+    cJSON_Delete(root);
+    CHECK(calls == 1);
+    router.PrintStatistics();
+    printf("unknown types: %zu messages refused\n", sizeof(refused) / sizeof(refused[0]));
+}
+
+static void TestMultipleSubscribers() {
+    MessageRouter router;
+    std::vector<int> order;
+    /* The application, the display and a board module all follow the speech state */
+    for (int subscriber = 0; subscriber < 3; subscriber++) {
+        router.Subscribe("tts", [&order, subscriber](const cJSON* root) {
+            CHECK(cJSON_IsString(cJSON_GetObjectItem(root, "state")));
+            order.push_back(subscriber);
+        });
+    }
+    router.Subscribe("system", [&order](const cJSON*) { order.push_back(100); });
+
+    auto root = Parse(R"({"type":"tts","state":"sentence_start","text":"hi"})");
+    CHECK(router.Dispatch(root));
+    CHECK(router.Dispatch(root));
+    cJSON_Delete(root);
+    CHECK((order == std::vector<int>{0, 1, 2, 0, 1, 2}));
+
+    root = Parse(R"({"type":"system","command":"reboot"})");
+    CHECK(router.Dispatch(root));
+    cJSON_Delete(root);
+    CHECK(order.size() == 7 && order.back() == 100);
+    printf("multiple subscribers: called in subscription order\n");
+}
+
+static void Benchmark() {
+    const char* types[] = {"tts", "stt", "llm", "mcp", "system", "alert", "custom"};
+    MessageRouter router;
+    int64_t sink = 0;
+    for (auto type : types) {
+        router.Subscribe(type, [&sink](const cJSON* root) { sink += cJSON_GetObjectItem(root, "state") != nullptr; });
+    }
+    auto root = Parse(R"({"type":"custom","state":"x","payload":{"a":1}})");
+    const int iterations = 1000000;
+    auto start = HostNowNs();
+    for (int i = 0; i < iterations; i++) {
+        router.Dispatch(root);
+    }
+    double ns = double(HostNowNs() - start) / iterations;
+    cJSON_Delete(root);
+    CHECK(sink == iterations);
+    printf("Dispatch   %.1f ns per message over %zu types\n", ns, sizeof(types) / sizeof(types[0]));
+}
+
+int main() {
+    TestDispatch();
+    TestUnknownTypes();
+    TestMultipleSubscribers();
+    Benchmark();
+    printf("message_router_test passed\n");
+    return 0;
+}
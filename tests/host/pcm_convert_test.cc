@@ -0,0 +1,220 @@
+// NoAudioCodec sample conversion: the kernels must match the loops they replaced bit for bit, the ESP32-S3 vector
+// blocks, run on a model of the PIE lanes, must match the scalar loops, and the micro-benchmark compares their
+// throughput, including the per-call allocation and pow() of the old code.
+#include "host_test.h"
+#include "pcm_convert.h"
+#include "pie_model.h"
+
+#include <cmath>
+#include <random>
+
+// NoAudioCodec::Write before the change, without the I2S write
+static void OldWrite(const int16_t* data, int samples, int output_volume, std::vector<int32_t>& out) {
+    std::vector<int32_t> buffer(samples);
+    int32_t volume_factor = pow(double(output_volume) / 100.0, 2) * 65536;
+    for (int i = 0; i < samples; i++) {
+        int64_t temp = int64_t(data[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            buffer[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            buffer[i] = INT32_MIN;
+        } else {
+            buffer[i] = static_cast<int32_t>(temp);
+        }
+    }
+    out.swap(buffer);
+}
+
+// NoAudioCodec::Read before the change, without the I2S read
+static void OldRead(const int32_t* i2s, int16_t* dest, int samples) {
+    std::vector<int32_t> bit32_buffer(i2s, i2s + samples);
+    for (int i = 0; i < samples; i++) {
+        int32_t value = bit32_buffer[i] >> 12;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+static void TestBitExact() {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> sample16(INT16_MIN, INT16_MAX);
+    std::uniform_int_distribution<int32_t> sample32(INT32_MIN, INT32_MAX);
+
+    std::vector<int16_t> pcm(1027);
+    for (auto& sample : pcm) {
+        sample = sample16(random);
+    }
+    pcm[0] = INT16_MIN;
+    pcm[1] = INT16_MAX;
+    std::vector<int32_t> expected;
+    std::vector<int32_t> actual(pcm.size());
+    for (int volume = 0; volume <= 100; volume++) {
+        OldWrite(pcm.data(), pcm.size(), volume, expected);
+        int32_t factor = pow(double(volume) / 100.0, 2) * 65536;
+        ScalePcm16ToPcm32(pcm.data(), actual.data(), pcm.size(), factor);
+        CHECK(expected == actual);
+    }
+
+    std::vector<int32_t> i2s(1027);
+    for (auto& sample : i2s) {
+        sample = sample32(random);
+    }
+    i2s[0] = INT32_MIN;
+    i2s[1] = INT32_MAX;
+    i2s[2] = (INT16_MAX + 1) << 12;
+    i2s[3] = -(INT16_MAX + 1) * 4096;
+    std::vector<int16_t> old_out(i2s.size());
+    std::vector<int16_t> new_out(i2s.size());
+    OldRead(i2s.data(), old_out.data(), i2s.size());
+    ShiftPcm32ToPcm16(i2s.data(), new_out.data(), i2s.size());
+    CHECK(old_out == new_out);
+}
+
+// ScalePcm16ToPcm32Blocks() and ShiftPcm32ToPcm16Blocks() for one block, instruction by instruction
+static void ScaleBlockModel(const int16_t* src, int32_t* dst, int32_t factor) {
+    int16_t half = int16_t(factor >= 65536 ? 32767 : factor >> 1);
+    int32_t rest = factor - 2 * half;
+    Q q7 = pie::Broadcast16(half);
+    Q q6 = pie::Broadcast16(0);
+    Q q0 = pie::Load(src);
+    Q q1 = pie::VMulS16(q0, q7, 0);
+    Q q2 = pie::VMulS16(q0, q7, 16);
+    pie::VZip16(q1, q2);
+    q1 = pie::VSl32(q1, 1);
+    q2 = pie::VSl32(q2, 1);
+    if (rest != 0) {
+        Q q3 = pie::VCmpLtS16(q0, q6);
+        pie::VZip16(q0, q3);
+        q1 = pie::VAddsS32(q1, q0);
+        q2 = pie::VAddsS32(q2, q3);
+        if (rest >= 2) {
+            q1 = pie::VAddsS32(q1, q0);
+            q2 = pie::VAddsS32(q2, q3);
+        }
+    }
+    pie::Store(dst, q1);
+    pie::Store(dst + 4, q2);
+}
+
+static void ShiftBlockModel(const int32_t* src, int16_t* dst) {
+    Q q6 = pie::Broadcast32(INT16_MAX);
+    Q q7 = pie::Broadcast32(-INT16_MAX);
+    Q q0 = pie::Load(src);
+    Q q1 = pie::Load(src + 4);
+    q0 = pie::VMaxS32(pie::VMinS32(pie::VSr32(q0, 12), q6), q7);
+    q1 = pie::VMaxS32(pie::VMinS32(pie::VSr32(q1, 12), q6), q7);
+    pie::VUnzip16(q0, q1);
+    pie::Store(dst, q0);
+}
+
+// Every 16-bit sample through the vector blocks at the volume steps, the edges of the factor split and random factors
+static void TestVectorBlocks() {
+    std::vector<int16_t> pcm(65536);
+    for (int i = 0; i < 65536; i++) {
+        pcm[i] = int16_t(i - 32768);
+    }
+    std::vector<int32_t> factors = {0, 1, 2, 3, 32766, 32767, 32768, 32769, 65533, 65534, 65535, 65536};
+    for (int volume = 0; volume <= 100; volume++) {
+        factors.push_back(pow(double(volume) / 100.0, 2) * 65536);
+    }
+    std::mt19937 random(3);
+    for (int i = 0; i < 50; i++) {
+        factors.push_back(random() % 65537);
+    }
+    std::vector<int32_t> expected(pcm.size());
+    std::vector<int32_t> actual(pcm.size());
+    for (int32_t factor : factors) {
+        ScalePcm16ToPcm32Scalar(pcm.data(), expected.data(), pcm.size(), factor);
+        for (size_t i = 0; i < pcm.size(); i += PCM_SIMD_BLOCK_SAMPLES) {
+            ScaleBlockModel(pcm.data() + i, actual.data() + i, factor);
+        }
+        CHECK(expected == actual);
+    }
+
+    std::vector<int32_t> i2s(1 << 16);
+    std::uniform_int_distribution<int32_t> sample32(INT32_MIN, INT32_MAX);
+    for (auto& sample : i2s) {
+        sample = sample32(random);
+    }
+    const int32_t edges[] = {INT32_MIN, INT32_MAX, 0, -1, 1, (INT16_MAX + 1) << 12, INT16_MAX << 12,
+        -(INT16_MAX + 1) * 4096, -INT16_MAX * 4096, -INT16_MAX * 4096 - 1, 4095, -4096, -4097};
+    std::copy(std::begin(edges), std::end(edges), i2s.begin());
+    std::vector<int16_t> expected16(i2s.size());
+    std::vector<int16_t> actual16(i2s.size());
+    ShiftPcm32ToPcm16Scalar(i2s.data(), expected16.data(), i2s.size());
+    for (size_t i = 0; i < i2s.size(); i += PCM_SIMD_BLOCK_SAMPLES) {
+        ShiftBlockModel(i2s.data() + i, actual16.data() + i);
+    }
+    CHECK(expected16 == actual16);
+}
+
+// AlignPcm32() lines the scratch buffer up with every alignment of the 16-bit buffer, within the slack
+static void TestAlignment() {
+    alignas(PCM_SIMD_ALIGNMENT) int16_t pcm[PCM_SIMD_BLOCK_SAMPLES * 2];
+    alignas(PCM_SIMD_ALIGNMENT) int32_t scratch[PCM_SIMD_BLOCK_SAMPLES * 2];
+    for (int pcm_offset = 0; pcm_offset < PCM_SIMD_BLOCK_SAMPLES; pcm_offset++) {
+        for (int scratch_offset = 0; scratch_offset < 4; scratch_offset++) {
+            const int16_t* p = pcm + pcm_offset;
+            int32_t* buffer = AlignPcm32(scratch + scratch_offset, p);
+            CHECK(buffer >= scratch + scratch_offset);
+            CHECK(buffer <= scratch + scratch_offset + PCM32_ALIGNMENT_SLACK);
+            int head = PcmSimdHead(p);
+            CHECK(uintptr_t(p + head) % PCM_SIMD_ALIGNMENT == 0);
+            CHECK(uintptr_t(buffer + head) % PCM_SIMD_ALIGNMENT == 0);
+        }
+    }
+}
+
+template <typename Function>
+static double MeasureMsamplesPerSecond(int samples, Function function) {
+    const int iterations = 20000;
+    int64_t start = HostNowNs();
+    for (int i = 0; i < iterations; i++) {
+        function();
+    }
+    double seconds = (HostNowNs() - start) / 1e9;
+    return double(samples) * iterations / seconds / 1e6;
+}
+
+static void Benchmark() {
+    // One DMA frame of the I2S channel, 240 samples at 24 kHz
+    const int samples = 240;
+    std::vector<int16_t> pcm(samples);
+    std::vector<int32_t> i2s(samples);
+    std::mt19937 random(2);
+    for (int i = 0; i < samples; i++) {
+        pcm[i] = int16_t(random());
+        i2s[i] = int32_t(random());
+    }
+    std::vector<int32_t> out32(samples);
+    std::vector<int16_t> out16(samples);
+    volatile int32_t sink = 0;
+
+    double old_write = MeasureMsamplesPerSecond(samples, [&]() {
+        OldWrite(pcm.data(), samples, 70, out32);
+        sink = sink + out32[samples - 1];
+    });
+    int32_t factor = pow(0.7, 2) * 65536;
+    double new_write = MeasureMsamplesPerSecond(samples, [&]() {
+        ScalePcm16ToPcm32(pcm.data(), out32.data(), samples, factor);
+        sink = sink + out32[samples - 1];
+    });
+    double old_read = MeasureMsamplesPerSecond(samples, [&]() {
+        OldRead(i2s.data(), out16.data(), samples);
+        sink = sink + out16[samples - 1];
+    });
+    double new_read = MeasureMsamplesPerSecond(samples, [&]() {
+        ShiftPcm32ToPcm16(i2s.data(), out16.data(), samples);
+        sink = sink + out16[samples - 1];
+    });
+    printf("Write 16 -> 32: old %8.1f Msamples/s  new %8.1f Msamples/s  (x%.1f)\n", old_write, new_write, new_write / old_write);
+    printf("Read  32 -> 16: old %8.1f Msamples/s  new %8.1f Msamples/s  (x%.1f)\n", old_read, new_read, new_read / old_read);
+}
+
+int main() {
+    TestBitExact();
+    TestVectorBlocks();
+    TestAlignment();
+    Benchmark();
+    printf("pcm_convert_test passed\n");
+    return 0;
+}
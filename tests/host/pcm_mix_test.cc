@@ -0,0 +1,138 @@
+// Playback mixer kernels: the ESP32-S3 vector blocks, run on a model of the PIE lanes with the head and tail split
+// of the dispatch, must match the scalar loops at every alignment and gain, without reading past the input, and
+// the micro-benchmark reports the throughput of the kernels the host runs.
+#include "host_test.h"
+#include "pcm_mix.h"
+#include "pie_model.h"
+
+#include <random>
+#include <vector>
+
+// ScalePcmBlocks() and MixPcmBlocks() instruction by instruction, `end` is the end of the input buffer
+static void GainBlocksModel(int16_t* out, const int16_t* in, int blocks, int32_t gain, bool mix, const int16_t* end) {
+    int16_t multiplier;
+    int32_t shift;
+    PcmMixMultiplier(gain, multiplier, shift);
+    Q q7 = pie::Broadcast16(multiplier);
+    int sar_byte;
+    Q q0 = pie::LoadUsar(in, sar_byte);
+    in += 8;
+    for (int b = 0; b < blocks; b++) {
+        /* The aligned block the load reads must hold a sample of the input */
+        CHECK(uintptr_t(in) / PCM_MIX_ALIGNMENT * PCM_MIX_ALIGNMENT < uintptr_t(end));
+        Q q1 = pie::LoadUsar(in, sar_byte);
+        in += 8;
+        Q q2 = pie::SrcQ(q0, q1, sar_byte);
+        q0 = q1;
+        Q q3 = pie::VMulS16(q2, q7, shift);
+        if (mix) {
+            q3 = pie::VAddsS16(pie::Load(out), q3);
+        }
+        pie::Store(out, q3);
+        out += 8;
+    }
+}
+
+// ScalePcm() and MixPcm() as the ESP32-S3 build runs them
+static void GainModel(int16_t* out, const int16_t* in, size_t samples, int32_t gain, bool mix) {
+    size_t head;
+    int blocks;
+    PcmMixSplit(out, samples, head, blocks);
+    auto scalar = mix ? MixPcmScalar : ScalePcmScalar;
+    if (blocks == 0) {
+        scalar(out, in, samples, gain);
+        return;
+    }
+    scalar(out, in, head, gain);
+    CHECK(uintptr_t(out + head) % PCM_MIX_ALIGNMENT == 0);
+    GainBlocksModel(out + head, in + head, blocks, gain, mix, in + samples);
+    size_t done = head + blocks * PCM_MIX_BLOCK_SAMPLES;
+    scalar(out + done, in + done, samples - done, gain);
+}
+
+static void TestVectorBlocks() {
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> sample(-32768, 32767);
+    std::uniform_int_distribution<int32_t> random_gain(0, 32768);
+    std::vector<int32_t> gains = {0, 1, 2, 16383, 16384, 32767, 32768};
+    for (int i = 0; i < 40; i++) {
+        gains.push_back(random_gain(random));
+    }
+    for (int percent = 0; percent <= 100; percent += 5) {
+        gains.push_back(percent * 32768 / 100);
+    }
+
+    const size_t max_samples = 100;
+    alignas(16) int16_t in_storage[max_samples + 16];
+    alignas(16) int16_t out_storage[max_samples + 16];
+    alignas(16) int16_t expected_storage[max_samples + 16];
+    for (int32_t gain : gains) {
+        for (bool mix : {false, true}) {
+            for (int in_offset = 0; in_offset < 8; in_offset++) {
+                for (int out_offset = 0; out_offset < 8; out_offset++) {
+                    for (size_t samples : {size_t(1), size_t(8), size_t(17), size_t(24), max_samples - 7, max_samples}) {
+                        int16_t* in = in_storage + in_offset;
+                        int16_t* out = out_storage + out_offset;
+                        int16_t* expected = expected_storage + out_offset;
+                        for (size_t i = 0; i < samples; i++) {
+                            /* Full scale samples on both sides saturate the mix both ways */
+                            in[i] = i < 4 ? (i % 2 ? 32767 : -32768) : sample(random);
+                            out[i] = i < 4 ? (i < 2 ? 32767 : -32768) : sample(random);
+                            expected[i] = out[i];
+                        }
+                        if (mix) {
+                            MixPcmScalar(expected, in, samples, gain);
+                        } else {
+                            ScalePcmScalar(expected, in, samples, gain);
+                        }
+                        GainModel(out, in, samples, gain, mix);
+                        for (size_t i = 0; i < samples; i++) {
+                            CHECK(out[i] == expected[i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("vector blocks match the scalar loops for %zu gains\n", gains.size());
+}
+
+static void Benchmark() {
+    // A 60 ms frame at 24 kHz, the mixer output
+    const size_t samples = 1440;
+    const int iterations = 20000;
+    std::vector<int16_t> in(samples);
+    std::vector<int16_t> out(samples);
+    std::mt19937 random(8);
+    std::uniform_int_distribution<int> sample(-32768, 32767);
+    for (auto& value : in) {
+        value = sample(random);
+    }
+    struct Kernel {
+        const char* name;
+        void (*run)(int16_t*, const int16_t*, size_t, int32_t);
+    };
+    const Kernel kernels[] = {{"ScalePcm", ScalePcm}, {"MixPcm", MixPcm}};
+    for (auto& kernel : kernels) {
+        int64_t sink = 0;
+        auto start = HostNowNs();
+        for (int i = 0; i < iterations; i++) {
+            kernel.run(out.data(), in.data(), samples, 13107);
+            sink += out[i % samples];
+        }
+        double ns_per_frame = double(HostNowNs() - start) / iterations;
+        printf("%-10s %.2f us per 60 ms frame%s\n", kernel.name, ns_per_frame / 1000, sink == 1 ? " " : "");
+    }
+    auto start = HostNowNs();
+    for (int i = 0; i < iterations; i++) {
+        MixPcmRamp(out.data(), in.data(), samples, 32768, 13107);
+    }
+    printf("%-10s %.2f us per 60 ms frame\n", "MixPcmRamp", double(HostNowNs() - start) / iterations / 1000);
+}
+
+int main() {
+    TestVectorBlocks();
+    Benchmark();
+    printf("pcm_mix_test passed\n");
+    return 0;
+}
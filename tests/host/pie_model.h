@@ -0,0 +1,157 @@
+#ifndef PIE_MODEL_H
+#define PIE_MODEL_H
+
+// A lane by lane model of the ESP32-S3 PIE instructions the audio kernels use, so the host tests can run the
+// instruction sequence of a vector block and compare it with the scalar loop it replaces. Only the arithmetic
+// is modeled, not the timing. Functions are named after the instructions.
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// A 128-bit register as 16-bit lanes, the 32-bit lanes are pairs of them, low half first
+struct Q {
+    uint16_t h[8];
+
+    int32_t Word(int i) const { return int32_t(uint32_t(h[2 * i]) | uint32_t(h[2 * i + 1]) << 16); }
+    void SetWord(int i, int32_t value) {
+        h[2 * i] = uint16_t(value);
+        h[2 * i + 1] = uint16_t(uint32_t(value) >> 16);
+    }
+};
+
+namespace pie {
+
+// ee.vld.128.ip, the address is 16-byte aligned
+static inline Q Load(const void* p) {
+    Q q;
+    memcpy(q.h, p, sizeof(q.h));
+    return q;
+}
+
+static inline void Store(void* p, const Q& q) {
+    memcpy(p, q.h, sizeof(q.h));
+}
+
+// ee.ld.128.usar.ip: the aligned block holding the address, SAR_BYTE is the offset into it
+static inline Q LoadUsar(const void* p, int& sar_byte) {
+    sar_byte = int(uintptr_t(p) % 16);
+    return Load((const void*)(uintptr_t(p) - sar_byte));
+}
+
+// ee.src.q: qs1:qs0 shifted right by SAR_BYTE bytes, the unaligned block between two aligned ones
+static inline Q SrcQ(const Q& qs0, const Q& qs1, int sar_byte) {
+    uint8_t bytes[32];
+    memcpy(bytes, qs0.h, 16);
+    memcpy(bytes + 16, qs1.h, 16);
+    Q q;
+    memcpy(q.h, bytes + sar_byte, 16);
+    return q;
+}
+
+// ee.vldbc.16 / ee.vldbc.32
+static inline Q Broadcast16(int16_t value) {
+    Q q;
+    for (auto& lane : q.h) {
+        lane = uint16_t(value);
+    }
+    return q;
+}
+
+static inline Q Broadcast32(int32_t value) {
+    Q q;
+    for (int i = 0; i < 4; i++) {
+        q.SetWord(i, value);
+    }
+    return q;
+}
+
+static inline int16_t Lane16(const Q& q, int i) {
+    return int16_t(q.h[i]);
+}
+
+template <typename Operation>
+static inline Q Map16(const Q& x, const Q& y, Operation operation) {
+    Q q;
+    for (int i = 0; i < 8; i++) {
+        q.h[i] = uint16_t(operation(Lane16(x, i), Lane16(y, i)));
+    }
+    return q;
+}
+
+template <typename Operation>
+static inline Q Map32(const Q& x, const Q& y, Operation operation) {
+    Q q;
+    for (int i = 0; i < 4; i++) {
+        q.SetWord(i, operation(x.Word(i), y.Word(i)));
+    }
+    return q;
+}
+
+// ee.vmul.s16: the low 16 bits of the product shifted right by SAR
+static inline Q VMulS16(const Q& x, const Q& y, int sar) {
+    return Map16(x, y, [sar](int32_t a, int32_t b) { return (a * b) >> sar; });
+}
+
+static inline Q VAddsS16(const Q& x, const Q& y) {
+    return Map16(x, y, [](int32_t a, int32_t b) { return std::clamp(a + b, -32768, 32767); });
+}
+
+static inline Q VCmpLtS16(const Q& x, const Q& y) {
+    return Map16(x, y, [](int32_t a, int32_t b) { return a < b ? -1 : 0; });
+}
+
+// ee.vzip.16 qs0, qs1: the lanes interleaved, the low half of the result to qs0
+static inline void VZip16(Q& a, Q& b) {
+    uint16_t e[16];
+    for (int i = 0; i < 8; i++) {
+        e[2 * i] = a.h[i];
+        e[2 * i + 1] = b.h[i];
+    }
+    memcpy(a.h, e, sizeof(a.h));
+    memcpy(b.h, e + 8, sizeof(b.h));
+}
+
+// ee.vunzip.16 qs0, qs1: the even lanes of qs0:qs1 to qs0, the odd ones to qs1
+static inline void VUnzip16(Q& a, Q& b) {
+    uint16_t e[16];
+    memcpy(e, a.h, sizeof(a.h));
+    memcpy(e + 8, b.h, sizeof(b.h));
+    for (int i = 0; i < 8; i++) {
+        a.h[i] = e[2 * i];
+        b.h[i] = e[2 * i + 1];
+    }
+}
+
+static inline Q VSl32(const Q& x, int sar) {
+    return Map32(x, x, [sar](int32_t a, int32_t) { return int32_t(uint32_t(a) << sar); });
+}
+
+static inline Q VSr32(const Q& x, int sar) {
+    return Map32(x, x, [sar](int32_t a, int32_t) { return a >> sar; });
+}
+
+static inline Q VAddsS32(const Q& x, const Q& y) {
+    return Map32(x, y, [](int32_t a, int32_t b) {
+        return int32_t(std::clamp<int64_t>(int64_t(a) + b, INT32_MIN, INT32_MAX));
+    });
+}
+
+static inline Q VMinS32(const Q& x, const Q& y) {
+    return Map32(x, y, [](int32_t a, int32_t b) { return std::min(a, b); });
+}
+
+static inline Q VMaxS32(const Q& x, const Q& y) {
+    return Map32(x, y, [](int32_t a, int32_t b) { return std::max(a, b); });
+}
+
+// ee.vmulas.s16.accx: the 8 products added to the 40-bit ACCX, rur.accx_0 reads its low 32 bits
+static inline void VMulasS16Accx(int64_t& accx, const Q& x, const Q& y) {
+    for (int i = 0; i < 8; i++) {
+        accx += int32_t(Lane16(x, i)) * Lane16(y, i);
+    }
+    accx = (accx << 24) >> 24;
+}
+
+} // namespace pie
+
+#endif // PIE_MODEL_H
@@ -0,0 +1,301 @@
+// Polyphase resampler: SNR of in-band tones against an ideal sine at the output rate, rejection of the tones
+// the output rate cannot carry, chunking and channel independence, the ESP32-S3 vector dot products against the
+// scalar ones, and the throughput per 60 ms frame.
+#include "host_test.h"
+#include "pie_model.h"
+#include "polyphase_resampler.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+struct RatePair {
+    int input;
+    int output;
+};
+
+static const RatePair kRatePairs[] = {
+    {24000, 16000}, {16000, 24000}, {48000, 16000}, {16000, 48000}, {32000, 16000}, {16000, 32000},
+};
+
+static std::vector<int16_t> Tone(double frequency, int sample_rate, size_t frames, int channels, double amplitude) {
+    std::vector<int16_t> pcm(frames * channels);
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+            // Every channel gets its own phase, so a channel mixup shows up as noise
+            double phase = 2 * M_PI * frequency * i / sample_rate + c * 0.7;
+            pcm[i * channels + c] = int16_t(lround(amplitude * 32767 * sin(phase)));
+        }
+    }
+    return pcm;
+}
+
+// Feeds the input in chunks of the given frame counts (cycled), checking GetOutputSamples() on every call
+static std::vector<int16_t> Resample(Resampler& resampler, const std::vector<int16_t>& input, int channels,
+    const std::vector<size_t>& chunk_frames) {
+    std::vector<int16_t> output;
+    size_t offset = 0;
+    for (size_t i = 0; offset < input.size(); i++) {
+        size_t samples = std::min(chunk_frames[i % chunk_frames.size()] * channels, input.size() - offset);
+        size_t expected = resampler.GetOutputSamples(samples);
+        std::vector<int16_t> chunk(expected);
+        size_t produced = resampler.Process(input.data() + offset, samples, chunk.data());
+        CHECK(produced == expected);
+        output.insert(output.end(), chunk.begin(), chunk.end());
+        offset += samples;
+    }
+    return output;
+}
+
+struct ToneFit {
+    double gain;    // Amplitude of the fitted sine relative to the input amplitude
+    double snr_db;  // Fitted sine against everything else
+};
+
+/*
+ * Least squares fit of a sine of the tone frequency to one channel of the output, after the filter has
+ * settled. The fit absorbs the filter delay and phase, the residual is the noise and distortion.
+ */
+static ToneFit FitTone(const std::vector<int16_t>& output, int channel, int channels, double frequency,
+    int sample_rate, double amplitude) {
+    size_t frames = output.size() / channels;
+    size_t start = sample_rate / 50;
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+    for (size_t i = start; i < frames; i++) {
+        double phase = 2 * M_PI * frequency * i / sample_rate;
+        double s = sin(phase);
+        double c = cos(phase);
+        double y = output[i * channels + channel];
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+    }
+    double determinant = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / determinant;
+    double b = (yc * ss - ys * sc) / determinant;
+
+    double signal = 0, noise = 0;
+    for (size_t i = start; i < frames; i++) {
+        double phase = 2 * M_PI * frequency * i / sample_rate;
+        double fitted = a * sin(phase) + b * cos(phase);
+        double residual = output[i * channels + channel] - fitted;
+        signal += fitted * fitted;
+        noise += residual * residual;
+    }
+    ToneFit fit;
+    fit.gain = sqrt(a * a + b * b) / (amplitude * 32767);
+    fit.snr_db = 10 * log10(signal / std::max(noise, 1e-9));
+    return fit;
+}
+
+static double Rms(const std::vector<int16_t>& pcm, size_t skip) {
+    double sum = 0;
+    for (size_t i = skip; i < pcm.size(); i++) {
+        sum += double(pcm[i]) * pcm[i];
+    }
+    return sqrt(sum / std::max<size_t>(pcm.size() - skip, 1));
+}
+
+static void TestPassband() {
+    const double amplitude = 0.5;
+    for (auto& rates : kRatePairs) {
+        int lower = std::min(rates.input, rates.output);
+        for (int channels : {1, 2, 3}) {
+            double worst_snr = 1000;
+            for (double frequency : {200.0, 1000.0, 3000.0, 0.3 * lower}) {
+                auto resampler = CreatePolyphaseResampler(rates.input, rates.output, channels);
+                CHECK(resampler != nullptr);
+                auto input = Tone(frequency, rates.input, rates.input, channels, amplitude);
+                auto output = Resample(*resampler, input, channels, {size_t(rates.input * 60 / 1000)});
+                CHECK(output.size() / channels + 1 >= size_t(rates.output) - 1);
+                for (int c = 0; c < channels; c++) {
+                    auto fit = FitTone(output, c, channels, frequency, rates.output, amplitude);
+                    CHECK(fabs(20 * log10(fit.gain)) < 0.1);
+                    CHECK(fit.snr_db > 75);
+                    worst_snr = std::min(worst_snr, fit.snr_db);
+                }
+            }
+            printf("%5d -> %5d Hz, %d channel(s): worst in-band SNR %.1f dB\n", rates.input, rates.output, channels,
+                worst_snr);
+        }
+    }
+}
+
+static void TestStopband() {
+    // Above the output Nyquist frequency when downsampling, above the input one (images) when upsampling
+    const double amplitude = 0.5;
+    for (auto& rates : kRatePairs) {
+        int lower = std::min(rates.input, rates.output);
+        auto resampler = CreatePolyphaseResampler(rates.input, rates.output, 1);
+        double frequency = 0.6 * lower;
+        double rms;
+        if (rates.input > rates.output) {
+            auto input = Tone(frequency, rates.input, rates.input, 1, amplitude);
+            rms = Rms(Resample(*resampler, input, 1, {size_t(rates.input * 60 / 1000)}), rates.output / 50);
+        } else {
+            // Upsampling a tone near the input Nyquist frequency, the output above it must be the tone alone
+            auto input = Tone(0.4 * lower, rates.input, rates.input, 1, amplitude);
+            auto output = Resample(*resampler, input, 1, {size_t(rates.input * 60 / 1000)});
+            auto fit = FitTone(output, 0, 1, 0.4 * lower, rates.output, amplitude);
+            rms = amplitude * 32767 / sqrt(2) / pow(10, fit.snr_db / 20);
+        }
+        double attenuation_db = 20 * log10(amplitude * 32767 / sqrt(2) / std::max(rms, 1e-9));
+        printf("%5d -> %5d Hz: %.0f Hz rejected by %.1f dB\n", rates.input, rates.output,
+            rates.input > rates.output ? frequency : rates.input - 0.4 * lower, attenuation_db);
+        CHECK(attenuation_db > 60);
+    }
+}
+
+static void TestChunkingAndReset() {
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> sample(-20000, 20000);
+    std::uniform_int_distribution<size_t> chunk_size(1, 2000);
+    for (auto& rates : kRatePairs) {
+        for (int channels : {1, 2}) {
+            std::vector<int16_t> input(rates.input / 2 * channels);
+            for (auto& value : input) {
+                value = sample(random);
+            }
+            std::vector<size_t> random_chunks(31);
+            for (auto& size : random_chunks) {
+                size = chunk_size(random);
+            }
+
+            auto resampler = CreatePolyphaseResampler(rates.input, rates.output, channels);
+            auto whole = Resample(*resampler, input, channels, {input.size()});
+            resampler->Reset();
+            CHECK(Resample(*resampler, input, channels, random_chunks) == whole);
+            resampler->Reset();
+            CHECK(Resample(*resampler, input, channels, {1}) == whole);
+        }
+    }
+    CHECK(CreatePolyphaseResampler(44100, 16000, 1) == nullptr);
+    CHECK(CreatePolyphaseResampler(16000, 16000, 1) == nullptr);
+    CHECK(CreatePolyphaseResampler(24000, 16000, 0) == nullptr);
+}
+
+// The instruction sequence of DotMonoBlocks() on the PIE model
+static int32_t DotMonoBlocksModel(const int16_t* h, const int16_t* x, int blocks) {
+    int64_t accx = 0;
+    int sar_byte;
+    Q q0 = pie::LoadUsar(x, sar_byte);
+    x += 8;
+    for (int b = 0; b < blocks; b++) {
+        Q q1 = pie::LoadUsar(x, sar_byte);
+        x += 8;
+        Q q2 = pie::Load(h);
+        h += 8;
+        Q q3 = pie::SrcQ(q0, q1, sar_byte);
+        q0 = q1;
+        pie::VMulasS16Accx(accx, q3, q2);
+    }
+    return int32_t(accx);
+}
+
+// The instruction sequence of DotStereoBlocks() on the PIE model
+static int32_t DotStereoBlocksModel(const int16_t* h, const int16_t* x, int blocks) {
+    int64_t accx = 0;
+    int sar_byte;
+    Q q0 = pie::LoadUsar(x, sar_byte);
+    x += 8;
+    for (int b = 0; b < blocks; b++) {
+        Q q1 = pie::LoadUsar(x, sar_byte);
+        x += 8;
+        Q q3 = pie::SrcQ(q0, q1, sar_byte);
+        q0 = q1;
+        q1 = pie::LoadUsar(x, sar_byte);
+        x += 8;
+        Q q4 = pie::SrcQ(q0, q1, sar_byte);
+        q0 = q1;
+        pie::VUnzip16(q3, q4);
+        Q q2 = pie::Load(h);
+        h += 8;
+        pie::VMulasS16Accx(accx, q3, q2);
+    }
+    return int32_t(accx);
+}
+
+/*
+ * Every phase of the filter on windows at every sample offset from a 16-byte boundary, random samples and
+ * full scale ones matching the sign of the taps, which give the largest sums the filter allows.
+ */
+template <int L, int M>
+static void TestVectorBlocks(std::mt19937& random) {
+    using namespace polyphase_resampler;
+    constexpr int kTaps = Filter<L, M>::kTaps;
+    const auto& filter = kFilter<L, M>;
+    CHECK(uintptr_t(filter.coefficients) % 16 == 0);
+    std::uniform_int_distribution<int> sample(-32768, 32767);
+    // The window, at most 7 samples in, and the padding the loads may read
+    alignas(16) int16_t window[2 * kTaps + 8 + POLYPHASE_RESAMPLER_PADDING];
+    for (int p = 0; p < L; p++) {
+        const int16_t* h = filter.coefficients[p];
+        CHECK(uintptr_t(h) % 16 == 0);
+        for (int trial = 0; trial < 40; trial++) {
+            for (int offset = 0; offset < 8; offset++) {
+                for (auto& value : window) {
+                    value = sample(random);
+                }
+                if (trial < 4) {
+                    /* Full scale with the sign of the taps or against it, the mono window then both channels */
+                    for (int j = 0; j < kTaps; j++) {
+                        int16_t value = (h[j] < 0) == (trial % 2 == 0) ? -32768 : 32767;
+                        if (trial < 2) {
+                            window[offset + j] = value;
+                        } else {
+                            window[offset + 2 * j] = value;
+                            window[offset + 2 * j + 1] = value;
+                        }
+                    }
+                }
+                const int16_t* x = window + offset;
+                CHECK(DotMonoBlocksModel(h, x, kTaps / 8) == DotMono<kTaps>(h, x));
+                CHECK(DotStereoBlocksModel(h, x, kTaps / 8) == DotStereo<kTaps>(h, x));
+                CHECK(DotStereoBlocksModel(h, x + 1, kTaps / 8) == DotStereo<kTaps>(h, x + 1));
+            }
+        }
+    }
+}
+
+static void TestVectorDotProducts() {
+    std::mt19937 random(5);
+    TestVectorBlocks<2, 3>(random);
+    TestVectorBlocks<3, 2>(random);
+    TestVectorBlocks<1, 3>(random);
+    TestVectorBlocks<3, 1>(random);
+    TestVectorBlocks<1, 2>(random);
+    TestVectorBlocks<2, 1>(random);
+    printf("vector dot products match the scalar ones\n");
+}
+
+static void Benchmark() {
+    const int iterations = 2000;
+    for (auto& rates : kRatePairs) {
+        for (int channels : {1, 2}) {
+            auto resampler = CreatePolyphaseResampler(rates.input, rates.output, channels);
+            auto input = Tone(1000, rates.input, rates.input * 60 / 1000, channels, 0.5);
+            std::vector<int16_t> output(resampler->GetOutputSamples(input.size()) + channels);
+            int64_t sink = 0;
+            auto start = HostNowNs();
+            for (int i = 0; i < iterations; i++) {
+                resampler->Process(input.data(), input.size(), output.data());
+                sink += output[0];
+            }
+            double ns_per_frame = double(HostNowNs() - start) / iterations;
+            printf("%5d -> %5d Hz, %d channel(s): %.1f us per 60 ms frame, %.0fx realtime%s\n", rates.input,
+                rates.output, channels, ns_per_frame / 1000, 60e6 / ns_per_frame, sink == 1 ? " " : "");
+        }
+    }
+}
+
+int main() {
+    TestPassband();
+    TestStopband();
+    TestChunkingAndReset();
+    TestVectorDotProducts();
+    Benchmark();
+    printf("polyphase_resampler_test passed\n");
+    return 0;
+}
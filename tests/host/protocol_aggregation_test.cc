@@ -0,0 +1,200 @@
+// Protocol frame aggregation: uplink frames, with or without headroom, packed into size-prefixed messages and
+// unpacked by ReceiveAudio() back into the same frames, the flush timer on the simulated clock, and the flushes
+// before the listen messages.
+#include "host_test.h"
+#include "protocol.h"
+
+#include <string>
+
+// Records the messages a transport would send, in order
+class TestProtocol : public Protocol {
+public:
+    struct Message {
+        std::unique_ptr<AudioStreamPacket> packet;  // nullptr for a text message
+        int frames = 0;
+        std::string text;
+    };
+    std::vector<Message> messages;
+
+    bool Start() override { return true; }
+    bool OpenAudioChannel() override { return true; }
+    void CloseAudioChannel() override {}
+    bool IsAudioChannelOpened() const override { return true; }
+
+    using Protocol::SetFramesPerPacket;
+    using Protocol::ReceiveAudio;
+
+protected:
+    // The packet is only borrowed, keep a copy
+    bool SendAudioMessage(AudioStreamPacket& packet, int frames) override {
+        messages.push_back({std::make_unique<AudioStreamPacket>(packet), frames, ""});
+        return true;
+    }
+    bool SendText(const std::string& text) override {
+        messages.push_back({nullptr, 0, text});
+        return true;
+    }
+};
+
+static std::unique_ptr<AudioStreamPacket> MakeFrame(uint32_t index, int frame_duration) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = 16000;
+    packet->frame_duration = frame_duration;
+    packet->timestamp = 5000 + index * frame_duration;
+    packet->origin_time = esp_timer_get_time();
+    // Sizes around the Opus frames of a few hundred bytes, one above 255 to use both size bytes
+    packet->payload.resize(index % 5 == 4 ? 300 : 20 + index * 7);
+    for (size_t i = 0; i < packet->payload.size(); i++) {
+        packet->payload[i] = uint8_t(index * 31 + i);
+    }
+    return packet;
+}
+
+// The frame as the encoder writes it, behind the headroom
+static AudioStreamPacket WithHeadroom(const AudioStreamPacket& frame) {
+    AudioStreamPacket packet = frame;
+    packet.payload.assign(AUDIO_PACKET_HEADROOM, 0xEE);
+    packet.payload.insert(packet.payload.end(), frame.payload.begin(), frame.payload.end());
+    packet.headroom = AUDIO_PACKET_HEADROOM;
+    return packet;
+}
+
+static void TestSingleFrames() {
+    TestProtocol protocol;
+    protocol.SetFramesPerPacket(1);
+    for (uint32_t i = 0; i < 3; i++) {
+        auto frame = MakeFrame(i, 60);
+        CHECK(protocol.SendAudio(*frame));
+        CHECK(protocol.messages.size() == i + 1);
+        CHECK(protocol.messages.back().frames == 1);
+        CHECK(protocol.messages.back().packet->payload == frame->payload);
+    }
+}
+
+// Packs the frames of the given duration, flushes the rest on the timer and unpacks every message
+static void TestRoundTrip(int frame_duration, int frames_per_packet, int expected_frames_per_message) {
+    TestProtocol sender;
+    int flush_requests = 0;
+    sender.OnAudioFlushNeeded([&]() {
+        flush_requests++;
+        // Application schedules this on the main task, the test has no other task
+        sender.FlushAudio();
+    });
+    sender.SetFramesPerPacket(frames_per_packet);
+
+    const uint32_t count = 3 * expected_frames_per_message + 1;
+    std::vector<std::unique_ptr<AudioStreamPacket>> originals;
+    for (uint32_t i = 0; i < count; i++) {
+        originals.push_back(MakeFrame(i, frame_duration));
+        if (i % 2 == 0) {
+            auto packet = WithHeadroom(*originals.back());
+            CHECK(sender.SendAudio(packet));
+        } else {
+            CHECK(sender.SendAudio(*originals.back()));
+        }
+        HostAdvanceTime(frame_duration * 1000);
+    }
+    // The timer fires only for the last, incomplete message
+    CHECK(sender.messages.size() == 3);
+    HostAdvanceTime(AUDIO_AGGREGATION_MAX_DELAY_MS * 1000);
+    CHECK(flush_requests == 1);
+    CHECK(sender.messages.size() == 4);
+    CHECK(sender.messages.back().frames == 1);
+
+    TestProtocol receiver;
+    receiver.SetFramesPerPacket(frames_per_packet);
+    std::vector<std::unique_ptr<AudioStreamPacket>> received;
+    receiver.OnIncomingAudio([&](std::unique_ptr<AudioStreamPacket> packet) {
+        received.push_back(std::move(packet));
+    });
+
+    uint32_t sequence = 1;
+    for (size_t m = 0; m < sender.messages.size(); m++) {
+        auto& message = sender.messages[m];
+        CHECK(message.packet != nullptr);
+        int frames = m < 3 ? expected_frames_per_message : 1;
+        CHECK(message.frames == frames);
+        // The message carries the timestamp of its first frame, and a 2 byte size before every frame
+        auto& first = originals[m * expected_frames_per_message];
+        CHECK(message.packet->timestamp == first->timestamp);
+        size_t size = 0;
+        for (int f = 0; f < frames; f++) {
+            size += 2 + originals[m * expected_frames_per_message + f]->payload.size();
+        }
+        CHECK(message.packet->size() == size);
+        CHECK(message.packet->data()[0] == first->payload.size() >> 8);
+        CHECK(message.packet->data()[1] == (first->payload.size() & 0xFF));
+        // Packed behind the headroom, the transport frames the message in place
+        CHECK(message.packet->headroom == AUDIO_PACKET_HEADROOM);
+        CHECK(FrameBinaryProtocol2(*message.packet) != nullptr);
+
+        // The transport stamps the sequence of the first frame
+        message.packet->sequence = sequence;
+        message.packet->has_sequence = true;
+        CHECK(receiver.ReceiveAudio(std::move(message.packet)) == frames);
+        sequence += frames;
+    }
+
+    CHECK(received.size() == originals.size());
+    for (size_t i = 0; i < originals.size(); i++) {
+        CHECK(received[i]->payload == originals[i]->payload);
+        CHECK(received[i]->timestamp == originals[i]->timestamp);
+        CHECK(received[i]->sequence == i + 1);
+        CHECK(received[i]->frame_duration == frame_duration);
+        CHECK(received[i]->sample_rate == 16000);
+    }
+    printf("%d ms frames, %d per packet: %u frames in %zu messages, 2 bytes of framing per frame\n", frame_duration,
+        frames_per_packet, (unsigned)count, sender.messages.size());
+}
+
+static void TestTruncatedMessage() {
+    TestProtocol receiver;
+    receiver.SetFramesPerPacket(4);
+    int received = 0;
+    receiver.OnIncomingAudio([&](std::unique_ptr<AudioStreamPacket>) { received++; });
+
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->frame_duration = 60;
+    packet->payload = {0, 3, 1, 2, 3, 0, 10, 1, 2};
+    CHECK(receiver.ReceiveAudio(std::move(packet)) == 1);
+    CHECK(received == 1);
+}
+
+static void TestFlushBeforeListenMessages() {
+    TestProtocol protocol;
+    protocol.SetFramesPerPacket(4);
+    CHECK(protocol.SendAudio(*MakeFrame(0, 60)));
+    CHECK(protocol.SendAudio(*MakeFrame(1, 60)));
+    CHECK(protocol.messages.empty());
+    protocol.SendWakeWordDetected("hi");
+    CHECK(protocol.messages.size() == 2);
+    CHECK(protocol.messages[0].frames == 2);
+    CHECK(protocol.messages[1].text.find("\"state\":\"detect\"") != std::string::npos);
+
+    CHECK(protocol.SendAudio(*MakeFrame(2, 60)));
+    protocol.SendStopListening();
+    CHECK(protocol.messages.size() == 4);
+    CHECK(protocol.messages[2].frames == 1);
+    CHECK(protocol.messages[3].text.find("\"state\":\"stop\"") != std::string::npos);
+
+    // Nothing left to flush, the timer was stopped with the flushes
+    int flush_requests = 0;
+    protocol.OnAudioFlushNeeded([&]() { flush_requests++; });
+    HostAdvanceTime(AUDIO_AGGREGATION_MAX_DELAY_MS * 2000);
+    CHECK(flush_requests == 0);
+    CHECK(protocol.FlushAudio());
+    CHECK(protocol.messages.size() == 4);
+}
+
+int main() {
+    TestSingleFrames();
+    // 180 ms budget: 3 frames of 60 ms; 20 ms frames are capped by CONFIG_AUDIO_FRAMES_PER_PACKET (4)
+    TestRoundTrip(60, 4, 3);
+    TestRoundTrip(20, 4, 4);
+    TestRoundTrip(20, 10, 4);
+    TestRoundTrip(60, 2, 2);
+    TestTruncatedMessage();
+    TestFlushBeforeListenMessages();
+    printf("protocol_aggregation_test passed\n");
+    return 0;
+}
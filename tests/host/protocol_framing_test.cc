@@ -0,0 +1,194 @@
+// Websocket binary protocol framing: the v2 and v3 messages, framed in the packet headroom or copied for packets
+// without it, must match the per-packet strings they replaced byte for byte, and the benchmark counts the heap
+// allocations, the bytes copied and the time per frame.
+#include "host_test.h"
+#include "protocol.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <random>
+
+static std::atomic<uint64_t> heap_allocations{0};
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// WebsocketProtocol::SendAudio before the change, without the websocket send
+static std::string OldSerialize2(const AudioStreamPacket& packet) {
+    std::string serialized;
+    serialized.resize(sizeof(BinaryProtocol2) + packet.payload.size());
+    auto bp2 = (BinaryProtocol2*)serialized.data();
+    bp2->version = htons(2);
+    bp2->type = 0;
+    bp2->reserved = 0;
+    bp2->timestamp = htonl(packet.timestamp);
+    bp2->payload_size = htonl(packet.payload.size());
+    memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
+    return serialized;
+}
+
+static std::string OldSerialize3(const AudioStreamPacket& packet) {
+    std::string serialized;
+    serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
+    auto bp3 = (BinaryProtocol3*)serialized.data();
+    bp3->type = 0;
+    bp3->reserved = 0;
+    bp3->payload_size = htons(packet.payload.size());
+    memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
+    return serialized;
+}
+
+// Opus frames of 60 ms at 16 kHz, a few hundred bytes, behind the given headroom
+static std::vector<AudioStreamPacket> MakePackets(size_t count, size_t headroom) {
+    std::mt19937 random(5);
+    std::uniform_int_distribution<int> size(40, 400);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<AudioStreamPacket> packets(count);
+    for (size_t i = 0; i < count; i++) {
+        packets[i].timestamp = uint32_t(i * 60 + 0x12345600);
+        packets[i].headroom = headroom;
+        packets[i].payload.resize(headroom + size(random));
+        for (auto& value : packets[i].payload) {
+            value = uint8_t(byte(random));
+        }
+    }
+    return packets;
+}
+
+// The payload without the headroom, as the transport had it before
+static AudioStreamPacket WithoutHeadroom(const AudioStreamPacket& packet) {
+    AudioStreamPacket copy = packet;
+    copy.payload.assign(packet.data(), packet.data() + packet.size());
+    copy.headroom = 0;
+    return copy;
+}
+
+static void TestLayout() {
+    auto packets = MakePackets(200, 0);
+    std::string buffer;
+    for (auto& packet : packets) {
+        size_t n = packet.payload.size();
+        CHECK(FrameBinaryProtocol2(packet) == nullptr);
+        CHECK(FrameBinaryProtocol3(packet) == nullptr);
+
+        SerializeBinaryProtocol2(packet, buffer);
+        CHECK(buffer == OldSerialize2(packet));
+        auto bytes = (const uint8_t*)buffer.data();
+        CHECK(buffer.size() == 16 + n);
+        CHECK(bytes[0] == 0 && bytes[1] == 2);
+        CHECK(bytes[2] == 0 && bytes[3] == 0);
+        CHECK(bytes[8] == uint8_t(packet.timestamp >> 24) && bytes[11] == uint8_t(packet.timestamp));
+        CHECK(bytes[12] == uint8_t(n >> 24) && bytes[14] == uint8_t(n >> 8) && bytes[15] == uint8_t(n));
+        CHECK(memcmp(bytes + 16, packet.payload.data(), n) == 0);
+
+        SerializeBinaryProtocol3(packet, buffer);
+        CHECK(buffer == OldSerialize3(packet));
+        bytes = (const uint8_t*)buffer.data();
+        CHECK(buffer.size() == 4 + n);
+        CHECK(bytes[0] == 0 && bytes[1] == 0);
+        CHECK(bytes[2] == uint8_t(n >> 8) && bytes[3] == uint8_t(n));
+        CHECK(memcmp(bytes + 4, packet.payload.data(), n) == 0);
+    }
+
+    // In place: the header ends where the payload starts, the headroom in front of it is left alone
+    for (auto& packet : MakePackets(200, AUDIO_PACKET_HEADROOM)) {
+        auto old_packet = WithoutHeadroom(packet);
+        auto payload = packet.payload;
+        auto message = FrameBinaryProtocol2(packet);
+        CHECK(message == packet.data() - 16);
+        CHECK(std::string((const char*)message, 16 + packet.size()) == OldSerialize2(old_packet));
+        message = FrameBinaryProtocol3(packet);
+        CHECK(message == packet.data() - 4);
+        CHECK(std::string((const char*)message, 4 + packet.size()) == OldSerialize3(old_packet));
+        CHECK(std::equal(payload.begin() + AUDIO_PACKET_HEADROOM, payload.end(), packet.data()));
+
+        // A packet with headroom still serializes its data only
+        SerializeBinaryProtocol2(packet, buffer);
+        CHECK(buffer == OldSerialize2(old_packet));
+    }
+}
+
+struct FramingCost {
+    double allocations;     // Per frame
+    double bytes_copied;    // Per frame, the header included
+};
+
+// frame() frames one packet and returns the bytes it copied
+template <typename Frame>
+static FramingCost Measure(const char* name, std::vector<AudioStreamPacket>& packets, Frame frame) {
+    const int rounds = 200;
+    size_t bytes = 0;
+    size_t payload_bytes = 0;
+    uint64_t allocations = heap_allocations;
+    auto start = HostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (auto& packet : packets) {
+            bytes += frame(packet);
+            payload_bytes += packet.size();
+        }
+    }
+    double frames = double(rounds) * packets.size();
+    double ns = double(HostNowNs() - start) / frames;
+    FramingCost cost = {(heap_allocations - allocations) / frames, bytes / frames};
+    printf("%-16s %.2f allocations, %.1f bytes copied for %.1f payload bytes, %.0f ns per frame\n", name,
+        cost.allocations, cost.bytes_copied, payload_bytes / frames, ns);
+    return cost;
+}
+
+static void Benchmark() {
+    auto packets = MakePackets(500, 0);
+    auto headroom_packets = MakePackets(500, AUDIO_PACKET_HEADROOM);
+    std::string buffer;
+    // Warm up the reused buffer to the largest frame, as the first packets of a session do
+    for (auto& packet : packets) {
+        SerializeBinaryProtocol2(packet, buffer);
+    }
+
+    for (int version : {2, 3}) {
+        size_t header = version == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3);
+        char name[32];
+        snprintf(name, sizeof(name), "v%d per packet", version);
+        auto per_packet = Measure(name, packets, [version](AudioStreamPacket& packet) {
+            return version == 2 ? OldSerialize2(packet).size() : OldSerialize3(packet).size();
+        });
+        snprintf(name, sizeof(name), "v%d reused", version);
+        auto reused = Measure(name, packets, [version, &buffer](AudioStreamPacket& packet) {
+            version == 2 ? SerializeBinaryProtocol2(packet, buffer) : SerializeBinaryProtocol3(packet, buffer);
+            return buffer.size();
+        });
+        snprintf(name, sizeof(name), "v%d in place", version);
+        auto in_place = Measure(name, headroom_packets, [version, header](AudioStreamPacket& packet) {
+            auto message = version == 2 ? FrameBinaryProtocol2(packet) : FrameBinaryProtocol3(packet);
+            return message != nullptr ? header : 0;
+        });
+        CHECK(per_packet.allocations == 1);
+        CHECK(reused.allocations == 0);
+        CHECK(in_place.allocations == 0);
+        CHECK(reused.bytes_copied > header);
+        // Only the header is written, the payload is never copied
+        CHECK(in_place.bytes_copied == header);
+    }
+}
+
+int main() {
+    TestLayout();
+    Benchmark();
+    printf("protocol_framing_test passed\n");
+    return 0;
+}
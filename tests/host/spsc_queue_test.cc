@@ -0,0 +1,258 @@
+// SpscQueue: ordering, capacity and Clear() semantics, then a stress test of the push to pop latency
+// with a producer, a consumer and a third thread polling Size() like the AudioService tasks do.
+// The same load runs through a mutex + deque queue, the one SpscQueue replaced, for comparison.
+#include "host_test.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct Item {
+    uint64_t sequence = 0;
+    int64_t push_time = 0;
+};
+
+// The queue before SpscQueue: one lock for producers, consumers and observers
+template <typename T>
+class MutexQueue {
+public:
+    explicit MutexQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool Push(T&& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= capacity_) {
+            return false;
+        }
+        queue_.push_back(std::move(item));
+        return true;
+    }
+
+    bool Pop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            return false;
+        }
+        item = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<T> queue_;
+    size_t capacity_;
+};
+
+static void TestOrderAndCapacity() {
+    SpscQueue<int> queue(4);
+    CHECK(queue.Empty());
+    for (int i = 0; i < 4; i++) {
+        int value = i;
+        CHECK(queue.Push(std::move(value)));
+    }
+    CHECK(queue.Full());
+    int extra = 4;
+    CHECK(!queue.Push(std::move(extra)));
+    CHECK(queue.Size() == 4);
+
+    // Wrap around a few times
+    for (int i = 0; i < 100; i++) {
+        int value = -1;
+        CHECK(queue.Pop(value));
+        CHECK(value == i);
+        int next = i + 4;
+        CHECK(queue.Push(std::move(next)));
+    }
+    CHECK(queue.Size() == 4);
+}
+
+static void TestClear() {
+    auto released = std::make_shared<int>(0);
+    struct Tracked {
+        std::shared_ptr<int> released;
+        ~Tracked() {
+            if (released) {
+                (*released)++;
+            }
+        }
+    };
+    SpscQueue<std::unique_ptr<Tracked>> queue(8);
+    for (int i = 0; i < 5; i++) {
+        auto item = std::make_unique<Tracked>();
+        item->released = released;
+        CHECK(queue.Push(std::move(item)));
+    }
+
+    queue.Clear();
+    // Empty for everyone at once, the items are released by the consumer's next Pop()
+    CHECK(queue.Empty());
+    CHECK(*released == 0);
+    std::unique_ptr<Tracked> item;
+    CHECK(!queue.Pop(item));
+    CHECK(*released == 5);
+
+    // Items pushed after Clear() are kept
+    auto kept = std::make_unique<Tracked>();
+    CHECK(queue.Push(std::move(kept)));
+    queue.Clear();
+    auto after = std::make_unique<Tracked>();
+    after->released = released;
+    CHECK(queue.Push(std::move(after)));
+    CHECK(queue.Size() == 1);
+    CHECK(queue.Pop(item));
+    CHECK(item && item->released == released);
+}
+
+struct StressResult {
+    double seconds;
+    std::vector<int64_t> latencies_ns;
+};
+
+// Producer and consumer yield on full / empty instead of sleeping, so the numbers show the queue more than the scheduler
+template <typename Queue>
+static StressResult Stress(Queue& queue, uint64_t count, bool clear) {
+    std::atomic<bool> produced{false};
+    std::atomic<bool> done{false};
+    StressResult result;
+    result.latencies_ns.reserve(count);
+
+    std::thread observer([&]() {
+        // Like the main task checking IsIdle() and the statistics timer reading queue depths
+        size_t sum = 0;
+        while (!done) {
+            sum += queue.Size();
+            std::this_thread::yield();
+        }
+        (void)sum;
+    });
+
+    int64_t start = HostNowNs();
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < count; i++) {
+            Item item{i, HostNowNs()};
+            while (!queue.Push(std::move(item))) {
+                std::this_thread::yield();
+                item.push_time = HostNowNs();
+            }
+        }
+        produced = true;
+    });
+
+    uint64_t received = 0;
+    uint64_t last = 0;
+    while (true) {
+        Item item;
+        if (!queue.Pop(item)) {
+            if (!produced) {
+                std::this_thread::yield();
+                continue;
+            }
+            // Everything was pushed, one more try for the last items
+            if (!queue.Pop(item)) {
+                break;
+            }
+        }
+        result.latencies_ns.push_back(HostNowNs() - item.push_time);
+        // Never reordered or repeated, and nothing lost unless cleared
+        CHECK(received == 0 || item.sequence > last);
+        CHECK(clear || item.sequence == received);
+        last = item.sequence;
+        received++;
+    }
+    producer.join();
+    result.seconds = (HostNowNs() - start) / 1e9;
+    done = true;
+    observer.join();
+    return result;
+}
+
+static void Report(const char* name, StressResult& result) {
+    size_t count = result.latencies_ns.size();
+    printf("%-12s %8.2f Mitems/s  latency p50 %6lld ns  p99 %8lld ns  p99.9 %9lld ns  max %9lld ns\n", name,
+        count / result.seconds / 1e6, (long long)Percentile(result.latencies_ns, 50),
+        (long long)Percentile(result.latencies_ns, 99), (long long)Percentile(result.latencies_ns, 99.9),
+        (long long)Percentile(result.latencies_ns, 100));
+}
+
+static void TestStress() {
+    const uint64_t count = 200000;
+    // MAX_ENCODE_TASKS_IN_QUEUE and the other limits are a few items, use one of that size
+    const size_t capacity = 4;
+
+    SpscQueue<Item> spsc(capacity);
+    auto spsc_result = Stress(spsc, count, false);
+    CHECK(spsc_result.latencies_ns.size() == count);
+    Report("SpscQueue", spsc_result);
+
+    MutexQueue<Item> mutex_queue(capacity);
+    auto mutex_result = Stress(mutex_queue, count, false);
+    CHECK(mutex_result.latencies_ns.size() == count);
+    Report("mutex+deque", mutex_result);
+}
+
+static void TestStressWithClear() {
+    // A third thread calling Clear() like AbortPlayback(): the consumer still sees an increasing sequence
+    const uint64_t count = 100000;
+    SpscQueue<Item> queue(16);
+    std::atomic<bool> done{false};
+    std::thread clearer([&]() {
+        while (!done) {
+            queue.Clear();
+            std::this_thread::yield();
+        }
+    });
+    auto result = Stress(queue, count, true);
+    done = true;
+    clearer.join();
+    printf("With Clear(): %zu of %llu items delivered\n", result.latencies_ns.size(), (unsigned long long)count);
+}
+
+static void TestSizeRaces() {
+    // Size() and Full() from a task that owns neither end, while the consumer pops and a third task clears
+    const uint64_t count = 100000;
+    const size_t capacity = 8;
+    SpscQueue<Item> queue(capacity);
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> samples{0};
+    std::thread observer([&]() {
+        while (!done) {
+            size_t size = queue.Size();
+            CHECK(size <= capacity);
+            CHECK(!queue.Full() || queue.Size() <= capacity);
+            // Spins most of the time to land between the loads of the other tasks, yields on one core
+            if (++samples % 256 == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread clearer([&]() {
+        while (!done) {
+            queue.Clear();
+            std::this_thread::yield();
+        }
+    });
+    auto result = Stress(queue, count, true);
+    done = true;
+    observer.join();
+    clearer.join();
+    printf("Size() raced against Pop() and Clear(): %llu samples within [0, %zu]\n",
+        (unsigned long long)samples.load(), capacity);
+}
+
+int main() {
+    TestOrderAndCapacity();
+    TestClear();
+    TestStress();
+    TestStressWithClear();
+    TestSizeRaces();
+    printf("spsc_queue_test passed\n");
+    return 0;
+}
@@ -0,0 +1,4 @@
+// Host stand-in for the board header included by AudioCodec, the host codecs do not use the board
+#ifndef BOARD_H
+#define BOARD_H
+#endif // BOARD_H
@@ -0,0 +1,360 @@
+// Host stand-in for cJSON: the tree building and parsing calls of the code under test, same node layout and ownership
+#ifndef CJSON_H
+#define CJSON_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define cJSON_Invalid (0)
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+    struct cJSON* next;
+    struct cJSON* prev;
+    struct cJSON* child;
+    int type;
+    char* valuestring;
+    int valueint;
+    double valuedouble;
+    char* string;
+} cJSON;
+
+inline cJSON* HostJsonCreate(int type) {
+    auto item = (cJSON*)calloc(1, sizeof(cJSON));
+    item->type = type;
+    return item;
+}
+
+inline char* HostJsonStrdup(const char* string) {
+    size_t size = strlen(string) + 1;
+    auto copy = (char*)malloc(size);
+    memcpy(copy, string, size);
+    return copy;
+}
+
+inline void cJSON_Delete(cJSON* item) {
+    while (item != nullptr) {
+        cJSON* next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+inline cJSON* cJSON_CreateObject() {
+    return HostJsonCreate(cJSON_Object);
+}
+
+inline cJSON* cJSON_CreateArray() {
+    return HostJsonCreate(cJSON_Array);
+}
+
+inline cJSON* cJSON_CreateNumber(double number) {
+    auto item = HostJsonCreate(cJSON_Number);
+    item->valuedouble = number;
+    item->valueint = int(number);
+    return item;
+}
+
+inline cJSON* cJSON_CreateString(const char* string) {
+    auto item = HostJsonCreate(cJSON_String);
+    item->valuestring = HostJsonStrdup(string);
+    return item;
+}
+
+inline cJSON* cJSON_CreateBool(bool value) {
+    return HostJsonCreate(value ? cJSON_True : cJSON_False);
+}
+
+inline cJSON* cJSON_CreateNull() {
+    return HostJsonCreate(cJSON_NULL);
+}
+
+inline bool cJSON_AddItemToArray(cJSON* array, cJSON* item) {
+    if (array == nullptr || item == nullptr) {
+        return false;
+    }
+    if (array->child == nullptr) {
+        array->child = item;
+        item->prev = item;
+    } else {
+        // The first child's prev is the last one, like cJSON
+        cJSON* last = array->child->prev;
+        last->next = item;
+        item->prev = last;
+        array->child->prev = item;
+    }
+    return true;
+}
+
+inline bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item) {
+    if (item == nullptr) {
+        return false;
+    }
+    free(item->string);
+    item->string = HostJsonStrdup(name);
+    return cJSON_AddItemToArray(object, item);
+}
+
+inline cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number) {
+    auto item = cJSON_CreateNumber(number);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+inline cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string) {
+    auto item = cJSON_CreateString(string);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+inline cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, bool value) {
+    auto item = cJSON_CreateBool(value);
+    cJSON_AddItemToObject(object, name, item);
+    return item;
+}
+
+inline cJSON* cJSON_GetObjectItem(const cJSON* object, const char* name) {
+    if (object == nullptr || name == nullptr) {
+        return nullptr;
+    }
+    for (cJSON* item = object->child; item != nullptr; item = item->next) {
+        if (item->string != nullptr && strcmp(item->string, name) == 0) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+inline bool cJSON_IsNumber(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_Number;
+}
+
+inline bool cJSON_IsString(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_String;
+}
+
+inline bool cJSON_IsObject(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_Object;
+}
+
+inline bool cJSON_IsArray(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_Array;
+}
+
+inline bool cJSON_IsBool(const cJSON* item) {
+    return item != nullptr && (item->type == cJSON_True || item->type == cJSON_False);
+}
+
+inline bool cJSON_IsNull(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_NULL;
+}
+
+inline bool cJSON_IsTrue(const cJSON* item) {
+    return item != nullptr && item->type == cJSON_True;
+}
+
+/* A strict parser for the messages of the tests: no comments, \\u escapes below 0x80 only */
+inline void HostJsonSkip(const char*& p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+}
+
+inline char* HostJsonParseString(const char*& p) {
+    if (*p != '"') {
+        return nullptr;
+    }
+    std::string value;
+    for (p++; *p != '"'; p++) {
+        if (*p == '\0') {
+            return nullptr;
+        }
+        if (*p != '\\') {
+            value += *p;
+            continue;
+        }
+        p++;
+        switch (*p) {
+        case 'n': value += '\n'; break;
+        case 't': value += '\t'; break;
+        case 'r': value += '\r'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'u':
+            if (strlen(p) < 5) {
+                return nullptr;
+            }
+            value += char(strtol(std::string(p + 1, 4).c_str(), nullptr, 16));
+            p += 4;
+            break;
+        case '\0': return nullptr;
+        default: value += *p; break;
+        }
+    }
+    p++;
+    return HostJsonStrdup(value.c_str());
+}
+
+inline cJSON* HostJsonParseValue(const char*& p) {
+    HostJsonSkip(p);
+    if (*p == '{' || *p == '[') {
+        bool object = *p == '{';
+        char close = object ? '}' : ']';
+        auto container = HostJsonCreate(object ? cJSON_Object : cJSON_Array);
+        p++;
+        HostJsonSkip(p);
+        if (*p == close) {
+            p++;
+            return container;
+        }
+        while (true) {
+            char* name = nullptr;
+            if (object) {
+                HostJsonSkip(p);
+                name = HostJsonParseString(p);
+                HostJsonSkip(p);
+                if (name == nullptr || *p != ':') {
+                    free(name);
+                    cJSON_Delete(container);
+                    return nullptr;
+                }
+                p++;
+            }
+            auto item = HostJsonParseValue(p);
+            if (item == nullptr) {
+                free(name);
+                cJSON_Delete(container);
+                return nullptr;
+            }
+            item->string = name;
+            cJSON_AddItemToArray(container, item);
+            HostJsonSkip(p);
+            if (*p == ',') {
+                p++;
+            } else if (*p == close) {
+                p++;
+                return container;
+            } else {
+                cJSON_Delete(container);
+                return nullptr;
+            }
+        }
+    }
+    if (*p == '"') {
+        char* string = HostJsonParseString(p);
+        if (string == nullptr) {
+            return nullptr;
+        }
+        auto item = HostJsonCreate(cJSON_String);
+        item->valuestring = string;
+        return item;
+    }
+    const struct {
+        const char* literal;
+        int type;
+    } literals[] = {{"true", cJSON_True}, {"false", cJSON_False}, {"null", cJSON_NULL}};
+    for (auto& literal : literals) {
+        if (strncmp(p, literal.literal, strlen(literal.literal)) == 0) {
+            p += strlen(literal.literal);
+            return HostJsonCreate(literal.type);
+        }
+    }
+    char* end;
+    double number = strtod(p, &end);
+    if (end == p) {
+        return nullptr;
+    }
+    p = end;
+    return cJSON_CreateNumber(number);
+}
+
+inline cJSON* cJSON_Parse(const char* value) {
+    if (value == nullptr) {
+        return nullptr;
+    }
+    const char* p = value;
+    auto item = HostJsonParseValue(p);
+    HostJsonSkip(p);
+    if (item != nullptr && *p != '\0') {
+        cJSON_Delete(item);
+        return nullptr;
+    }
+    return item;
+}
+
+inline void HostJsonPrintString(std::string& out, const char* string) {
+    out += '"';
+    for (const char* p = string; *p != '\0'; p++) {
+        switch (*p) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        case '\r': out += "\\r"; break;
+        default: out += *p; break;
+        }
+    }
+    out += '"';
+}
+
+inline void HostJsonPrint(std::string& out, const cJSON* item) {
+    switch (item->type) {
+    case cJSON_False: out += "false"; break;
+    case cJSON_True: out += "true"; break;
+    case cJSON_NULL: out += "null"; break;
+    case cJSON_Number: {
+        char buffer[32];
+        if (item->valuedouble == double(int64_t(item->valuedouble))) {
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)item->valuedouble);
+        } else {
+            snprintf(buffer, sizeof(buffer), "%.17g", item->valuedouble);
+        }
+        out += buffer;
+        break;
+    }
+    case cJSON_String: HostJsonPrintString(out, item->valuestring); break;
+    case cJSON_Array:
+    case cJSON_Object:
+        out += item->type == cJSON_Object ? '{' : '[';
+        for (cJSON* child = item->child; child != nullptr; child = child->next) {
+            if (child != item->child) {
+                out += ',';
+            }
+            if (item->type == cJSON_Object) {
+                HostJsonPrintString(out, child->string);
+                out += ':';
+            }
+            HostJsonPrint(out, child);
+        }
+        out += item->type == cJSON_Object ? '}' : ']';
+        break;
+    }
+}
+
+// The caller frees the string with cJSON_free(), like cJSON
+inline char* cJSON_PrintUnformatted(const cJSON* item) {
+    if (item == nullptr) {
+        return nullptr;
+    }
+    std::string out;
+    HostJsonPrint(out, item);
+    return HostJsonStrdup(out.c_str());
+}
+
+inline void cJSON_free(void* object) {
+    free(object);
+}
+
+#endif // CJSON_H
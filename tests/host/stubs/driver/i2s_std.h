@@ -0,0 +1,7 @@
+// Host stand-in for the I2S driver types, the host codecs have no I2S channels
+#ifndef DRIVER_I2S_STD_H
+#define DRIVER_I2S_STD_H
+
+#include "driver/i2s_common.h"
+
+#endif // DRIVER_I2S_STD_H
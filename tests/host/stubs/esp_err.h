@@ -0,0 +1,20 @@
+// Host stand-in for the ESP-IDF error codes
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x) do { \
+    esp_err_t error = (x); \
+    if (error != ESP_OK) { \
+        fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d\n", error, __FILE__, __LINE__); \
+        abort(); \
+    } \
+} while (0)
+
+#endif // ESP_ERR_H
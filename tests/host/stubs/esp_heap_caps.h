@@ -0,0 +1,27 @@
+// Host stand-in for the capability allocator, set host_heap_without_spiram to run as a board without PSRAM
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline bool host_heap_without_spiram = false;
+
+inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    if ((caps & MALLOC_CAP_SPIRAM) && host_heap_without_spiram) {
+        return nullptr;
+    }
+    return malloc(size);
+}
+
+inline void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+#endif // ESP_HEAP_CAPS_H
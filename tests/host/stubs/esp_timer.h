@@ -0,0 +1,100 @@
+// Host stand-in for esp_timer on a simulated clock: it only moves with HostAdvanceTime(), which also fires
+// the timers that expire, so the tests are deterministic. With host_time_realtime set, the clock is the host
+// monotonic clock instead, for the tests that run the audio tasks on threads; the timers then never fire
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "esp_err.h"
+
+struct esp_timer {
+    void (*callback)(void* arg);
+    void* arg;
+    bool armed;
+    int64_t deadline_us;
+    int64_t period_us;      // 0 for a one-shot timer
+};
+typedef struct esp_timer* esp_timer_handle_t;
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    void (*callback)(void* arg);
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+inline int64_t host_time_us = 1000000;
+inline bool host_time_realtime = false;
+inline std::vector<esp_timer*> host_timers;
+
+inline int64_t esp_timer_get_time() {
+    if (host_time_realtime) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    return host_time_us;
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer) {
+    *timer = new esp_timer{args->callback, args->arg, false, 0, 0};
+    host_timers.push_back(*timer);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    timer->armed = true;
+    timer->deadline_us = host_time_us + int64_t(timeout_us);
+    timer->period_us = 0;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    timer->armed = true;
+    timer->deadline_us = host_time_us + int64_t(period_us);
+    timer->period_us = int64_t(period_us);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    timer->armed = false;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    host_timers.erase(std::remove(host_timers.begin(), host_timers.end(), timer), host_timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+// Move the clock forward, firing the expired timers at their deadline
+inline void HostAdvanceTime(int64_t us) {
+    int64_t end = host_time_us + us;
+    while (true) {
+        esp_timer* next = nullptr;
+        for (auto timer : host_timers) {
+            if (timer->armed && timer->deadline_us <= end && (next == nullptr || timer->deadline_us < next->deadline_us)) {
+                next = timer;
+            }
+        }
+        if (next == nullptr) {
+            break;
+        }
+        host_time_us = std::max(host_time_us, next->deadline_us);
+        next->armed = next->period_us > 0;
+        next->deadline_us += next->period_us;
+        next->callback(next->arg);
+    }
+    host_time_us = end;
+}
+
+#endif // ESP_TIMER_H
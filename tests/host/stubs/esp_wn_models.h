@@ -0,0 +1,11 @@
+// Host stand-in for the esp-sr WakeNet model lookup, the host has no models
+#ifndef ESP_WN_MODELS_H
+#define ESP_WN_MODELS_H
+
+#include "esp_wn_iface.h"
+
+inline const esp_wn_iface_t* esp_wn_handle_from_name(const char* model_name) {
+    return nullptr;
+}
+
+#endif // ESP_WN_MODELS_H
@@ -0,0 +1,19 @@
+// Host stand-in for the FreeRTOS base types
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY TickType_t(0xffffffffUL)
+// A tick is a millisecond
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) TickType_t(ms)
+
+#endif // FREERTOS_H
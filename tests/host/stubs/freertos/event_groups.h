@@ -0,0 +1,68 @@
+// Host stand-in for FreeRTOS event groups, a tick is a millisecond of real time
+#ifndef FREERTOS_EVENT_GROUPS_H
+#define FREERTOS_EVENT_GROUPS_H
+
+#include "FreeRTOS.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+typedef uint32_t EventBits_t;
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable changed;
+    EventBits_t bits = 0;
+};
+typedef HostEventGroup* EventGroupHandle_t;
+
+inline EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+inline void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->changed.notify_all();
+    return group->bits;
+}
+
+inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+// Returns the bits when the wait ended, the waited bits are cleared only if the wait succeeded
+inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto ready = [group, bits, wait_for_all]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool success;
+    if (ticks == portMAX_DELAY) {
+        group->changed.wait(lock, ready);
+        success = true;
+    } else {
+        success = group->changed.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+    }
+    EventBits_t result = group->bits;
+    if (success && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+#endif // FREERTOS_EVENT_GROUPS_H
@@ -0,0 +1,119 @@
+/*
+ * Host stand-in for the no-split FreeRTOS ring buffer. Items take the space of the IDF ring: an 8 byte
+ * header and the data rounded up to 4 bytes, so a ring fills at the same item count as on the chip.
+ */
+#ifndef FREERTOS_RINGBUF_H
+#define FREERTOS_RINGBUF_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <deque>
+#include <vector>
+#include <new>
+#include <chrono>
+#include <algorithm>
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+struct HostRingbuffer {
+    size_t capacity;
+    size_t used = 0;
+    std::vector<std::vector<uint8_t>*> acquired;
+    std::deque<std::vector<uint8_t>*> items;
+};
+typedef HostRingbuffer* RingbufHandle_t;
+
+typedef struct {
+    alignas(HostRingbuffer) uint8_t storage[sizeof(HostRingbuffer)];
+} StaticRingbuffer_t;
+
+inline std::mutex host_rings_mutex;
+inline std::condition_variable host_rings_changed;
+inline bool host_rings_registered = (host_task_wake_blocked = []() {
+    std::lock_guard<std::mutex> lock(host_rings_mutex);
+    host_rings_changed.notify_all();
+}, true);
+
+inline size_t HostRingItemSpace(size_t size) {
+    return 8 + (size + 3) / 4 * 4;
+}
+
+inline RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t* storage,
+    StaticRingbuffer_t* buffer) {
+    auto ring = new (buffer->storage) HostRingbuffer();
+    ring->capacity = size;
+    return ring;
+}
+
+inline void vRingbufferDelete(RingbufHandle_t ring) {
+    for (auto item : ring->acquired) {
+        delete item;
+    }
+    for (auto item : ring->items) {
+        delete item;
+    }
+    ring->~HostRingbuffer();
+}
+
+// Never waits for space, the callers under test only send with a zero timeout
+inline BaseType_t xRingbufferSendAcquire(RingbufHandle_t ring, void** item, size_t size, TickType_t ticks) {
+    std::lock_guard<std::mutex> lock(host_rings_mutex);
+    if (ring->used + HostRingItemSpace(size) > ring->capacity) {
+        return pdFALSE;
+    }
+    ring->used += HostRingItemSpace(size);
+    auto data = new std::vector<uint8_t>(size);
+    ring->acquired.push_back(data);
+    *item = data->data();
+    return pdTRUE;
+}
+
+inline BaseType_t xRingbufferSendComplete(RingbufHandle_t ring, void* item) {
+    std::lock_guard<std::mutex> lock(host_rings_mutex);
+    auto it = std::find_if(ring->acquired.begin(), ring->acquired.end(),
+        [item](std::vector<uint8_t>* data) { return data->data() == item; });
+    if (it == ring->acquired.end()) {
+        return pdFALSE;
+    }
+    ring->items.push_back(*it);
+    ring->acquired.erase(it);
+    host_rings_changed.notify_all();
+    return pdTRUE;
+}
+
+// A tick is a millisecond, a deleted task blocked here unwinds
+inline void* xRingbufferReceive(RingbufHandle_t ring, size_t* size, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(host_rings_mutex);
+    auto ready = [ring]() { return !ring->items.empty() || (host_current_task && host_current_task->deleted); };
+    if (ticks == portMAX_DELAY) {
+        host_rings_changed.wait(lock, ready);
+    } else {
+        host_rings_changed.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+    }
+    HostTaskCheckDeleted();
+    if (ring->items.empty()) {
+        return nullptr;
+    }
+    *size = ring->items.front()->size();
+    return ring->items.front()->data();
+}
+
+inline void vRingbufferReturnItem(RingbufHandle_t ring, void* item) {
+    std::lock_guard<std::mutex> lock(host_rings_mutex);
+    if (ring->items.empty()) {
+        return;
+    }
+    auto data = ring->items.front();
+    if (data->data() == item) {
+        ring->used -= HostRingItemSpace(data->size());
+        ring->items.pop_front();
+        delete data;
+    }
+}
+
+#endif // FREERTOS_RINGBUF_H
@@ -0,0 +1,118 @@
+/*
+ * Host stand-in for FreeRTOS tasks on threads. A task starts at once unless host_tasks_paused is set, then
+ * it waits for HostResumeTasks(). vTaskDelete() can only stop a task blocked in a host stand-in that calls
+ * HostTaskCheckDeleted(), like the ring buffer receive, and joins it. A task deleting itself, vTaskDelete(NULL),
+ * ends when its function returns; HostWaitTasks() waits until every task has ended.
+ */
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+typedef void (*TaskFunction_t)(void* arg);
+
+struct HostTask {
+    std::thread thread;
+    std::atomic<bool> deleted{false};
+    bool self_deleted = false;
+};
+typedef HostTask* TaskHandle_t;
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+// Thrown at a blocking point of a deleted task, unwinds it back to its thread
+struct HostTaskDeleted {};
+
+inline bool host_tasks_paused = false;
+inline int host_tasks_running = 0;
+inline std::mutex host_tasks_mutex;
+inline std::condition_variable host_tasks_resumed;
+inline std::condition_variable host_tasks_finished;
+inline thread_local HostTask* host_current_task = nullptr;
+
+inline void HostResumeTasks() {
+    std::lock_guard<std::mutex> lock(host_tasks_mutex);
+    host_tasks_paused = false;
+    host_tasks_resumed.notify_all();
+}
+
+// `remaining` tasks may still run, like one only its owner deletes
+inline void HostWaitTasks(int remaining = 0) {
+    std::unique_lock<std::mutex> lock(host_tasks_mutex);
+    host_tasks_finished.wait(lock, [remaining]() { return host_tasks_running <= remaining; });
+}
+
+inline void HostTaskCheckDeleted() {
+    if (host_current_task != nullptr && host_current_task->deleted) {
+        throw HostTaskDeleted();
+    }
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle) {
+    auto task = new HostTask();
+    // Held until the thread is stored, the task waits for it before it starts
+    std::lock_guard<std::mutex> lock(host_tasks_mutex);
+    host_tasks_running++;
+    task->thread = std::thread([task, function, arg]() {
+        host_current_task = task;
+        {
+            std::unique_lock<std::mutex> lock(host_tasks_mutex);
+            host_tasks_resumed.wait(lock, [task]() { return !host_tasks_paused || task->deleted; });
+        }
+        try {
+            HostTaskCheckDeleted();
+            function(arg);
+        } catch (const HostTaskDeleted&) {
+        }
+        std::lock_guard<std::mutex> lock(host_tasks_mutex);
+        if (task->self_deleted) {
+            task->thread.detach();
+            delete task;
+        }
+        host_tasks_running--;
+        host_tasks_finished.notify_all();
+    });
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+// The core is ignored, the host schedules the threads
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, BaseType_t core_id) {
+    return xTaskCreate(function, name, stack_depth, arg, priority, handle);
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+// Wakes the blocking points of the host stand-ins, they are registered by ringbuf.h
+inline void (*host_task_wake_blocked)() = nullptr;
+
+inline void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr) {
+        host_current_task->self_deleted = true;
+        return;
+    }
+    task->deleted = true;
+    {
+        std::lock_guard<std::mutex> lock(host_tasks_mutex);
+        host_tasks_resumed.notify_all();
+    }
+    if (host_task_wake_blocked != nullptr) {
+        host_task_wake_blocked();
+    }
+    task->thread.join();
+    delete task;
+}
+
+#endif // FREERTOS_TASK_H
@@ -0,0 +1,22 @@
+/*
+ * Host declarations of the mbedtls AES calls, linked against the mbedcrypto library of the host. The context
+ * is only passed by pointer, so an opaque block larger than the real one of any mbedtls version is enough.
+ */
+#ifndef MBEDTLS_AES_H
+#define MBEDTLS_AES_H
+
+#include <cstddef>
+
+typedef struct mbedtls_aes_context {
+    alignas(16) unsigned char opaque[1024];
+} mbedtls_aes_context;
+
+extern "C" {
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output);
+}
+
+#endif // MBEDTLS_AES_H
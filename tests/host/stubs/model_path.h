@@ -0,0 +1,24 @@
+// Host stand-in for the esp-sr model list, the host has no models: every lookup finds nothing
+#ifndef MODEL_PATH_H
+#define MODEL_PATH_H
+
+#define ESP_WN_PREFIX "wn"
+#define ESP_MN_PREFIX "mn"
+
+typedef struct {
+    int num;
+    char** model_name;
+} srmodel_list_t;
+
+inline srmodel_list_t* esp_srmodel_init(const char* partition_label) {
+    return nullptr;
+}
+
+inline void esp_srmodel_deinit(srmodel_list_t* models) {
+}
+
+inline char* esp_srmodel_filter(srmodel_list_t* models, const char* prefix, const char* keyword) {
+    return nullptr;
+}
+
+#endif // MODEL_PATH_H
@@ -0,0 +1,155 @@
+/*
+ * Host stand-in for libopus: a deterministic toy codec with the libopus calls, packets of about the same size
+ * (16 kbps at 16 kHz) and none of the cost, so the pipeline tests measure the pipeline. Its packets are not
+ * Opus: |0xA5|frame size 2u|sample rate / 1000|one 8-bit value per 8 samples|. Decoding an empty packet
+ * (packet loss concealment) gives silence, in-band FEC decodes the packet itself.
+ */
+#ifndef OPUS_H
+#define OPUS_H
+
+#include <cstdint>
+#include <cstdarg>
+
+typedef int16_t opus_int16;
+typedef int32_t opus_int32;
+
+#define OPUS_OK 0
+#define OPUS_BAD_ARG -1
+#define OPUS_BUFFER_TOO_SMALL -2
+#define OPUS_INVALID_PACKET -4
+#define OPUS_AUTO -1000
+#define OPUS_APPLICATION_VOIP 2048
+
+#define OPUS_SET_BITRATE_REQUEST 4002
+#define OPUS_SET_COMPLEXITY_REQUEST 4010
+#define OPUS_SET_INBAND_FEC_REQUEST 4012
+#define OPUS_SET_PACKET_LOSS_PERC_REQUEST 4014
+#define OPUS_SET_DTX_REQUEST 4016
+#define OPUS_RESET_STATE 4028
+
+#define OPUS_SET_BITRATE(x) OPUS_SET_BITRATE_REQUEST, (opus_int32)(x)
+#define OPUS_SET_COMPLEXITY(x) OPUS_SET_COMPLEXITY_REQUEST, (opus_int32)(x)
+#define OPUS_SET_INBAND_FEC(x) OPUS_SET_INBAND_FEC_REQUEST, (opus_int32)(x)
+#define OPUS_SET_PACKET_LOSS_PERC(x) OPUS_SET_PACKET_LOSS_PERC_REQUEST, (opus_int32)(x)
+#define OPUS_SET_DTX(x) OPUS_SET_DTX_REQUEST, (opus_int32)(x)
+
+#define HOST_OPUS_MAGIC 0xA5
+#define HOST_OPUS_HEADER_SIZE 4
+#define HOST_OPUS_SAMPLES_PER_VALUE 8
+
+struct OpusEncoder {
+    opus_int32 sample_rate;
+    opus_int32 bitrate;
+    int complexity;
+    int dtx;
+};
+
+struct OpusDecoder {
+    opus_int32 sample_rate;
+};
+
+inline OpusEncoder* opus_encoder_create(opus_int32 Fs, int channels, int application, int* error) {
+    if (channels != 1 || Fs <= 0) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusEncoder{Fs, OPUS_AUTO, 9, 0};
+}
+
+inline void opus_encoder_destroy(OpusEncoder* st) {
+    delete st;
+}
+
+// The settings are kept, the packets do not depend on them
+inline int opus_encoder_ctl(OpusEncoder* st, int request, ...) {
+    va_list args;
+    va_start(args, request);
+    int result = OPUS_OK;
+    switch (request) {
+        case OPUS_SET_BITRATE_REQUEST:
+            st->bitrate = va_arg(args, opus_int32);
+            break;
+        case OPUS_SET_COMPLEXITY_REQUEST:
+            st->complexity = va_arg(args, opus_int32);
+            break;
+        case OPUS_SET_DTX_REQUEST:
+            st->dtx = va_arg(args, opus_int32);
+            break;
+        case OPUS_SET_INBAND_FEC_REQUEST:
+        case OPUS_SET_PACKET_LOSS_PERC_REQUEST:
+            va_arg(args, opus_int32);
+            break;
+        default:
+            result = OPUS_BAD_ARG;
+            break;
+    }
+    va_end(args);
+    return result;
+}
+
+inline opus_int32 opus_encode(OpusEncoder* st, const opus_int16* pcm, int frame_size, unsigned char* data,
+    opus_int32 max_data_bytes) {
+    int values = (frame_size + HOST_OPUS_SAMPLES_PER_VALUE - 1) / HOST_OPUS_SAMPLES_PER_VALUE;
+    if (max_data_bytes < HOST_OPUS_HEADER_SIZE + values) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    data[0] = HOST_OPUS_MAGIC;
+    data[1] = uint8_t(frame_size >> 8);
+    data[2] = uint8_t(frame_size);
+    data[3] = uint8_t(st->sample_rate / 1000);
+    for (int v = 0; v < values; v++) {
+        int sum = 0;
+        int count = 0;
+        for (int i = v * HOST_OPUS_SAMPLES_PER_VALUE; i < frame_size && count < HOST_OPUS_SAMPLES_PER_VALUE; i++) {
+            sum += pcm[i];
+            count++;
+        }
+        int value = (sum / count + 128) >> 8;
+        data[HOST_OPUS_HEADER_SIZE + v] = uint8_t(int8_t(value > 127 ? 127 : value));
+    }
+    return HOST_OPUS_HEADER_SIZE + values;
+}
+
+inline OpusDecoder* opus_decoder_create(opus_int32 Fs, int channels, int* error) {
+    if (channels != 1 || Fs <= 0) {
+        *error = OPUS_BAD_ARG;
+        return nullptr;
+    }
+    *error = OPUS_OK;
+    return new OpusDecoder{Fs};
+}
+
+inline void opus_decoder_destroy(OpusDecoder* st) {
+    delete st;
+}
+
+inline int opus_decoder_ctl(OpusDecoder* st, int request, ...) {
+    return request == OPUS_RESET_STATE ? OPUS_OK : OPUS_BAD_ARG;
+}
+
+// Returns the samples of the packet duration at the decoder rate, frame_size is the room in pcm
+inline int opus_decode(OpusDecoder* st, const unsigned char* data, opus_int32 len, opus_int16* pcm, int frame_size,
+    int decode_fec) {
+    if (data == nullptr || len == 0) {
+        for (int i = 0; i < frame_size; i++) {
+            pcm[i] = 0;
+        }
+        return frame_size;
+    }
+    if (len <= HOST_OPUS_HEADER_SIZE || data[0] != HOST_OPUS_MAGIC || data[3] == 0) {
+        return OPUS_INVALID_PACKET;
+    }
+    int encoded_samples = (data[1] << 8) | data[2];
+    int samples = int(int64_t(encoded_samples) * st->sample_rate / (data[3] * 1000));
+    if (samples > frame_size) {
+        return OPUS_BUFFER_TOO_SMALL;
+    }
+    int values = len - HOST_OPUS_HEADER_SIZE;
+    for (int i = 0; i < samples; i++) {
+        pcm[i] = opus_int16(int8_t(data[HOST_OPUS_HEADER_SIZE + int64_t(i) * values / samples]) * 256);
+    }
+    return samples;
+}
+
+#endif // OPUS_H
@@ -0,0 +1,29 @@
+// Host stand-in for the esp-opus-encoder resampler, nearest sample: the polyphase resampler covers the rates
+// the tests use, this one is only the fallback for the other rate pairs
+#ifndef OPUS_RESAMPLER_H
+#define OPUS_RESAMPLER_H
+
+#include <cstdint>
+
+class OpusResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate) {
+        input_sample_rate_ = input_sample_rate;
+        output_sample_rate_ = output_sample_rate;
+    }
+    void Process(const int16_t* input, int input_samples, int16_t* output) {
+        int output_samples = GetOutputSamples(input_samples);
+        for (int i = 0; i < output_samples; i++) {
+            output[i] = input[int64_t(i) * input_samples / output_samples];
+        }
+    }
+    int GetOutputSamples(int input_samples) {
+        return int(int64_t(input_samples) * output_sample_rate_ / input_sample_rate_);
+    }
+
+private:
+    int input_sample_rate_ = 16000;
+    int output_sample_rate_ = 16000;
+};
+
+#endif // OPUS_RESAMPLER_H
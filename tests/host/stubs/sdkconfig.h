@@ -0,0 +1,4 @@
+// Host stand-in for the generated configuration, the tests pass the options they need as compile definitions
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+#endif // SDKCONFIG_H
@@ -0,0 +1,26 @@
+// Host stand-in for the NVS settings, kept in memory for the life of the test
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <map>
+#include <string>
+
+inline std::map<std::string, int> host_settings;
+
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) : ns_(ns) {}
+
+    int GetInt(const std::string& key, int default_value = 0) {
+        auto it = host_settings.find(ns_ + "." + key);
+        return it != host_settings.end() ? it->second : default_value;
+    }
+    void SetInt(const std::string& key, int value) {
+        host_settings[ns_ + "." + key] = value;
+    }
+
+private:
+    std::string ns_;
+};
+
+#endif // SETTINGS_H
@@ -0,0 +1,168 @@
+// Uplink frame duration: the duration requested for a listening session against the one answered in the server
+// hello, as announced in the listen start message, then a latency and bandwidth benchmark of 20/40/60 ms frames,
+// with and without frame aggregation, over the websocket and the MQTT/UDP transports.
+#include "host_test.h"
+#include "protocol.h"
+
+#include <string>
+
+// Counts the messages a transport would send, with the send time of each
+class TestProtocol : public Protocol {
+public:
+    struct Message {
+        int64_t time;
+        int64_t origin_time;    // Capture start of the first frame
+        int frame_duration;
+        int frames;
+        size_t size;
+    };
+    std::vector<Message> messages;
+    std::string last_text;
+
+    bool Start() override { return true; }
+    bool OpenAudioChannel() override { return true; }
+    void CloseAudioChannel() override {}
+    bool IsAudioChannelOpened() const override { return true; }
+
+    using Protocol::SetFramesPerPacket;
+    using Protocol::SetServerUplinkFrameDuration;
+
+protected:
+    bool SendAudioMessage(AudioStreamPacket& packet, int frames) override {
+        messages.push_back({esp_timer_get_time(), packet.origin_time, packet.frame_duration, frames, packet.size()});
+        return true;
+    }
+    bool SendText(const std::string& text) override {
+        last_text = text;
+        return true;
+    }
+};
+
+static bool Announces(TestProtocol& protocol, int frame_duration) {
+    protocol.SendStartListening(kListeningModeRealtime);
+    return protocol.last_text.find("\"frame_duration\":" + std::to_string(frame_duration) + "}") != std::string::npos;
+}
+
+static void TestNegotiation() {
+    TestProtocol protocol;
+    // Requested before the channel opens, the server hello did not answer a duration
+    protocol.SetFrameDuration(20);
+    protocol.SetServerUplinkFrameDuration(0);
+    CHECK(protocol.frame_duration() == 20);
+    CHECK(Announces(protocol, 20));
+    protocol.SetFrameDuration(60);
+    CHECK(Announces(protocol, 60));
+
+    // The server answered 40 ms: every session of the channel uses it
+    protocol.SetFrameDuration(20);
+    protocol.SetServerUplinkFrameDuration(40);
+    CHECK(protocol.frame_duration() == 40);
+    protocol.SetFrameDuration(20);
+    CHECK(protocol.frame_duration() == 40);
+    CHECK(Announces(protocol, 40));
+
+    // A new hello without an answer gives the choice back to the device, an unsupported answer is ignored
+    protocol.SetServerUplinkFrameDuration(0);
+    protocol.SetFrameDuration(20);
+    CHECK(protocol.frame_duration() == 20);
+    protocol.SetServerUplinkFrameDuration(30);
+    CHECK(protocol.frame_duration() == 20);
+    protocol.SetFrameDuration(60);
+    CHECK(protocol.frame_duration() == 60);
+}
+
+struct Transport {
+    const char* name;
+    size_t message_header;      // BinaryProtocol3, or the nonce of a datagram
+    size_t network_header;      // Websocket frame (client frames are masked), TCP/IP or UDP/IP headers
+};
+
+static const Transport kTransports[] = {
+    {"websocket v3", 4, 6 + 40},
+    {"mqtt/udp", 16, 8 + 20},
+};
+
+struct UplinkCost {
+    double messages_per_second;
+    double bits_per_second;     // On the wire, the headers included
+    double latency_ms;          // Mean time from the capture of a sample to the send of its message
+};
+
+/*
+ * Streams 10 s of constant bitrate Opus frames on the simulated clock. A frame is sent when its last sample is
+ * captured, the encode time is left out: it is measured on the device, see the codec task statistics.
+ */
+static UplinkCost MeasureUplink(const Transport& transport, int frame_duration, int frames_per_packet,
+    int bitrate) {
+    TestProtocol protocol;
+    protocol.OnAudioFlushNeeded([&]() { protocol.FlushAudio(); });
+    protocol.SetFramesPerPacket(frames_per_packet);
+    protocol.SetFrameDuration(frame_duration);
+
+    const int seconds = 10;
+    const int count = seconds * 1000 / frame_duration;
+    int64_t start = esp_timer_get_time();
+    AudioStreamPacket frame;
+    frame.sample_rate = 16000;
+    frame.frame_duration = frame_duration;
+    frame.payload.assign(bitrate / 8 * frame_duration / 1000, 0x55);
+    for (int i = 0; i < count; i++) {
+        frame.origin_time = start + int64_t(i) * frame_duration * 1000;
+        frame.timestamp = i * frame_duration;
+        HostAdvanceTime(frame.origin_time + frame_duration * 1000 - esp_timer_get_time());
+        CHECK(protocol.SendAudio(frame));
+    }
+    HostAdvanceTime(AUDIO_AGGREGATION_MAX_DELAY_MS * 1000);
+    CHECK(protocol.FlushAudio());
+
+    size_t wire_bytes = 0;
+    double latency_us = 0;
+    int frames = 0;
+    for (auto& message : protocol.messages) {
+        wire_bytes += transport.message_header + transport.network_header + message.size;
+        // Every sample of a frame waits half a frame on average before its frame is complete
+        for (int f = 0; f < message.frames; f++) {
+            latency_us += message.time - message.origin_time - f * message.frame_duration * 1000 -
+                message.frame_duration * 500;
+        }
+        frames += message.frames;
+    }
+    CHECK(frames == count);
+    return {double(protocol.messages.size()) / seconds, wire_bytes * 8.0 / seconds, latency_us / frames / 1000};
+}
+
+static void Benchmark() {
+    const int bitrate = 16000;
+    printf("%-13s %8s %10s %12s %12s %11s\n", "transport", "frame", "per packet", "messages/s", "wire kbps",
+        "latency");
+    for (auto& transport : kTransports) {
+        for (int frames_per_packet : {1, 4}) {
+            UplinkCost previous = {};
+            for (int frame_duration : {60, 40, 20}) {
+                auto cost = MeasureUplink(transport, frame_duration, frames_per_packet, bitrate);
+                printf("%-13s %6d ms %10d %12.1f %12.1f %8.1f ms\n", transport.name, frame_duration,
+                    frames_per_packet, cost.messages_per_second, cost.bits_per_second / 1000, cost.latency_ms);
+                // The Opus payload alone is the bitrate, the headers come on top of it per message
+                CHECK(cost.bits_per_second > bitrate);
+                if (previous.messages_per_second > 0 && frames_per_packet == 1) {
+                    // Shorter frames: less waiting for the frame to fill, more headers per second
+                    CHECK(cost.latency_ms < previous.latency_ms);
+                    CHECK(cost.bits_per_second > previous.bits_per_second);
+                }
+                previous = cost;
+            }
+        }
+    }
+    // Aggregated 20 ms frames spend the saved latency on the wait for the message to fill
+    auto single = MeasureUplink(kTransports[0], 20, 1, bitrate);
+    auto packed = MeasureUplink(kTransports[0], 20, 4, bitrate);
+    CHECK(packed.bits_per_second < single.bits_per_second);
+    CHECK(packed.latency_ms > single.latency_ms);
+}
+
+int main() {
+    TestNegotiation();
+    Benchmark();
+    printf("uplink_frame_duration_test passed\n");
+    return 0;
+}